@@ -13,7 +13,13 @@
  */
 
 
+#include <algorithm>
+#include <chrono>
 #include "cmd.h"
+#include "pixeldecoder.h"
+#include "eventfile.h"
+#include "eventmap.h"
+#include "replay.h"
 
 
 CMD_PROC(showclk)
@@ -448,119 +454,87 @@ CMD_PROC(daqtest2)
 
 
 
-// === Module error rate test
-
-class CEventCounter : public CAnalyzer
-{
-	CEvent* Read();
-public:
-	unsigned int nEvents;
-	unsigned int nPixels;
-	unsigned int nErrors;
-	void Reset() { nEvents = nPixels = nErrors = 0; }
-	CEventCounter() { Reset(); }
-	void Print() { printf("nEvents: %u;  nPixels: %u;  nErrors: %u\n", nEvents, nPixels, nErrors); }
-};
-
-CEvent* CEventCounter::Read()
-{
-	x = Get();
-	nEvents++;
-	if (x->error) nErrors++;
-	for (unsigned int r = 0; r < x->roc.size(); r++)
-		nPixels += x->roc[r].pixel.size();
-	return x;
-}
-
+CMD_PROC(daqreadm)
+{ PROFILING
+	int period;
+	PAR_INT(period,0,65535)
 
-class CEventMap : public CAnalyzer
-{
-	CEvent* Read();
-public:
-	unsigned int nWrongRocCount;
-	unsigned int nWrongAddress;
-	unsigned int map[8][52][80];
-	void Reset();
-	void Report();
-	CEventMap() { Reset(); }
-};
+	CDtbSource src;  src.Logging(false);  src.Threaded(true);
+//	CStreamDump srcdump("xxx_stream.txt");
+	CDataRecordScannerMODD rec;  rec.ZeroCopy(true);
+	CRocRawDataPrinter rawList("xxx_raw.txt");
+	CModDigFlatDecoder decoder;
+	CFlatParallelDecoder pdecoder(decoder);
+	CFlatEventMap pxmap;
+	CFlatEventPrinter evList("xxx_event.txt");
+	evList.ListOnlyErrors(true);
+	CEventFileWriter evFile("xxx_event.bin");
+	CFlatEventCounter counter;
+	CSink<CFlatEvent*> pump;
 
-void CEventMap::Reset()
-{
-	unsigned int r, x, y;
-	for (r=0; r<8; r++) for (x=0; x<52; x++) for (y=0; y<80; y++) map[r][x][y] = 0;
-	nWrongRocCount = nWrongAddress = 0;
-}
+	src >> /* srcdump >> */ rec >> rawList >> pdecoder >> pxmap >> evList >> evFile >> counter >> pump;
 
-void CEventMap::Report()
-{
-	Log.section("PIXELMAP");
-	Log.printf("Errors: RocCount=%u, Address=%u\n", nWrongRocCount, nWrongAddress);
-	int r, x, y;
-	for (r=0; r<8; r++)
-	{
-		Log.printf("ROC %i\n", r);
-		for (y=51; y>=0; y--)
-		{
-			Log.printf("%2i: ", y);
-			for (x=0; x<52; x++)
-			{
-				unsigned int n = map[r][x][y];
-				if (n == 0)           Log.printf("   .");
-				else if (n < 1000)    Log.printf(" %3u", n);
-				else if (n < 1000000) Log.printf("%3uk", n/1000);
-				else                  Log.printf("%3uM", n/10000000);
-			}
-			Log.printf("\n");
-		}
-	}
-}
+	src.OpenModDig(tb, true, 20000000);
+	src.Enable();
+	tb.uDelay(100);
+	tb.Pg_Loop(period);
 
-CEvent* CEventMap::Read()
-{
-	x = Get();
-	bool error = false;
-	if (x->roc.size() == 8)
+	try
 	{
-		for (unsigned int r = 0; r < x->roc.size(); r++)
+		int i=0;
+		while (i++ < 500000 && !keypressed())
 		{
-			unsigned int nP = x->roc[r].pixel.size();
-			for (unsigned int p = 0; p < nP; p++)
+			pump.Get();
+			if (i % 1000 == 0)
 			{
-				unsigned int px = x->roc[r].pixel[p].x;
-				unsigned int py = x->roc[r].pixel[p].y;
-				if (px < 52 && py < 80) map[r][px][py]++;
-				else { nWrongAddress++; error = true; }
+				counter.Print();
+				printf("ring: %u/%u;  stall: reader %0.3f s, decoder %0.3f s\n",
+					src.GetRingFill(), src.GetRingSize(),
+					src.GetReaderStallTime(), src.GetConsumerStallTime());
 			}
 		}
+		src.Disable(); // stop reader thread before accessing DTB
+		tb.Pg_Stop();
+		pxmap.Report();
 	}
-	else { nWrongRocCount++; error = true; }
+	catch (DS_empty &) { printf("finished\n"); }
+	catch (DataPipeException &e) { printf("%s\n", e.what()); }
 
-	if (error) x->error |= 0x0800;
-	return x;
+//	printf("Bytes Transfered: %u\n", srcdump.ByteCount());
+	printf("\n");
+	src.Disable();
+	return true;
 }
 
 
-CMD_PROC(daqreadm)
+CMD_PROC(daqreadmc)
 { PROFILING
-	int period;
+	int period, channels;
 	PAR_INT(period,0,65535)
+	PAR_INT(channels,1,MERGER_MAX_CHANNELS)
 
-	CDtbSource src;  src.Logging(false);
-//	CStreamDump srcdump("xxx_stream.txt");
-	CDataRecordScannerMODD rec;
-	CRocRawDataPrinter rawList("xxx_raw.txt");
-	CModDigDecoder decoder;
-	CEventMap pxmap;
+	CDtbSource src[MERGER_MAX_CHANNELS];
+	CDataRecordScannerMODD rec[MERGER_MAX_CHANNELS];
+	CModDigDecoder decoder[MERGER_MAX_CHANNELS];
+	CModEventMerger merger;
+	CEventMap pxmap(8*channels);
 	CEventPrinter evList("xxx_event.txt");
 	evList.ListOnlyErrors(true);
 	CEventCounter counter;
 	CSink<CEvent*> pump;
 
-	src >> /* srcdump >> */ rec >> rawList >> decoder >> pxmap >> evList >> counter >> pump;
+	int ch;
+	for (ch = 0; ch < channels; ch++)
+	{
+		src[ch].Logging(false);  src[ch].Threaded(true);
+		rec[ch].ZeroCopy(true);
+		src[ch] >> rec[ch] >> decoder[ch];
+		merger.AddChannel(decoder[ch]);
+		src[ch].OpenModDig(tb, true, 20000000, ch);
+	}
+	merger >> pxmap >> evList >> counter >> pump;
 
-	src.OpenModDig(tb, true, 20000000);
-	src.Enable();
+	for (ch = 0; ch < channels; ch++) src[ch].Enable();
 	tb.uDelay(100);
 	tb.Pg_Loop(period);
 
@@ -570,17 +544,56 @@ CMD_PROC(daqreadm)
 		while (i++ < 500000 && !keypressed())
 		{
 			pump.Get();
-			if (i % 1000 == 0) counter.Print();
+			if (i % 1000 == 0)
+			{
+				counter.Print();
+				printf("skipped events: %u\n", merger.GetSkipCount());
+			}
 		}
+		// stop reader threads before accessing DTB
+		for (ch = 0; ch < channels; ch++) src[ch].Disable();
 		tb.Pg_Stop();
 		pxmap.Report();
 	}
 	catch (DS_empty &) { printf("finished\n"); }
 	catch (DataPipeException &e) { printf("%s\n", e.what()); }
 
-//	printf("Bytes Transfered: %u\n", srcdump.ByteCount());
 	printf("\n");
-	src.Disable();
+	for (ch = 0; ch < channels; ch++) src[ch].Disable();
+	return true;
+}
+
+
+CMD_PROC(evlist)
+{
+	char filename[256], listname[256];
+	int first, count, onlyErrors;
+	PAR_STRING(filename, 255);
+	PAR_STRING(listname, 255);
+	if (!PAR_IS_INT(first, 0, 0x7fffffff)) first = 0;
+	if (!PAR_IS_INT(count, 1, 0x7fffffff)) count = 0x7fffffff;
+	if (!PAR_IS_INT(onlyErrors, 0, 1)) onlyErrors = 0;
+
+	CEventFileReader src;
+	if (!src.Open(filename))
+	{
+		printf("Could not open event file %s\n", filename);
+		return true;
+	}
+	printf("%u events\n", src.GetEventCount());
+	src.Seek(first);
+	src.ReadOnlyErrors(onlyErrors != 0);
+
+	CFlatEventPrinter evList(listname);
+	CSink<CFlatEvent*> pump;
+	src >> evList >> pump;
+
+	try
+	{
+		for (int i = 0; i < count; i++) pump.Get();
+	}
+	catch (DS_empty &) {}
+	catch (DataPipeException &e) { printf("%s\n", e.what()); }
 	return true;
 }
 
@@ -690,8 +703,11 @@ CMD_PROC(analyze)
 
 	CDtbSource src;
 	src.Logging(true);
-	CStreamDump srcdump("streamdump.txt");
+	CStreamRecorder srcdump;
+	srcdump.SetInfo(tb.GetBoardId(), RAW_DESER160, settings.deser160_tinDelay);
+	srcdump.Open("streamdump.bin");
 	CDataRecordScannerROC rec;
+	rec.ZeroCopy(true);
 	CRocRawDataPrinter rawList("raw.txt");
 
 //	CSink<CDataRecord*> pump;
@@ -735,6 +751,187 @@ CMD_PROC(analyze)
 }
 
 
+// === record scanner benchmark =============================================
+
+static double Seconds(std::chrono::steady_clock::time_point t0)
+{
+	return std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+}
+
+
+template <class Scanner>
+static void ScanBenchRun(const char *name, CMemorySource &src, int loops,
+	bool markerSearch, MarkerSearchKernel kernel)
+{
+	Scanner rec;
+	rec.ZeroCopy(true);
+	rec.MarkerSearch(markerSearch, kernel);
+	CSink<CDataRecord*> pump;
+	src >> rec >> pump;
+
+	unsigned int records = 0;
+	std::chrono::steady_clock::time_point t0 = std::chrono::steady_clock::now();
+	for (int i = 0; i < loops; i++)
+	{
+		src.Rewind();
+		try { while (true) { pump.Get(); records++; } }
+		catch (DS_empty &) {}
+	}
+	double t = Seconds(t0);
+	double words = double(src.Data().size())*loops;
+	printf("  scanner %-8s %8.1f Mwords/s %8.3f Mrecords/s\n",
+		name, words/t*1e-6, records/t*1e-6);
+}
+
+
+CMD_PROC(scanbench)
+{
+	char filename[256];
+	int module, loops;
+	PAR_STRING(filename, 255);
+	PAR_INT(module, 0, 1);
+	if (!PAR_IS_INT(loops, 1, 100000)) loops = 10;
+
+	CMemorySource src;
+	if ((!src.LoadRawFile(filename) && !src.LoadStreamDump(filename)) || src.Data().empty())
+	{
+		printf("Could not read raw data file or stream dump %s\n", filename);
+		return true;
+	}
+	const vector<uint16_t> &data = src.Data();
+	printf("%u words, %i loops\n", (unsigned int)data.size(), loops);
+
+	CMarkerSpec spec = module ?
+		CMarkerSpec(0x00f0, 0x0080, 0x00f0, 0x00f0) :
+		CMarkerSpec(0x8000, 0x8000, 0x4000, 0x4000);
+	vector<uint32_t> pos(SCANNER_BLOCK_SIZE);
+
+	MarkerSearchKernel kernel[3] = { MARKER_SCALAR, MARKER_SSE2, MARKER_AVX2 };
+	int k;
+	for (k = 0; k < 3; k++)
+	{
+		if (!MarkerKernelSupported(kernel[k])) continue;
+		unsigned int markers = 0;
+		std::chrono::steady_clock::time_point t0 = std::chrono::steady_clock::now();
+		for (int i = 0; i < loops; i++)
+			for (unsigned int p = 0; p < data.size(); p += SCANNER_BLOCK_SIZE)
+			{
+				unsigned int n = data.size() - p;
+				if (n > SCANNER_BLOCK_SIZE) n = SCANNER_BLOCK_SIZE;
+				markers += FindMarkers(data.data() + p, n, spec, pos.data(), kernel[k]);
+			}
+		double t = Seconds(t0);
+		printf("  kernel  %-8s %8.1f Mwords/s  %u markers\n", MarkerKernelName(kernel[k]),
+			double(data.size())*loops/t*1e-6, markers/loops);
+	}
+
+	if (module) ScanBenchRun<CDataRecordScannerMODD>("per word", src, loops, false, MARKER_SCALAR);
+	else        ScanBenchRun<CDataRecordScannerROC> ("per word", src, loops, false, MARKER_SCALAR);
+	for (k = 0; k < 3; k++)
+	{
+		if (!MarkerKernelSupported(kernel[k])) continue;
+		if (module) ScanBenchRun<CDataRecordScannerMODD>(MarkerKernelName(kernel[k]), src, loops, true, kernel[k]);
+		else        ScanBenchRun<CDataRecordScannerROC> (MarkerKernelName(kernel[k]), src, loops, true, kernel[k]);
+	}
+	return true;
+}
+
+
+// === pixel decoder benchmark ==============================================
+
+CMD_PROC(pixbench)
+{
+	int loops;
+	if (!PAR_IS_INT(loops, 1, 10000)) loops = 100;
+
+	// check all raw words against the reference decoder
+	unsigned int r, nBad = 0;
+	for (r = 0; r < (1 << 24); r++)
+	{
+		CRocPixel a, b;
+		a.raw = b.raw = r;
+		a.DecodeRaw();
+		DecodeRawPixel(b);
+		if (a.x != b.x || a.y != b.y || a.ph != b.ph || a.error != b.error) nBad++;
+	}
+	printf("table decoder: %u of %u raw words differ\n", nBad, 1 << 24);
+
+	// random pixels, mostly valid addresses
+	const unsigned int n = 4096;
+	vector<uint32_t> raw(n);
+	vector<CRocPixel> pixel(n);
+	vector<uint8_t> px(n), ph(n);
+	vector<int8_t> py(n);
+	vector<uint16_t> error(n);
+	srand(1);
+	unsigned int i;
+	for (i = 0; i < n; i++)
+	{
+		raw[i] = 0;
+		for (int d = 0; d < 5; d++) raw[i] = raw[i]*8 + rand() % ((i % 64) ? 6 : 8);
+		raw[i] = (raw[i] << 9) + (rand() & 0x1ef);
+	}
+
+	double words = double(n)*loops;
+	int loop;
+	std::chrono::steady_clock::time_point t0 = std::chrono::steady_clock::now();
+	for (loop = 0; loop < loops; loop++)
+		for (i = 0; i < n; i++) { pixel[i].raw = raw[i]; pixel[i].DecodeRaw(); }
+	printf("  DecodeRaw          %8.1f Mpixel/s\n", words/Seconds(t0)*1e-6);
+
+	t0 = std::chrono::steady_clock::now();
+	for (loop = 0; loop < loops; loop++)
+	{
+		for (i = 0; i < n; i++) pixel[i].raw = raw[i];
+		DecodeRawPixels(pixel.data(), n);
+	}
+	printf("  table, CRocPixel   %8.1f Mpixel/s\n", words/Seconds(t0)*1e-6);
+
+	t0 = std::chrono::steady_clock::now();
+	for (loop = 0; loop < loops; loop++)
+		DecodeRawPixels(raw.data(), n, px.data(), py.data(), ph.data(), error.data());
+	printf("  table, arrays      %8.1f Mpixel/s\n", words/Seconds(t0)*1e-6);
+	return true;
+}
+
+
+// === offline replay =======================================================
+
+CMD_PROC(replay)
+{
+	char filename[256], chainName[16];
+	int workers, flat, first, count;
+	PAR_STRING(filename, 255);
+	PAR_STRING(chainName, 15);
+	if (!PAR_IS_INT(workers, 0, 64)) workers = 0;
+	if (!PAR_IS_INT(flat, 0, 1)) flat = 0;
+	if (!PAR_IS_INT(first, 0, 0x7fffffff)) first = 0;
+	if (!PAR_IS_INT(count, 1, 0x7fffffff)) count = 0;
+
+	CReplayOptions options;
+	if (!ReplayChainFromName(chainName, options.chain))
+	{
+		printf("Unknown chain %s (rocdig, rocana, modd)\n", chainName);
+		return true;
+	}
+	options.workers = workers;
+	options.flat = flat != 0;
+	options.firstRecord = first;
+	options.recordCount = count;
+
+	CReplayStats stats;
+	if (!Replay(filename, options, stats))
+	{
+		printf("Could not replay %s\n", filename);
+		return true;
+	}
+	printf("replay %s (%s%s, %i workers)\n", filename,
+		ReplayChainName(options.chain), options.flat ? " flat" : "", workers);
+	stats.Print(stdout);
+	return true;
+}
+
+
 CMD_PROC(ethsend)
 {
 	char msg[45];
@@ -31,8 +31,13 @@ CMD_REG(vectortest, "<length>", "send/receive a vector")
 CMD_REG(daqtest, "", "test DAQ read function")
 CMD_REG(daqtest2, "", "test DAQ read function in continous mode")
 CMD_REG(daqreadm, "", "read, decode and list continous data stream from module")
+CMD_REG(daqreadmc, "<period> <channels>", "read and merge continous data streams of several module channels")
+CMD_REG(evlist, "<event file> <list file> [<first> [<count> [<errors>]]]", "list events of a binary event file")
 
 CMD_REG(analyze, "", "test analyzer chain")
+CMD_REG(scanbench, "<file> <module> [<loops>]", "benchmark the record scanners on a raw data file or stream dump")
+CMD_REG(pixbench, "[<loops>]", "check and benchmark the table based pixel decoder")
+CMD_REG(replay, "<file> <chain> [<workers> [<flat> [<first> [<count>]]]]", "replay a raw data file through a decoder chain (rocdig, rocana, modd)")
 CMD_REG(ethsend, "<string>", "send <string> in a Ethernet packet")
 CMD_REG(ethrx, "", "shows number of received packets")
 CMD_REG(shmoo, "", "shmoo vx xrange vy ymin yrange")
@@ -17,6 +17,7 @@
  */
 
 #include "cmd.h"
+#include "dtbemu.h"
 
 // =======================================================================
 //  connection, communication, startup commands
@@ -102,6 +103,7 @@ CMD_PROC(open)
 		return true;
 	}
 	printf("DTB %s opened\n", usbId.c_str());
+	ApplyUsbTuning(tb);
 
 	string info;
 	tb.GetInfo(info);
@@ -118,6 +120,117 @@ CMD_PROC(close)
 	return true;
 }
 
+CMD_PROC(emulator)
+{
+	static CDtbEmulator emu;
+
+	if (tb.IsConnected())
+	{
+		printf("Already connected to DTB.\n");
+		return true;
+	}
+
+	char filename[256];
+	emu.ClearDefects();
+	if (PAR_IS_STRING(filename, 255) && !emu.LoadDefects(filename))
+	{
+		printf("Could not read defect list %s\n", filename);
+		return true;
+	}
+
+	tb.OpenEmulator(emu, false);
+	printf("DTB emulator connected\n");
+
+	string info;
+	tb.GetInfo(info);
+	printf("--- DTB info-------------------------------------\n"
+		   "%s"
+		   "-------------------------------------------------\n", info.c_str());
+	return true;
+}
+
+
+CMD_PROC(capture)
+{
+	char filename[256];
+	if (!PAR_IS_STRING(filename, 255))
+	{
+		if (tb.IsCapturing()) printf("RPC capture running\n");
+		else printf("RPC capture off\n");
+		return true;
+	}
+
+	if (strcmp(filename, "stop") == 0)
+	{
+		if (!tb.IsCapturing()) return true;
+		CRpcCaptureTiming t = tb.GetCaptureTiming();
+		if (!tb.CaptureStop()) printf("Error writing RPC capture\n");
+		t.Print(stdout);
+		return true;
+	}
+
+	if (!tb.IsConnected())
+	{
+		printf("Not connected to DTB.\n");
+		return true;
+	}
+	if (!tb.CaptureStart(filename)) printf("Could not create %s\n", filename);
+	return true;
+}
+
+
+CMD_PROC(rpcreplay)
+{
+	static CRpcReplay replay;
+
+	char filename[256];
+	if (!PAR_IS_STRING(filename, 255))
+	{
+		if (!tb.IsReplay())
+		{
+			printf("No RPC replay connected.\n");
+			return true;
+		}
+		printf("captured:  ");
+		replay.GetCapturedTiming().Print(stdout);
+		printf("replayed:  %llu bytes sent%s, %0.3f s\n",
+			(unsigned long long)replay.BytesSent(),
+			replay.Mismatch() ? ", mismatch" : (replay.Complete() ? ", complete" : ""),
+			replay.ReplayTime());
+		return true;
+	}
+
+	if (tb.IsConnected())
+	{
+		printf("Already connected to DTB.\n");
+		return true;
+	}
+	if (!replay.Load(filename))
+	{
+		printf("Could not read RPC capture %s\n", filename);
+		return true;
+	}
+	tb.OpenReplay(replay, false);
+	printf("RPC replay connected (%u call ids)\n", (unsigned int)replay.GetCallIds().size());
+	return true;
+}
+
+
+CMD_PROC(iothread)
+{
+	char s[8];
+	if (PAR_IS_STRING(s, 7))
+	{
+		bool ok = true;
+		if (strcmp(s, "on") == 0) ok = tb.IoThreadStart();
+		else if (strcmp(s, "off") == 0) ok = tb.IoThreadStop();
+		else { printf("on or off expected\n"); return true; }
+		if (!ok) printf("Not possible while capturing.\n");
+	}
+	printf("I/O thread %s\n", tb.IsIoThread() ? "on" : "off");
+	return true;
+}
+
 
 CMD_PROC(rpclink)
 {
@@ -258,6 +371,53 @@ CMD_PROC(rpcinfo)
 	return true;
 }
 
+CMD_PROC(rpcstat)
+{
+	char s[16];
+	if (PAR_IS_STRING(s, 15))
+	{
+		if (strcmp(s, "on") == 0) RpcStat.Enable(true);
+		else if (strcmp(s, "off") == 0) RpcStat.Enable(false);
+		else if (strcmp(s, "reset") == 0) RpcStat.Clear();
+		else printf("on, off or reset expected\n");
+		return true;
+	}
+
+	vector<string> names;
+	tb.GetRpcCallNames(names);
+	RpcStat.Print(stdout, names);
+	if (!RpcStat.IsEnabled()) printf("(statistics off)\n");
+	return true;
+}
+
+CMD_PROC(usbtune)
+{
+	char s[16];
+	if (PAR_IS_STRING(s, 15))
+	{
+		if (strcmp(s, "show") == 0) tb.GetUsbTuning().Print(stdout);
+		else if (strcmp(s, "default") == 0) tb.SetUsbTuning(CUsbTuning());
+		else printf("show or default expected\n");
+		return true;
+	}
+
+	CUsbTuning best;
+	if (!UsbTune(tb, best))
+	{
+		printf("USB tuning failed\n");
+		return true;
+	}
+	printf("selected: ");
+	best.Print(stdout);
+
+	int id = tb.GetBoardId();
+	if (settings.WriteUsbTuning(USBTUNING_FILE, id, best))
+		printf("stored for board %i in %s\n", id, USBTUNING_FILE);
+	else
+		printf("error writing %s\n", USBTUNING_FILE);
+	return true;
+}
+
 CMD_PROC(info)
 {
 	string s;
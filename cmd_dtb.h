@@ -26,12 +26,18 @@ HELP_CAT("dtb");
 CMD_REG(scan, "", "Get infos of all connected DTBs")
 CMD_REG(open, "[<name>]", "open a DTB (with name)")
 CMD_REG(close, "", "close DTB connection")
+CMD_REG(emulator, "[<defect list>]", "connect the software DTB (one digital ROC)")
+CMD_REG(capture, "[<file>|stop]", "record the RPC traffic to a file")
+CMD_REG(rpcreplay, "[<file>]", "connect a RPC capture instead of the DTB / show replay status")
+CMD_REG(iothread, "[on|off]", "send the RPC requests by a dedicated I/O thread")
 CMD_REG(rpclink, "", "link all DTB functions")
 CMD_REG(welcome, "", "blink with LEDs")
 CMD_REG(setled, "<mask>", "set atb LEDs")
 CMD_REG(log, "<text>", "writes text to log file")
 CMD_REG(upgrade, "<filename>", "upgrade DTB")
 CMD_REG(rpcinfo, "", "list all DTB functions")
+CMD_REG(rpcstat, "[on|off|reset]", "show RPC call statistics (calls, bytes, flushes, round trip time)")
+CMD_REG(usbtune, "[show|default]", "calibrate the USB transport and store it in psi46test.ini")
 CMD_REG(info, "", "show detailed DTB info")
 CMD_REG(ver, "", "shows DTB software version number")
 CMD_REG(version, "", "shows DTB software version")
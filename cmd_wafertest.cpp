@@ -13,7 +13,9 @@
  */
 
 
+#include <mutex>
 #include "cmd.h"
+#include "multitest.h"
 
 
 // =======================================================================
@@ -40,6 +42,8 @@ CMD_PROC(roctype)
 
 void GetTimeStamp(char datetime[])
 {
+	static std::mutex timeLock; // localtime, asctime: static buffer
+	std::lock_guard<std::mutex> lock(timeLock);
 	time_t t;
 	struct tm *dt;
 	time(&t);
@@ -225,6 +229,43 @@ CMD_PROC(test)
 }
 
 
+CMD_PROC(multitest)
+{
+	vector<CMultiTestBoard> boards;
+	char s[256];
+	while (PAR_IS_STRING(s, 255))
+	{
+		CMultiTestBoard b;
+		char *id = strchr(s, ':');
+		if (id) { *id = 0; b.chipId = id + 1; }
+		b.dtb = s;
+		if (b.chipId.empty()) b.chipId = b.dtb;
+		boards.push_back(b);
+	}
+	if (boards.empty())
+	{
+		printf("DTB name expected\n");
+		return true;
+	}
+
+	double t = MultiTest(boards);
+
+	unsigned int chips = 0;
+	printf(" %-12s %-16s %4s %8s\n", "DTB", "chip", "bin", "time[s]");
+	for (unsigned int i = 0; i < boards.size(); i++)
+	{
+		CMultiTestBoard &b = boards[i];
+		printf(" %-12s %-16s ", b.dtb.c_str(), b.chipId.c_str());
+		if (b.ok) { printf("%4i %8.1f\n", b.bin, b.time); chips++; }
+		else printf("%s\n", b.error.c_str());
+	}
+	printf("%u chips in %0.1f s", chips, t);
+	if (t > 0.0) printf(": %0.0f chips/hour", chips*3600.0/t);
+	printf("\n");
+	return true;
+}
+
+
 #define CSX   8050
 #define CSY  10451
 
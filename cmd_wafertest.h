@@ -23,6 +23,7 @@ CMD_REG(pr, "<command>", "send command to prober")
 CMD_REG(sep, "", "prober z-axis separation")
 CMD_REG(contact, "", "prober z-axis contact")
 CMD_REG(test, "<chip id>", "run chip test")
+CMD_REG(multitest, "<dtb>[:<chip id>] ...", "run chip tests on several DTBs in parallel")
 CMD_REG(chippos, "<ABCD>", "move to chip A, B, C or D")
 CMD_REG(go, "init|cont", "start wafer test (press <cr> to stop)")
 CMD_REG(first, "", "go to first die and clear wafer map")
@@ -11,7 +11,7 @@
 
 // === set profiling options ================================================
 // if defined a profiling infos are collected during execution
-// and a report is created after termination (only Windows)
+// and a report (profiler_report.txt) is created after termination
 
 // #define ENABLE_PROFILING
 
@@ -21,7 +21,9 @@
 
 
 // === thread safe CTestboard class =========================================
-// if defined -> CTestboard is thread safe (Boost thread library needed)
+// if defined -> CTestboard is thread safe (each RPC call locks the
+// connection, see rpc_io.h). The I/O thread (CTestboard::IoThreadStart)
+// needs this to serve calls from more than one thread.
 
-// #define ENABLE_MULTITHREADING
+#define ENABLE_MULTITHREADING
 
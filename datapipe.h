@@ -24,14 +24,34 @@ public:
 DATAPIPE_ERROR(DP_not_connected, "Not connected")
 
 
+// === data block ===========================================================
+
+// Contiguous block of samples returned by a block read. The samples are
+// owned by the source and are valid until the next read from that source.
+template <class T>
+struct CDataBlock
+{
+	const T *data;
+	unsigned int size;
+	CDataBlock() : data(0), size(0) {}
+	CDataBlock(const T *p, unsigned int n) : data(p), size(n) {}
+	const T& operator[](unsigned int i) const { return data[i]; }
+};
+
+
 // === data source ==========================================================
 
-// The inheritor must define ReadLast and Read
+// The inheritor must define ReadLast and Read.
+// ReadBlock returns 1..maxSize consecutive samples. Sources with an internal
+// buffer should override it, the default adapter delivers one sample per call.
 template <class T>
 class CSource
 {
+	T blockSample;
 	virtual T ReadLast() = 0;
 	virtual T Read() = 0;
+	virtual CDataBlock<T> ReadBlock(unsigned int maxSize)
+	{ blockSample = Read(); return CDataBlock<T>(&blockSample, 1); }
 public:
 	virtual ~CSource() {}
 
@@ -48,6 +68,7 @@ protected:
 	~CNullSource() {}
     T ReadLast() { throw DP_not_connected(); }
 	T Read()     { return ReadLast();     }
+	CDataBlock<T> ReadBlock(unsigned int maxSize) { throw DP_not_connected(); }
 	template <class TO> friend class CSink;
 };
 
@@ -67,6 +88,7 @@ public:
 
 	T GetLast() { return src->ReadLast(); }
 	T Get()     { return src->Read();     }
+	CDataBlock<T> GetBlock(unsigned int maxSize) { return src->ReadBlock(maxSize); }
 	void GetAll() { while (true) Get(); }
 	template <class TI, class TO> friend void operator >> (CSource<TI> &, CSink<TO> &);
 	template <class TI, class TO> friend CSource<TO>& operator >> (CSource<TI> &in, CDataPipe<TI,TO> &out);
@@ -1,11 +1,35 @@
 // datastream.cpp
 
+#include <string.h>
+#include <chrono>
 #include "datastream.h"
+#include "pixeldecoder.h"
 #include "protocol.h"
 
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
 
 // === Data structures ======================================================
 
+void CDataRecord::Copy(CDataRecord &src)
+{
+	unsigned int n = src.GetSize();
+	data.resize(n);
+	for (unsigned int i = 0; i < n; i++) data[i] = src[i];
+	flags = src.flags;
+	view = 0;
+	viewSize = 0;
+	recordNr = src.recordNr;
+}
+
+
 // error bits:{ ph | x | y | c1 | c0 | r2 | r1 | r0 }
 
 void CRocPixel::DecodeRaw()
@@ -27,7 +51,7 @@ void CRocPixel::DecodeRaw()
 }
 
 
-void CRocPixel::DecodeAna(CAnalogLevelDecoder &dec, uint16_t *v)
+void CRocPixel::DecodeAna(const CAnalogLevelDecoder &dec, uint16_t *v)
 { PROFILING
 	error = 0;
 
@@ -55,7 +79,7 @@ void CAnalogLevelDecoder::Calibrate(int ublackLevel, int blackLevel)
 }
 
 
-int CAnalogLevelDecoder::Translate(uint16_t x)
+int CAnalogLevelDecoder::Translate(uint16_t x) const
 {
 	int y = ExpandSign(x) - level0;
 	if (y >= 0) y += levelS; else y -= levelS;
@@ -63,124 +87,407 @@ int CAnalogLevelDecoder::Translate(uint16_t x)
 }
 
 
-// === CDtbSource (CSource<uint16_t>) ================================
+// === CDataRing ============================================================
 
-bool CDtbSource::Open(CTestboard &dtb, unsigned int dataChannel,
-		bool endless, unsigned int dtbBufferSize)
+void CDataRing::Init(unsigned int minSize)
+{
+	unsigned int n = 1;
+	while (n < minSize) n <<= 1;
+	buffer.resize(n);
+	mask = n - 1;
+	head = tail = 0;
+}
 
-{ PROFILING
-	if (isOpen) Close();
-	if (dataChannel > 8) return false;
-	channel = dataChannel;
-	tb = &dtb;
-	stopAtEmptyData = !endless;
-	dtbFifoSize = dtbBufferSize;
-
-	// --- DTB control/state
-	dtbRemainingSize = 0;
-	dtbState = 0;
-
-	// --- data buffer
-	lastSample = 0;
-	pos = 0;
-	buffer.clear();
 
-	isOpen = tb->Daq_Open(dtbFifoSize, channel) != 0;
-	return isOpen;
+unsigned int CDataRing::Write(const uint16_t *x, unsigned int n)
+{
+	unsigned int h = head.load(std::memory_order_relaxed);
+	unsigned int free = buffer.size() - (h - tail.load(std::memory_order_acquire));
+	if (n > free) n = free;
+
+	unsigned int p = h & mask;
+	unsigned int n1 = buffer.size() - p;
+	if (n1 > n) n1 = n;
+	memcpy(&buffer[p], x, n1*sizeof(uint16_t));
+	if (n > n1) memcpy(&buffer[0], x + n1, (n - n1)*sizeof(uint16_t));
+
+	head.store(h + n, std::memory_order_release);
+	return n;
 }
 
 
-bool CDtbSource::OpenRocAna(CTestboard &dtb, uint8_t tinDelay, uint8_t toutDelay, uint16_t timeout,
-	bool endless, unsigned int dtbBufferSize)
-{ PROFILING
-	if (!Open(dtb, 0, endless, dtbBufferSize)) return false;
-	dtb.Daq_Select_ADC(timeout, // 1..65535
-		0,  // source: tin/tout
-		tinDelay,  // tin delay 0..63
-		toutDelay); // tout delay 0..63
-	dtb.SignalProbeADC(PROBEA_SDATA1, GAIN_4);
-	dtb.uDelay(800); // to stabilize ADC input signal
-	return true;
+CDataBlock<uint16_t> CDataRing::Peek()
+{
+	unsigned int t = tail.load(std::memory_order_relaxed);
+	unsigned int n = head.load(std::memory_order_acquire) - t;
+	unsigned int p = t & mask;
+	if (n > buffer.size() - p) n = buffer.size() - p;
+	return CDataBlock<uint16_t>(buffer.data() + p, n);
 }
 
 
-bool CDtbSource::OpenRocDig(CTestboard &dtb, uint8_t deserAdjust,
-		bool endless, unsigned int dtbBufferSize)
-{ PROFILING
-	if (!Open(dtb, 0, endless, dtbBufferSize)) return false;
-	tb->Daq_Select_Deser160(deserAdjust);
-	return true;
+// === Raw data file ========================================================
+
+static const char rawFileMagic[8] = { 'P','S','I','R','A','W','0','1' };
+
+uint64_t CRawFileInfo::Now()
+{
+	return std::chrono::duration_cast<std::chrono::microseconds>(
+		std::chrono::system_clock::now().time_since_epoch()).count();
 }
 
 
-bool CDtbSource::OpenModDig(CTestboard &dtb, bool endless, unsigned int dtbBufferSize)
-{ PROFILING
-	if (!Open(dtb, 0, endless, dtbBufferSize)) return false;
-	tb->Daq_Select_Deser400();
+bool CRawFileInfo::Write(FILE *f) const
+{
+	uint8_t h[RAW_FILE_HEADER_SIZE];
+	memset(h, 0, RAW_FILE_HEADER_SIZE);
+	uint32_t headerSize = RAW_FILE_HEADER_SIZE, version = RAW_FILE_VERSION;
+	memcpy(h, rawFileMagic, 8);
+	memcpy(h +  8, &headerSize, 4);
+	memcpy(h + 12, &version, 4);
+	memcpy(h + 16, &boardId, 2);
+	h[18] = mode;
+	h[19] = deserPhase;
+	memcpy(h + 20, &fileIndex, 4);
+	memcpy(h + 24, &startTime, 8);
+	memcpy(h + 32, &stopTime, 8);
+	memcpy(h + 40, &dataWords, 8);
+	return fwrite(h, 1, RAW_FILE_HEADER_SIZE, f) == RAW_FILE_HEADER_SIZE;
+}
+
+
+unsigned int CRawFileInfo::Read(const void *data, uint64_t size)
+{
+	const uint8_t *h = (const uint8_t*)data;
+	if (size < 48 || memcmp(h, rawFileMagic, 8) != 0) { *this = CRawFileInfo(); return 0; }
+	uint32_t headerSize;
+	memcpy(&headerSize, h + 8, 4);
+	memcpy(&boardId, h + 16, 2);
+	mode = h[18];
+	deserPhase = h[19];
+	memcpy(&fileIndex, h + 20, 4);
+	memcpy(&startTime, h + 24, 8);
+	memcpy(&stopTime, h + 32, 8);
+	memcpy(&dataWords, h + 40, 8);
+	return headerSize;
+}
+
+
+// === CBinaryFileSource (CSource<uint16_t>) ================================
+
+static const char recordIndexMagic[8] = { 'P','S','I','R','I','D','X','1' };
+
+CBinaryFileSource::CBinaryFileSource()
+	:
+#ifdef _WIN32
+	hFile(INVALID_HANDLE_VALUE), hMap(0),
+#else
+	fd(-1),
+#endif
+	map(0), mapSize(0), data(0), size(0), pos(0), end(0), readahead(0), lastSample(0)
+{}
+
+
+bool CBinaryFileSource::Open(const char *filename)
+{
+	Close();
+	fileName = filename;
+
+#ifdef _WIN32
+	hFile = CreateFileA(filename, GENERIC_READ, FILE_SHARE_READ, 0,
+		OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, 0);
+	if (hFile == INVALID_HANDLE_VALUE) return false;
+	LARGE_INTEGER fileSize;
+	if (!GetFileSizeEx(hFile, &fileSize)) { Close(); return false; }
+	mapSize = fileSize.QuadPart;
+	if (mapSize)
+	{
+		hMap = CreateFileMappingA(hFile, 0, PAGE_READONLY, 0, 0, 0);
+		if (hMap) map = (const uint8_t*)MapViewOfFile(hMap, FILE_MAP_READ, 0, 0, 0);
+		if (!map) { Close(); return false; }
+	}
+#else
+	fd = open(filename, O_RDONLY);
+	if (fd < 0) return false;
+	struct stat st;
+	if (fstat(fd, &st) != 0) { Close(); return false; }
+	mapSize = st.st_size;
+	if (mapSize)
+	{
+		void *p = mmap(0, mapSize, PROT_READ, MAP_SHARED, fd, 0);
+		if (p == MAP_FAILED) { Close(); return false; }
+		map = (const uint8_t*)p;
+		madvise(p, mapSize, MADV_SEQUENTIAL);
+	}
+#endif
+
+	unsigned int headerSize = info.Read(map, mapSize);
+	if (headerSize > mapSize) headerSize = (unsigned int)mapSize;
+	data = (const uint16_t*)(map + headerSize);
+	size = (mapSize - headerSize)/sizeof(uint16_t);
+	SetRange(0, size);
 	return true;
 }
 
 
-bool CDtbSource::OpenSimulator(CTestboard &dtb, bool endless, unsigned int dtbBufferSize)
+void CBinaryFileSource::Close()
+{
+#ifdef _WIN32
+	if (map) UnmapViewOfFile(map);
+	if (hMap) CloseHandle(hMap);
+	if (hFile != INVALID_HANDLE_VALUE) CloseHandle(hFile);
+	hMap = 0;
+	hFile = INVALID_HANDLE_VALUE;
+#else
+	if (map) munmap((void*)map, mapSize);
+	if (fd >= 0) close(fd);
+	fd = -1;
+#endif
+	map = 0;
+	mapSize = 0;
+	data = 0;
+	size = pos = end = readahead = 0;
+	info = CRawFileInfo();
+	recordIndex.clear();
+}
+
+
+void CBinaryFileSource::Seek(uint64_t wordPos)
+{
+	pos = (wordPos < end) ? wordPos : end;
+	readahead = pos;
+}
+
+
+void CBinaryFileSource::SetRange(uint64_t first, uint64_t last)
+{
+	end = (last < size) ? last : size;
+	Seek(first);
+}
+
+
+void CBinaryFileSource::ReadAhead()
+{
+	// ask the kernel for the next FILE_SOURCE_READAHEAD bytes
+	uint64_t first = (readahead > pos) ? readahead : pos;
+	uint64_t last = pos + FILE_SOURCE_READAHEAD/sizeof(uint16_t);
+	if (last > end) last = end;
+	readahead = last;
+	if (first >= last) return;
+#ifndef _WIN32
+	static const uint64_t pageMask = ~uint64_t(sysconf(_SC_PAGESIZE) - 1);
+	const uint8_t *p = (const uint8_t*)(data + first);
+	uint64_t offset = uint64_t(p - map) & pageMask;
+	madvise((void*)(map + offset), (const uint8_t*)(data + last) - (map + offset), MADV_WILLNEED);
+#endif
+}
+
+
+CDataBlock<uint16_t> CBinaryFileSource::ReadBlock(unsigned int maxSize)
 { PROFILING
-	if (!Open(dtb, 0, endless, dtbBufferSize)) return false;
-	tb->Daq_Select_Datagenerator(0);
+	if (pos >= end) throw DS_empty();
+	if (readahead < end && pos + FILE_SOURCE_READAHEAD/sizeof(uint16_t)/2 >= readahead) ReadAhead();
+	uint64_t n = end - pos;
+	if (n > maxSize) n = maxSize;
+	CDataBlock<uint16_t> block(data + pos, (unsigned int)n);
+	pos += n;
+	lastSample = data[pos-1];
+	return block;
+}
+
+
+bool CBinaryFileSource::OpenIndex(uint16_t startMask, uint16_t startValue, bool rebuild)
+{
+	if (!map) return false;
+	if (!rebuild && LoadIndex(startMask, startValue)) return true;
+	return BuildIndex(startMask, startValue);
+}
+
+
+bool CBinaryFileSource::LoadIndex(uint16_t startMask, uint16_t startValue)
+{
+	recordIndex.clear();
+	FILE *f = fopen((fileName + ".idx").c_str(), "rb");
+	if (!f) return false;
+
+	uint8_t h[24];
+	uint16_t mask, value;
+	uint32_t count;
+	uint64_t words;
+	bool ok = fread(h, 1, 24, f) == 24 && memcmp(h, recordIndexMagic, 8) == 0;
+	if (ok)
+	{
+		memcpy(&mask,  h +  8, 2);
+		memcpy(&value, h + 10, 2);
+		memcpy(&count, h + 12, 4);
+		memcpy(&words, h + 16, 8);
+		ok = mask == startMask && value == startValue && words == size;
+	}
+	if (ok)
+	{
+		recordIndex.resize(count);
+		ok = count == 0 || fread(recordIndex.data(), sizeof(uint64_t), count, f) == count;
+	}
+	fclose(f);
+	if (!ok) recordIndex.clear();
+	return ok;
+}
+
+
+bool CBinaryFileSource::BuildIndex(uint16_t startMask, uint16_t startValue)
+{
+	recordIndex.clear();
+	CMarkerSpec spec(startMask, startValue, startMask, startValue);
+	vector<uint32_t> marker(FILE_SOURCE_BLOCK_SIZE);
+	for (uint64_t p = 0; p < size; p += FILE_SOURCE_BLOCK_SIZE)
+	{
+		unsigned int n = (size - p < FILE_SOURCE_BLOCK_SIZE) ? (unsigned int)(size - p) : FILE_SOURCE_BLOCK_SIZE;
+		unsigned int count = FindMarkers(data + p, n, spec, marker.data());
+		for (unsigned int i = 0; i < count; i++) recordIndex.push_back(p + marker[i]);
+	}
+
+	// the index is only a cache: a read only directory is no error
+	FILE *f = fopen((fileName + ".idx").c_str(), "wb");
+	if (!f) return true;
+	uint8_t h[24];
+	uint32_t count = recordIndex.size();
+	uint64_t words = size;
+	memcpy(h, recordIndexMagic, 8);
+	memcpy(h +  8, &startMask, 2);
+	memcpy(h + 10, &startValue, 2);
+	memcpy(h + 12, &count, 4);
+	memcpy(h + 16, &words, 8);
+	fwrite(h, 1, 24, f);
+	if (count) fwrite(recordIndex.data(), sizeof(uint64_t), count, f);
+	fclose(f);
 	return true;
 }
 
 
-void CDtbSource::Close()
-{ PROFILING
-	if (!isOpen) return;
-	tb->Daq_Close(channel);
-	isOpen = false;
+bool CBinaryFileSource::SelectRecords(unsigned int first, unsigned int count)
+{
+	if (first > recordIndex.size()) return false;
+	uint64_t last = (count < recordIndex.size() - first) ? recordIndex[first + count] : size;
+	uint64_t start = (first < recordIndex.size()) ? recordIndex[first] : size;
+	SetRange(start, last);
+	return true;
 }
 
-void CDtbSource::Enable()
-{ PROFILING
-	if (!isOpen) return;
-	tb->Daq_Start(channel);
+
+// === CMemorySource (CSource<uint16_t>) ====================================
+
+CDataBlock<uint16_t> CMemorySource::ReadBlock(unsigned int maxSize)
+{
+	if (pos >= buffer.size()) throw DS_empty();
+	unsigned int n = buffer.size() - pos;
+	if (n > maxSize) n = maxSize;
+	CDataBlock<uint16_t> block(buffer.data() + pos, n);
+	pos += n;
+	return block;
 }
 
-void CDtbSource::Disable()
-{ PROFILING
-	if (!isOpen) return;
-	tb->Daq_Stop(channel);
+
+bool CMemorySource::LoadStreamDump(const char *filename)
+{
+	FILE *f = fopen(filename, "rt");
+	if (!f) return false;
+	buffer.clear();
+	pos = 0;
+	unsigned int x;
+	while (fscanf(f, "%x", &x) == 1) buffer.push_back(uint16_t(x));
+	fclose(f);
+	return true;
 }
 
 
-uint16_t CDtbSource::FillBuffer()
-{ PROFILING
-	if (!isOpen) throw DS_no_dtb_access();
+bool CMemorySource::LoadRawFile(const char *filename)
+{
+	CBinaryFileSource file;
+	if (!file.Open(filename) || !file.HasHeader()) return false;
+	buffer.clear();
+	buffer.reserve(file.GetSize());
 	pos = 0;
-	do
+
+	CSink<uint16_t> sink;
+	file >> sink;
+	try
 	{
-		dtbState = tb->Daq_Read(buffer, DTB_SOURCE_BLOCK_SIZE, dtbRemainingSize, channel);
-		if (logging) printf("%i(%u/%u)\n", int(dtbState), (unsigned int)(buffer.size()), dtbRemainingSize);
-		if (buffer.size() == 0)
+		while (true)
 		{
-			if (stopAtEmptyData) throw DS_empty();
-			if (dtbState & (DAQ_FIFO_OVFL | DAQ_MEM_OVFL)) throw DS_buffer_overflow();
+			CDataBlock<uint16_t> block = sink.GetBlock(FILE_SOURCE_BLOCK_SIZE);
+			buffer.insert(buffer.end(), block.data, block.data + block.size);
 		}
+	}
+	catch (DS_empty &) {}
+	return true;
+}
 
-	} while (buffer.size() == 0);
 
-	return lastSample = buffer[pos++];
+// === CDataRecordScanner (CDataPipe<uint16_t, CRecord*>) ================
+
+void CDataRecordScanner::NextBlock()
+{
+	if (viewActive)
+	{ // record straddles the block boundary -> copy it
+		viewActive = false;
+		for (unsigned int i = viewStart; i < block.size; i++) CopySample(block.data[i]);
+	}
+	block = GetBlock(SCANNER_BLOCK_SIZE);
+	blockPos = 0;
+	markersValid = false;
 }
 
 
-// === CBinaryFileSource (CSource<uint16_t>) ================================
+uint16_t CDataRecordScanner::GetMarker(bool inRecord)
+{
+	while (true)
+	{
+		if (blockPos >= block.size) NextBlock();
+		if (!markersValid)
+		{
+			if (marker.size() < block.size) marker.resize(block.size);
+			markerCount = FindMarkers(block.data, block.size, markerSpec, marker.data(), markerKernel);
+			markerPos = 0;
+			markerDense = markerCount > block.size/4;
+			markersValid = true;
+		}
+		if (markerDense) return lastSample = block.data[blockPos++];
+
+		while (markerPos < markerCount && marker[markerPos] < blockPos) markerPos++;
+		unsigned int next = (markerPos < markerCount) ? marker[markerPos] : block.size;
+		if (inRecord && !viewActive)
+			for (unsigned int i = blockPos; i < next; i++) CopySample(block.data[i]);
+		blockPos = next;
+		if (blockPos < block.size) return lastSample = block.data[blockPos++];
+	}
+}
 
-uint16_t CBinaryFileSource::FillBuffer()
-{ PROFILING
-	pos = 0;
-	do
+
+void CDataRecordScanner::StartRecord()
+{
+	record.recordNr = recCounter++;
+	if (zeroCopy)
 	{
-		buffer.resize(FILE_SOURCE_BLOCK_SIZE);
-		size = fread(buffer.data(), sizeof(uint16_t), FILE_SOURCE_BLOCK_SIZE, f); 
-	} while(size == 0);
+		viewActive = true;
+		viewStart = blockPos - 1;
+	}
+	else CopySample(lastSample);
+}
+
 
-	return lastSample = buffer[pos++];
+void CDataRecordScanner::EndRecord(bool includeCurrent)
+{
+	if (!viewActive) return;
+	viewActive = false;
+
+	unsigned int size = blockPos - viewStart;
+	if (!includeCurrent) size--;
+	if (size > SCANNER_MAX_RECORD_SIZE)
+	{
+		size = SCANNER_MAX_RECORD_SIZE;
+		record.SetOverflow();
+	}
+	record.SetView(block.data + viewStart, size, headerMask);
 }
 
 
@@ -188,26 +495,26 @@ uint16_t CBinaryFileSource::FillBuffer()
 
 CDataRecord* CDataRecordScannerROC::Read()
 { PROFILING
-	record.Clear();
+	ClearRecord();
 
-	if (!nextStartDetected) Get();
+	if (!nextStartDetected) GetCandidate(false);
 	nextStartDetected = false;
 
-	while (!(GetLast() & 0x8000)) Get();
-	record.Add(GetLast() & 0x0fff);
-	record.recordNr = recCounter++;
+	while (!(GetLastSample() & 0x8000)) GetCandidate(false);
+	StartRecord();
 
-	while (!(GetLast() & 0x4000))
+	while (!(GetLastSample() & 0x4000))
 	{
-		if (Get() & 0x8000)
+		if (GetCandidate(true) & 0x8000)
 		{
 			record.SetEndError();
 			nextStartDetected = true;
+			EndRecord(false);
 			return &record;
 		}
-		if (record.GetSize() < 40000) record.Add(GetLast() & 0x0fff);
-		else record.SetOverflow();
+		AddSample();
 	}
+	EndRecord(true);
 	return &record;
 }
 
@@ -216,62 +523,180 @@ CDataRecord* CDataRecordScannerROC::Read()
 
 CDataRecord* CDataRecordScannerMODD::Read()
 { PROFILING
-	record.Clear();
+	ClearRecord();
 
-	if (!nextStartDetected) Get();
+	if (!nextStartDetected) GetCandidate(false);
 	nextStartDetected = false;
 
-	while ((GetLast() & 0x00f0) != 0x0080) Get();
-	record.Add(GetLast());
-	record.recordNr = recCounter++;
+	while ((GetLastSample() & 0x00f0) != 0x0080) GetCandidate(false);
+	StartRecord();
 
-	while ((GetLast() & 0x00f0) != 0x00f0)
+	while ((GetLastSample() & 0x00f0) != 0x00f0)
 	{
-		if ((Get() & 0x00f0) == 0x0080)
+		if ((GetCandidate(true) & 0x00f0) == 0x0080)
 		{
 			record.SetEndError();
 			nextStartDetected = true;
+			EndRecord(false);
 			return &record;
 		}
-		if (record.GetSize() < 40000) record.Add(GetLast() & 0x0fff);
-		else record.SetOverflow();
+		AddSample();
 	}
+	EndRecord(true);
 	return &record;
 }
 
 
 // === CStreamDump (uint16_t, uint16_t) ==============
 
+void CStreamDump::Dump(uint16_t value)
+{
+	if (row < 15)
+	{
+		fprintf(f, "%04X ", (unsigned int)value);
+		row++;
+	}
+	else
+	{
+		fprintf(f, "%04X\n", (unsigned int)value);
+		row = 0;
+	}
+}
+
+
 uint16_t CStreamDump::Read()
 { PROFILING
 	x = Get();
-	if (f)
-	{
-		if (row < 15)
-		{
-			fprintf(f, "%04X ", (unsigned int)x);
-			row++;
-		}
-		else
-		{
-			fprintf(f, "%04X\n", (unsigned int)x);
-			row = 0;
-		}
-	}
+	if (f) Dump(x);
 	return x;
 }
 
 
-// === CStreamErrorDump (uint16_t, uint16_t) ==============
+CDataBlock<uint16_t> CStreamDump::ReadBlock(unsigned int maxSize)
+{ PROFILING
+	CDataBlock<uint16_t> block = GetBlock(maxSize);
+	if (block.size == 0) return block;
+	if (f) for (unsigned int i=0; i<block.size; i++) Dump(block[i]);
+	x = block[block.size-1];
+	return block;
+}
 
 
-uint16_t CStreamErrorDump::Read()
+// === CStreamRecorder (uint16_t, uint16_t) ==============
+
+bool CStreamRecorder::Open(const char *filename)
+{
+	Close();
+	fileName = filename;
+	info.fileIndex = 0;
+	buffer.reserve(RAW_FILE_BLOCK_SIZE/sizeof(uint16_t));
+	return OpenFile();
+}
+
+
+void CStreamRecorder::Close()
+{
+	if (!f) return;
+	Flush();
+	CloseFile();
+}
+
+
+bool CStreamRecorder::OpenFile()
+{
+	string name = fileName;
+	if (maxFileSize)
+	{ // <name>_<n>.<ext>
+		char s[16];
+		sprintf(s, "_%03u", info.fileIndex);
+		size_t ext = name.find_last_of('.');
+		if (ext == string::npos || name.find_first_of("/\\", ext) != string::npos)
+			ext = name.size();
+		name.insert(ext, s);
+	}
+	f = fopen(name.c_str(), "wb");
+	if (!f) return false;
+
+	info.startTime = CRawFileInfo::Now();
+	info.stopTime = 0;
+	info.dataWords = 0;
+	if (info.Write(f)) return true;
+	fclose(f);
+	f = 0;
+	return false;
+}
+
+
+void CStreamRecorder::CloseFile()
+{
+	// complete the header
+	info.stopTime = CRawFileInfo::Now();
+	fseek(f, 0, SEEK_SET);
+	info.Write(f);
+	fclose(f);
+	f = 0;
+}
+
+
+void CStreamRecorder::Flush()
+{
+	if (!f || buffer.empty()) return;
+
+	if (maxFileSize && info.dataWords
+		&& RAW_FILE_HEADER_SIZE + (info.dataWords + buffer.size())*sizeof(uint16_t) > maxFileSize)
+	{ // next file
+		CloseFile();
+		info.fileIndex++;
+		if (!OpenFile()) { buffer.clear(); return; }
+	}
+
+	fwrite(buffer.data(), sizeof(uint16_t), buffer.size(), f);
+	info.dataWords += buffer.size();
+	buffer.clear();
+}
+
+
+void CStreamRecorder::Record(const uint16_t *data, unsigned int size)
+{
+	if (!f) return;
+	const unsigned int blockWords = RAW_FILE_BLOCK_SIZE/sizeof(uint16_t);
+	while (size)
+	{
+		unsigned int n = blockWords - buffer.size();
+		if (n > size) n = size;
+		buffer.insert(buffer.end(), data, data + n);
+		data += n;
+		size -= n;
+		if (buffer.size() >= blockWords) Flush();
+	}
+}
+
+
+uint16_t CStreamRecorder::Read()
 { PROFILING
 	x = Get();
-	if (!f) return x;
+	Record(&x, 1);
+	return x;
+}
+
+
+CDataBlock<uint16_t> CStreamRecorder::ReadBlock(unsigned int maxSize)
+{ PROFILING
+	CDataBlock<uint16_t> block = GetBlock(maxSize);
+	if (block.size == 0) return block;
+	Record(block.data, block.size);
+	x = block[block.size-1];
+	return block;
+}
 
+
+// === CStreamErrorDump (uint16_t, uint16_t) ==============
+
+
+void CStreamErrorDump::Check(uint16_t value)
+{
 	n2++;
-	if (good && (x & 0x3000))
+	if (good && (value & 0x3000))
 	{
 		good = false;
 		fprintf(f, "%7u good\n", n2-n1);
@@ -280,7 +705,7 @@ uint16_t CStreamErrorDump::Read()
 	}
 	else if (!good)
 	{
-		if (!(x & 0x3000)) m++; else m = 0;
+		if (!(value & 0x3000)) m++; else m = 0;
 		if (m > 2)
 		{
 			good = true;
@@ -288,11 +713,27 @@ uint16_t CStreamErrorDump::Read()
 			n1 = n2-2;
 		}
 	}
+}
 
+
+uint16_t CStreamErrorDump::Read()
+{ PROFILING
+	x = Get();
+	if (f) Check(x);
 	return x;
 }
 
 
+CDataBlock<uint16_t> CStreamErrorDump::ReadBlock(unsigned int maxSize)
+{ PROFILING
+	CDataBlock<uint16_t> block = GetBlock(maxSize);
+	if (block.size == 0) return block;
+	if (f) for (unsigned int i=0; i<block.size; i++) Check(block[i]);
+	x = block[block.size-1];
+	return block;
+}
+
+
 // === CRocRawDataPrinter (CDateRecord*, CDataRecord*) =============
 
 
@@ -362,101 +803,116 @@ CDataRecord* CReadBack::Read()
 }
 
 
-// === CRocDigDecoder (CDataRecord*, CEvent*) ===============================
+// === CEventDecoder (CDataRecord*, E*) ====================================
 
-CEvent* CRocDigDecoder::Read()
+template <class E>
+E* CEventDecoderT<E>::Read()
 { PROFILING
-	CDataRecord *sample = Get();
-	x.recordNr = sample->recordNr;
+	Decode(*this->Get(), x);
+	return &x;
+}
+
+template class CEventDecoderT<CEvent>;
+template class CEventDecoderT<CFlatEvent>;
+
+
+// === CRocDigDecoder (CDataRecord*, CEvent*) ===============================
+
+void CRocDigDecoder::Decode(CDataRecord &sample, CEvent &x) const
+{
+	x.recordNr = sample.recordNr;
 	x.deviceType = CEvent::ROCD;
 	x.header = x.trailer = 0;
+	x.error = 0;
 	x.roc.resize(1);
+	x.roc[0].error = 0;
+	x.roc[0].pixel.clear();
 
-	unsigned int n = sample->GetSize();
+	unsigned int n = sample.GetSize();
 	if (n > 0)
 	{
-		if (n > 4) x.roc[0].pixel.reserve((n-1)/2);
-		x.roc[0].header = (*sample)[0];
+		x.roc[0].header = sample[0];
+		unsigned int np = (n-1)/2;
+		x.roc[0].pixel.resize(np);
+		CRocPixel *pix = x.roc[0].pixel.data();
 		unsigned int pos = 1;
-		while (pos < n-1)
+		for (unsigned int i = 0; i < np; i++)
 		{
-			CRocPixel pix;
-			pix.raw =  (*sample)[pos++] << 12;
-			pix.raw += (*sample)[pos++];
-			pix.DecodeRaw();
-			x.roc[0].pixel.push_back(pix);
+			pix[i].raw =  sample[pos++] << 12;
+			pix[i].raw += sample[pos++];
 		}
+		DecodeRawPixels(pix, np);
 	}
-	return &x;
 }
 
 
 // === CRocAnaDecoder (CDataRecord*, CEvent*) ===============================
 
-CEvent* CRocAnaDecoder::Read()
-{ PROFILING
-	CDataRecord *sample = Get();
-	x.recordNr = sample->recordNr;
+void CRocAnaDecoder::Decode(CDataRecord &sample, CEvent &x) const
+{
+	x.recordNr = sample.recordNr;
 	x.deviceType = CEvent::ROCA;
 	x.header = x.trailer = 0;
+	x.error = 0;
 	x.roc.resize(1);
+	x.roc[0].error = 0;
+	x.roc[0].pixel.clear();
 
-	unsigned int n = sample->GetSize();
+	unsigned int n = sample.GetSize();
 	if (n >= 3)
 	{
 		if (n > 15) x.roc[0].pixel.reserve((n-3)/6);
-		x.roc[0].header = CAnalogLevelDecoder::ExpandSign((*sample)[2]);
+		x.roc[0].header = CAnalogLevelDecoder::ExpandSign(sample[2]);
 		unsigned int pos = 3;
+		uint16_t v[6];
 		while (pos+6 <= n)
 		{
 			CRocPixel pix;
 			pix.raw = 0;
-			pix.DecodeAna(dec, &((*sample)[pos]));
+			for (unsigned int i=0; i<6; i++) v[i] = sample[pos++];
+			pix.DecodeAna(dec, v);
 			x.roc[0].pixel.push_back(pix);
-			pos += 6;
 		}
 	}
-	return &x;
 }
 
 
 // === CModDigDecoder (CDataRecord*, CEvent*) ===============================
 
-CEvent* CModDigDecoder::Read()
-{ PROFILING
+void CModDigDecoder::Decode(CDataRecord &sample, CEvent &x) const
+{
 	x.roc.clear();
 
-	CDataRecord *sample = Get();
-	x.recordNr = sample->recordNr;
+	x.recordNr = sample.recordNr;
 	x.deviceType = CEvent::MODD;
 	x.header = x.trailer = 0;
 	x.roc.reserve(8);
 	x.error = 0;
 
 	unsigned int pos = 0;
-	unsigned int size = sample->GetSize();
+	unsigned int size = sample.GetSize();
 	uint16_t v;
 
 	// --- decode TBM header ---------------------------------
 	unsigned int raw = 0;
 
 	// H1
-	v = (pos < size) ? (*sample)[pos++] : 0x100;
+	v = (pos < size) ? sample[pos++] : 0x100;
 	if ((v & 0x1f0) != 0x80) x.error |= 0x0800;
 	raw = v & 0x00f;
 
 	// H2
-	v = (pos < size) ? (*sample)[pos++] : 0x100;
+	v = (pos < size) ? sample[pos++] : 0x100;
 	if ((v & 0x1f0) != 0x90) x.error |= 0x0400;
 	raw = (raw << 4) + (v & 0x00f);
 
 	// H3
-	v = (pos < size) ? (*sample)[pos++] : 0x100;
+	v = (pos < size) ? sample[pos++] : 0x100;
 	if ((v & 0x1f0) != 0xa0) x.error |= 0x0200;
 	raw = (raw << 4) + (v & 0x00f);
 
 	// H4
-	v = (pos < size) ? (*sample)[pos++] : 0x100;
+	v = (pos < size) ? sample[pos++] : 0x100;
 	if ((v & 0x1f0) != 0xb0) x.error |= 0x0100;
 	raw = (raw << 4) + (v & 0x00f);
 
@@ -466,7 +922,7 @@ CEvent* CModDigDecoder::Read()
 	CRocEvent roc;
 
 	// while ROC header
-	v = (pos < size) ? (*sample)[pos++] : 0x100;
+	v = (pos < size) ? sample[pos++] : 0x100;
 	while ((v & 0x1f0) == 0x070) // R7
 	{
 		roc.pixel.clear();
@@ -475,7 +931,7 @@ CEvent* CModDigDecoder::Read()
 
 		int px_error;
 		CRocPixel pixel;
-		v = (pos < size) ? (*sample)[pos++] : 0x100;
+		v = (pos < size) ? sample[pos++] : 0x100;
 		while ((v & 0x1f0) <= 0x060) // R1 ... R6
 		{
 			px_error = 0;
@@ -491,14 +947,15 @@ CEvent* CModDigDecoder::Read()
 						roc.error |= 0x0001;
 						roc.pixel.push_back(pixel);
 						x.roc.push_back(roc);
-						v = (pos < size) ? (*sample)[pos++] : 0x100;
+						x.error |= 0x0001;
+						v = (pos < size) ? sample[pos++] : 0x100;
 						goto trailer;
 					}
 				}
 				pixel.raw = (pixel.raw << 4) + (v & 0x00f);
-				v = (pos < size) ? (*sample)[pos++] : 0x100;
+				v = (pos < size) ? sample[pos++] : 0x100;
 			}
-			pixel.DecodeRaw();
+			DecodeRawPixel(pixel);
 			pixel.error |= (px_error << 7);
 			if (pixel.error) roc.error |= 0x0001;
 			roc.pixel.push_back(pixel);
@@ -516,41 +973,422 @@ CEvent* CModDigDecoder::Read()
 	raw = v & 0x00f;
 
 	// T2
-	v = (pos < size) ? (*sample)[pos++] : 0x100;
+	v = (pos < size) ? sample[pos++] : 0x100;
+	if ((v & 0x1f0) != 0xd0) x.error |= 0x0040;
+	raw = (raw << 4) + (v & 0x00f);
+
+	// T3
+	v = (pos < size) ? sample[pos++] : 0x100;
+	if ((v & 0x1f0) != 0xe0) x.error |= 0x0020;
+	raw = (raw << 4) + (v & 0x00f);
+
+	// T4
+	v = (pos < size) ? sample[pos++] : 0x100;
+	if ((v & 0x1f0) != 0xf0) x.error |= 0x0010;
+	raw = (raw << 4) + (v & 0x00f);
+
+	x.trailer = raw;
+}
+
+
+// === CFlatEvent ===========================================================
+
+void CFlatEvent::Clear()
+{
+	rocHeader.clear();
+	rocError.clear();
+	rocOffset.clear();
+	rocOffset.push_back(0);
+	raw.clear();
+	rawError.clear();
+}
+
+
+void CFlatEvent::DecodePixels()
+{
+	unsigned int n = raw.size();
+	x.resize(n);
+	y.resize(n);
+	ph.resize(n);
+	pixelError.resize(n);
+	DecodeRawPixels(raw.data(), n, x.data(), y.data(), ph.data(), pixelError.data());
+	for (unsigned int i = 0; i < n; i++) pixelError[i] |= rawError[i];
+}
+
+
+// === CRocDigFlatDecoder (CDataRecord*, CFlatEvent*) =======================
+
+void CRocDigFlatDecoder::Decode(CDataRecord &sample, CFlatEvent &x) const
+{
+	x.Clear();
+	x.recordNr = sample.recordNr;
+	x.deviceType = CEvent::ROCD;
+	x.header = x.trailer = 0;
+	x.error = 0;
+
+	unsigned int n = sample.GetSize();
+	x.AddRoc(n > 0 ? sample[0] : 0);
+	unsigned int pos = 1;
+	while (pos+1 < n)
+	{
+		uint32_t raw = sample[pos++] << 12;
+		raw += sample[pos++];
+		x.AddPixel(raw);
+	}
+	x.DecodePixels();
+}
+
+
+// === CModDigFlatDecoder (CDataRecord*, CFlatEvent*) =======================
+
+void CModDigFlatDecoder::Decode(CDataRecord &sample, CFlatEvent &x) const
+{
+	x.Clear();
+	x.recordNr = sample.recordNr;
+	x.deviceType = CEvent::MODD;
+	x.header = x.trailer = 0;
+	x.error = 0;
+
+	unsigned int pos = 0;
+	unsigned int size = sample.GetSize();
+	uint16_t v;
+
+	// --- decode TBM header ---------------------------------
+	unsigned int raw = 0;
+
+	// H1
+	v = (pos < size) ? sample[pos++] : 0x100;
+	if ((v & 0x1f0) != 0x80) x.error |= 0x0800;
+	raw = v & 0x00f;
+
+	// H2
+	v = (pos < size) ? sample[pos++] : 0x100;
+	if ((v & 0x1f0) != 0x90) x.error |= 0x0400;
+	raw = (raw << 4) + (v & 0x00f);
+
+	// H3
+	v = (pos < size) ? sample[pos++] : 0x100;
+	if ((v & 0x1f0) != 0xa0) x.error |= 0x0200;
+	raw = (raw << 4) + (v & 0x00f);
+
+	// H4
+	v = (pos < size) ? sample[pos++] : 0x100;
+	if ((v & 0x1f0) != 0xb0) x.error |= 0x0100;
+	raw = (raw << 4) + (v & 0x00f);
+
+	x.header = raw;
+
+	// --- collect raw ROC data ------------------------------
+
+	// while ROC header
+	v = (pos < size) ? sample[pos++] : 0x100;
+	while ((v & 0x1f0) == 0x070) // R7
+	{
+		x.AddRoc(v & 0x00f);
+
+		v = (pos < size) ? sample[pos++] : 0x100;
+		while ((v & 0x1f0) <= 0x060) // R1 ... R6
+		{
+			int px_error = 0;
+			uint32_t pixel = 0;
+			for (unsigned int i=1; i<=6; i++)
+			{
+				if (((v & 0x1f0)>>4) != i) // R<i>
+				{
+					px_error |= (1<<i);
+					if (v & 0x080)
+					{
+						x.AddPixel(0, 0x1fff);
+						v = (pos < size) ? sample[pos++] : 0x100;
+						goto trailer;
+					}
+				}
+				pixel = (pixel << 4) + (v & 0x00f);
+				v = (pos < size) ? sample[pos++] : 0x100;
+			}
+			x.AddPixel(pixel, px_error << 7);
+		}
+	}
+
+	// --- decode TBM trailer --------------------------------
+	trailer:
+	raw = 0;
+
+	// T1
+	if ((v & 0x1f0) != 0xc0) x.error |= 0x0080;
+	raw = v & 0x00f;
+
+	// T2
+	v = (pos < size) ? sample[pos++] : 0x100;
 	if ((v & 0x1f0) != 0xd0) x.error |= 0x0040;
 	raw = (raw << 4) + (v & 0x00f);
 
 	// T3
-	v = (pos < size) ? (*sample)[pos++] : 0x100;
+	v = (pos < size) ? sample[pos++] : 0x100;
 	if ((v & 0x1f0) != 0xe0) x.error |= 0x0020;
 	raw = (raw << 4) + (v & 0x00f);
 
 	// T4
-	v = (pos < size) ? (*sample)[pos++] : 0x100;
+	v = (pos < size) ? sample[pos++] : 0x100;
 	if ((v & 0x1f0) != 0xf0) x.error |= 0x0010;
 	raw = (raw << 4) + (v & 0x00f);
 
 	x.trailer = raw;
 
+	// --- decode pixels -------------------------------------
+	x.DecodePixels();
+	for (unsigned int r = 0; r < x.RocCount(); r++)
+	{
+		for (unsigned int i = x.rocOffset[r]; i < x.rocOffset[r+1]; i++)
+			if (x.pixelError[i]) { x.rocError[r] = 1; break; }
+		if (x.rocError[r]) x.error |= 0x0001;
+	}
+}
+
+
+// === CParallelDecoder (CDataRecord*, E*) =================================
+
+template <class E>
+CParallelDecoderT<E>::CParallelDecoderT(const CEventDecoderT<E> &eventDecoder, unsigned int workers)
+	: decoder(eventDecoder), nWorkers(workers),
+	head(0), nextJob(0), tail(0), tailPos(0), last(0),
+	eof(false), readAhead(true), stop(false)
+{
+	if (nWorkers == 0) nWorkers = std::thread::hardware_concurrency();
+	if (nWorkers == 0) nWorkers = 2;
+
+	// enough batches to keep all workers busy while the oldest
+	// batch is emitted
+	batch.resize(4*nWorkers);
+	for (unsigned int i = 0; i < batch.size(); i++)
+	{
+		batch[i].done = false;
+		batch[i].size = 0;
+		batch[i].record.resize(PARALLEL_DECODER_BATCH_SIZE);
+		batch[i].event.resize(PARALLEL_DECODER_BATCH_SIZE);
+	}
+}
+
+
+template <class E>
+void CParallelDecoderT<E>::Start()
+{
+	stop = false;
+	for (unsigned int i = 0; i < nWorkers; i++)
+		worker.push_back(std::thread(&CParallelDecoderT<E>::Worker, this));
+}
+
+
+template <class E>
+void CParallelDecoderT<E>::Stop()
+{
+	{
+		std::lock_guard<std::mutex> guard(lock);
+		stop = true;
+	}
+	jobAvailable.notify_all();
+	for (unsigned int i = 0; i < worker.size(); i++) worker[i].join();
+	worker.clear();
+}
+
+
+template <class E>
+void CParallelDecoderT<E>::Worker()
+{
+	std::unique_lock<std::mutex> guard(lock);
+	while (true)
+	{
+		while (!stop && nextJob == head) jobAvailable.wait(guard);
+		if (stop) return;
+
+		CBatch &b = batch[nextJob++ % batch.size()];
+		guard.unlock();
+		for (unsigned int i = 0; i < b.size; i++)
+			decoder.Decode(b.record[i], b.event[i]);
+		guard.lock();
+		b.done = true;
+		jobDone.notify_one();
+	}
+}
+
+
+template <class E>
+bool CParallelDecoderT<E>::FillBatch()
+{
+	// read records into the next free batch and queue it for decoding,
+	// returns false if the batch was closed by waiting or end of data
+	CBatch &b = batch[head % batch.size()];
+	b.done = false;
+	b.size = 0;
+	bool waited = false;
+	// the clock is read after each record of the tail batch and after
+	// every 8th record read ahead
+	unsigned int mask = tail == head ? 0 : 7;
+	std::chrono::steady_clock::time_point t0 = std::chrono::steady_clock::now(), t1;
+	try
+	{
+		while (b.size < PARALLEL_DECODER_BATCH_SIZE && !waited)
+		{
+			b.record[b.size].Copy(*this->Get());
+			b.size++;
+			if (b.size & mask) continue;
+			t1 = std::chrono::steady_clock::now();
+			waited = t1 - t0 > std::chrono::microseconds(PARALLEL_DECODER_WAIT_US);
+			t0 = t1;
+		}
+	}
+	catch (...)
+	{
+		eof = true;
+		upstreamError = std::current_exception();
+	}
+
+	if (b.size)
+	{
+		{
+			std::lock_guard<std::mutex> guard(lock);
+			head++;
+		}
+		jobAvailable.notify_one();
+	}
+	return !eof && !waited;
+}
+
+
+template <class E>
+void CParallelDecoderT<E>::Fill()
+{
+	// the tail batch must be read, more batches only as long as the
+	// upstream has the records ready
+	while (!eof && head - tail < batch.size())
+	{
+		if (tail != head && !readAhead) break;
+		readAhead = FillBatch();
+	}
+}
+
+
+template <class E>
+E* CParallelDecoderT<E>::Read()
+{ PROFILING
+	if (worker.empty()) Start();
+
+	// release the emitted batch
+	if (tail != head && tailPos >= batch[tail % batch.size()].size)
+	{
+		tail++;
+		tailPos = 0;
+	}
+
+	Fill();
+
+	if (tail == head)
+	{
+		// all records emitted: rethrow the upstream exception
+		std::exception_ptr e = upstreamError;
+		upstreamError = nullptr;
+		eof = false;
+		if (e) std::rethrow_exception(e);
+		throw DS_empty();
+	}
+
+	CBatch &b = batch[tail % batch.size()];
+	{
+		std::unique_lock<std::mutex> guard(lock);
+		while (!b.done) jobDone.wait(guard);
+	}
+	last = &b.event[tailPos++];
+	return last;
+}
+
+template class CParallelDecoderT<CEvent>;
+template class CParallelDecoderT<CFlatEvent>;
+
+
+// === CModEventMerger (n x CEvent*, CEvent*) ===========================
+
+bool CModEventMerger::AddChannel(CSource<CEvent*> &src)
+{
+	if (nChannels >= MERGER_MAX_CHANNELS) return false;
+	src >> in[nChannels++];
+	return true;
+}
+
+
+bool CModEventMerger::Align()
+{
+	for (unsigned int n = 0; n < MERGER_MAX_SKIP; n++)
+	{
+		// most advanced event number (modulo 256) of the channels
+		// with a valid TBM header
+		int ref = -1;
+		unsigned int ch;
+		for (ch = 0; ch < nChannels; ch++)
+		{
+			if (ev[ch]->error & 0x0f00) continue;
+			unsigned int nr = GetEventNr(ev[ch]);
+			if (ref < 0 || int8_t(nr - ref) > 0) ref = nr;
+		}
+		if (ref < 0) return true;
+
+		// skip events of channels lagging behind
+		bool aligned = true;
+		for (ch = 0; ch < nChannels; ch++)
+		{
+			if (ev[ch]->error & 0x0f00) continue;
+			if (GetEventNr(ev[ch]) != (unsigned int)ref)
+			{
+				ev[ch] = in[ch].Get();
+				skipCount++;
+				aligned = false;
+			}
+		}
+		if (aligned) return true;
+	}
+	return false;
+}
+
+
+CEvent* CModEventMerger::Read()
+{ PROFILING
+	if (nChannels == 0) throw DP_not_connected();
+
+	unsigned int ch;
+	for (ch = 0; ch < nChannels; ch++) ev[ch] = in[ch].Get();
+	bool aligned = Align();
+
+	x.recordNr = recCounter++;
+	x.deviceType = CEvent::MODD;
+	x.header = ev[0]->header;
+	x.trailer = ev[0]->trailer;
+	x.error = 0;
+	x.roc.clear();
+	for (ch = 0; ch < nChannels; ch++)
+	{
+		x.error |= ev[ch]->error;
+		x.roc.insert(x.roc.end(), ev[ch]->roc.begin(), ev[ch]->roc.end());
+	}
+	if (!aligned) x.error |= 0x0002;
 	return &x;
 }
 
 
-// === CEventPrinter (CEvent*, CEvent*) ============================
+// === CEventPrinter (E*, E*) ==============================================
 
-CEvent* CEventPrinter::Read()
+template <class E>
+E* CEventPrinterT<E>::Read()
 { PROFILING
-	x = Get();
+	x = this->Get();
 	if (f && (listAll || x->error))
 	{
 		switch (x->deviceType)
 		{
 			case CEvent::ROCA:
 			case CEvent::ROCD:
-				fprintf(f, "%03X(%u):", int(x->header), (unsigned int)(x->roc[0].pixel.size()));
-				for (unsigned int i=0; i<x->roc[0].pixel.size(); i++)
+				fprintf(f, "%03X(%u):", int(x->header), x->PixelCount(0));
+				for (unsigned int i=0; i<x->PixelCount(0); i++)
 				{
-					fprintf(f, " (%2i/%2i/%3i)", x->roc[0].pixel[i].x, x->roc[0].pixel[i].y, x->roc[0].pixel[i].ph);
+					fprintf(f, " (%2i/%2i/%3i)", x->PixelX(0,i), x->PixelY(0,i), x->PixelPh(0,i));
 				}
 				fprintf(f, "\n");
 				break;
@@ -558,12 +1396,12 @@ CEvent* CEventPrinter::Read()
 				fprintf(f, "\nEvent: %u\nHeader: %04X", x->recordNr, (unsigned int)(x->header));
 				if (x->error) fprintf(f, "  ERROR %03x", int(x->error));
 				fprintf(f, "\n");
-				for (unsigned int r = 0; r < x->roc.size(); r++)
+				for (unsigned int r = 0; r < x->RocCount(); r++)
 				{
-					fprintf(f, "  ROC%2u:%c%03X(%3u):", r, x->roc[r].error ? '*':' ', int(x->header), (unsigned int)(x->roc[r].pixel.size()));
-					for (unsigned int i=0; i<x->roc[r].pixel.size(); i++)
+					fprintf(f, "  ROC%2u:%c%03X(%3u):", r, x->RocError(r) ? '*':' ', int(x->header), x->PixelCount(r));
+					for (unsigned int i=0; i<x->PixelCount(r); i++)
 					{
-						fprintf(f, " (%2i/%2i%c%3i)", x->roc[r].pixel[i].x, x->roc[r].pixel[i].y, x->roc[r].error ? '*':'/', x->roc[r].pixel[i].ph);
+						fprintf(f, " (%2i/%2i%c%3i)", x->PixelX(r,i), x->PixelY(r,i), x->RocError(r) ? '*':'/', x->PixelPh(r,i));
 					}
 					fprintf(f, "\n");
 				}
@@ -574,3 +1412,6 @@ CEvent* CEventPrinter::Read()
 	}
 	return x;
 }
+
+template class CEventPrinterT<CEvent>;
+template class CEventPrinterT<CFlatEvent>;
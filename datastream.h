@@ -5,12 +5,19 @@
 #include <stdint.h>
 #include <list>
 #include <vector>
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <exception>
+#include <string>
 
 #include "config.h"
 #include "psi46test.h"
 #include "datapipe.h"
 #include "protocol.h"
 #include "histo.h"
+#include "markersearch.h"
 
 
 using namespace std;
@@ -21,6 +28,7 @@ using namespace std;
 DATAPIPE_ERROR(DS_no_dtb_access, "No DTB connection")
 DATAPIPE_ERROR(DS_buffer_overflow, "Buffer overflow")
 DATAPIPE_ERROR(DS_empty, "Buffer empty")
+DATAPIPE_ERROR(DS_dtb_error, "DTB communication error")
 
 
 // === Binary Data Record Format ============================================
@@ -34,22 +42,33 @@ class CDataRecord
 	*/
 	vector<uint16_t> data;
 	unsigned int flags;
+
+	// --- zero copy record: unmasked view into the data source buffer
+	const uint16_t *view;
+	unsigned int viewSize;
+	uint16_t viewHeaderMask;
 public:
+	CDataRecord() : flags(0), view(0), viewSize(0), viewHeaderMask(0x0fff), recordNr(0) {}
 	void SetStartError() { flags |= 1; }
 	void SetEndError()   { flags |= 2; }
 	void SetOverflow()   { flags |= 4; }
 	void ResetStartError() { flags &= ~1; }
 	void ResetEndError()   { flags &= ~2; }
 	void ResetOverflow()   { flags &= ~4; }
-	void Clear() { flags = 0; data.clear(); }
+	void Clear() { flags = 0; data.clear(); view = 0; viewSize = 0; }
 	bool IsStartError() { return (flags & 1) != 0; }
 	bool IsEndError()   { return (flags & 2) != 0; }
 	bool IsOverflow()   { return (flags & 4) != 0; }
+	bool IsView() { return view != 0; }
 
 	unsigned int recordNr;
 	void Add(uint16_t value) { data.push_back(value); }
-	unsigned int GetSize() { return data.size(); }
-	uint16_t& operator[](int index) { return data[index]; }
+	void Copy(CDataRecord &src);
+	void SetView(const uint16_t *p, unsigned int size, uint16_t headerMask)
+	{ data.clear(); view = p; viewSize = size; viewHeaderMask = headerMask; }
+	unsigned int GetSize() { return view ? viewSize : data.size(); }
+	uint16_t operator[](int index)
+	{ return view ? (view[index] & (index ? 0x0fff : viewHeaderMask)) : data[index]; }
 };
 
 
@@ -62,8 +81,8 @@ class CAnalogLevelDecoder
 public:
 	void Calibrate(int ublackLevel, int blackLevel);
 	static int ExpandSign(uint16_t x) { return (x & 0x0800) ? int(x) - 4096 : int(x); }
-	int Translate(uint16_t x);
-	int CorrectOffset(uint16_t x) { return ExpandSign(x) - level0; }
+	int Translate(uint16_t x) const;
+	int CorrectOffset(uint16_t x) const { return ExpandSign(x) - level0; }
 };
 
 
@@ -75,8 +94,8 @@ struct CRocPixel
 	int x;
 	int y;
 	int ph;
-	void DecodeRaw();
-	void DecodeAna(CAnalogLevelDecoder &dec, uint16_t *x);
+	void DecodeRaw(); // reference, table based version in pixeldecoder.h
+	void DecodeAna(const CAnalogLevelDecoder &dec, uint16_t *x);
 };
 
 
@@ -92,21 +111,107 @@ struct CRocEvent
 struct CEvent
 {
 	unsigned int recordNr;
-// error bits:{ h0 | h1 | h2 | h3 || t0 | t1 | t2 | t3 || 0 | 0 | 0 | pixel }
+// error bits:{ h0 | h1 | h2 | h3 || t0 | t1 | t2 | t3 || 0 | 0 | evnr | pixel }
+// evnr: TBM event numbers of the merged DAQ channels differ
 	int error;
 	enum DeviceType { ROCD, ROCA, MODD, MODA } deviceType;
 	unsigned short header;
 	unsigned short trailer;
 	vector<CRocEvent> roc;
+
+	// --- common access with CFlatEvent
+	unsigned int RocCount() const { return roc.size(); }
+	unsigned int RocHeader(unsigned int r) const { return roc[r].header; }
+	unsigned int RocError(unsigned int r) const { return roc[r].error; }
+	unsigned int PixelCount(unsigned int r) const { return roc[r].pixel.size(); }
+	int PixelX(unsigned int r, unsigned int i) const { return roc[r].pixel[i].x; }
+	int PixelY(unsigned int r, unsigned int i) const { return roc[r].pixel[i].y; }
+	int PixelPh(unsigned int r, unsigned int i) const { return roc[r].pixel[i].ph; }
+};
+
+
+// Flat event layout: the pixels of all ROCs are stored in contiguous
+// arrays, the pixels of ROC r have the indices rocOffset[r] up to
+// rocOffset[r+1]-1. The arrays keep their capacity when the event is
+// cleared, so a reused event does not allocate in steady state.
+
+struct CFlatEvent
+{
+	unsigned int recordNr;
+	int error; // see CEvent
+	CEvent::DeviceType deviceType;
+	unsigned short header;
+	unsigned short trailer;
+
+	// --- ROCs
+	vector<uint16_t> rocHeader;
+	vector<uint8_t>  rocError;
+	vector<uint32_t> rocOffset; // RocCount()+1 entries
+
+	// --- pixels (raw and rawError are filled by the decoder,
+	//     x, y, ph and pixelError by DecodePixels)
+	vector<uint32_t> raw;
+	vector<uint16_t> rawError;
+	vector<uint8_t>  x;
+	vector<int8_t>   y;
+	vector<uint8_t>  ph;
+	vector<uint16_t> pixelError; // see CRocPixel
+
+	CFlatEvent() : recordNr(0), error(0), deviceType(CEvent::ROCD), header(0), trailer(0)
+	{ rocOffset.push_back(0); }
+	void Clear();
+	void AddRoc(uint16_t header)
+	{ rocHeader.push_back(header); rocError.push_back(0); rocOffset.push_back(rocOffset.back()); }
+	void AddPixel(uint32_t rawValue, uint16_t error = 0)
+	{ raw.push_back(rawValue); rawError.push_back(error); rocOffset.back()++; }
+	void DecodePixels();
+
+	unsigned int RocCount() const { return rocHeader.size(); }
+	unsigned int RocHeader(unsigned int r) const { return rocHeader[r]; }
+	unsigned int RocError(unsigned int r) const { return rocError[r]; }
+	unsigned int PixelCount(unsigned int r) const { return rocOffset[r+1] - rocOffset[r]; }
+	unsigned int PixelCount() const { return raw.size(); }
+	int PixelX(unsigned int r, unsigned int i) const { return x[rocOffset[r] + i]; }
+	int PixelY(unsigned int r, unsigned int i) const { return y[rocOffset[r] + i]; }
+	int PixelPh(unsigned int r, unsigned int i) const { return ph[rocOffset[r] + i]; }
 };
 
 
 
 // === Data Sources =========================================================
 
+// --- ring buffer
+
+// Lock free single producer/single consumer ring buffer for samples.
+// The consumer gets the samples as contiguous blocks (Peek) and
+// releases them after use (Release).
+
+class CDataRing
+{
+	vector<uint16_t> buffer;
+	unsigned int mask;
+	std::atomic<unsigned int> head; // write position (producer)
+	std::atomic<unsigned int> tail; // read position (consumer)
+public:
+	CDataRing() : mask(0), head(0), tail(0) {}
+	void Init(unsigned int minSize);
+	unsigned int GetSize() { return buffer.size(); }
+	unsigned int GetFill() { return head.load() - tail.load(); }
+	unsigned int GetFree() { return GetSize() - GetFill(); }
+
+	// --- producer
+	unsigned int Write(const uint16_t *x, unsigned int n);
+
+	// --- consumer
+	CDataBlock<uint16_t> Peek();
+	void Release(unsigned int n) { tail.store(tail.load(std::memory_order_relaxed) + n, std::memory_order_release); }
+};
+
+
 // --- PixelDTB
 
 #define DTB_SOURCE_BLOCK_SIZE 65536
+#define DTB_SOURCE_RING_SIZE  (64*DTB_SOURCE_BLOCK_SIZE)
 
 class CDtbSource : public CSource<uint16_t>
 {
@@ -114,34 +219,59 @@ class CDtbSource : public CSource<uint16_t>
 	bool logging;
 	unsigned int channel;
 	unsigned int dtbFifoSize;
-	volatile bool stopAtEmptyData;
+	std::atomic<bool> stopAtEmptyData;
 
 	// --- DTB control/state
 	CTestboard *tb;
-	uint32_t dtbRemainingSize;
-	uint8_t  dtbState;
+	std::atomic<uint32_t> dtbRemainingSize;
+	std::atomic<uint8_t>  dtbState;
 
 	// --- data buffer
 	uint16_t lastSample;
 	unsigned int pos;
+	unsigned int size;
+	const uint16_t *data;
 	vector<uint16_t> buffer;
-	uint16_t FillBuffer();
+	void FillBuffer();
+
+	// --- threaded mode (reader thread -> ring -> data buffer)
+	enum ReaderExit { READER_STOPPED, READER_EMPTY, READER_OVERFLOW, READER_DTB_ERROR };
+	bool threaded;
+	bool readerStarted;
+	bool dataFromRing;
+	CDataRing ring;
+	std::thread reader;
+	std::atomic<bool> readerStop;
+	std::atomic<bool> readerRunning;
+	std::atomic<int>  readerExit;
+	std::atomic<unsigned long long> readerStall; // us
+	unsigned long long consumerStall; // us
+	void StartReader();
+	void StopReader();
+	void ReaderLoop();
+	bool FillBufferFromRing();
 
 	// --- virtual data access methods
-	uint16_t Read() { return (pos < buffer.size()) ? lastSample = buffer[pos++] : FillBuffer(); }
+	uint16_t Read() { if (pos >= size) FillBuffer(); return lastSample = data[pos++]; }
 	uint16_t ReadLast() { return lastSample; }
+	CDataBlock<uint16_t> ReadBlock(unsigned int maxSize);
 
 	bool Open(CTestboard &dtb, unsigned int dataChannel,
 		bool endless, unsigned int dtbBufferSize);
 public:
-	CDtbSource() : isOpen(false), logging(false) {}
+	CDtbSource() : isOpen(false), logging(false), stopAtEmptyData(false),
+		dtbRemainingSize(0), dtbState(0), pos(0), size(0), data(0),
+		threaded(false), readerStarted(false), dataFromRing(false),
+		readerStop(false), readerRunning(false), readerExit(READER_STOPPED),
+		readerStall(0), consumerStall(0) {}
 	~CDtbSource() { Close(); }
 	
 	bool OpenRocAna(CTestboard &dtb, uint8_t tinDelay, uint8_t toutDelay, uint16_t timeout,
 		bool endless = true, unsigned int dtbBufferSize = 5000000);
 	bool OpenRocDig(CTestboard &dtb, uint8_t deserAdjust,
-		bool endless = true, unsigned int dtbBufferSize = 5000000);
-	bool OpenModDig(CTestboard &dtb, bool endless = true, unsigned int dtbBufferSize = 5000000);
+		bool endless = true, unsigned int dtbBufferSize = 5000000, unsigned int dataChannel = 0);
+	bool OpenModDig(CTestboard &dtb, bool endless = true, unsigned int dtbBufferSize = 5000000,
+		unsigned int dataChannel = 0);
 	bool OpenSimulator(CTestboard &dtb,
 		bool endless = true, unsigned int dtbBufferSize = 5000000);
 
@@ -151,34 +281,146 @@ public:
 	void Disable();
 	void Clear() { Disable(); Enable(); }
 
+	// Threaded mode: a reader thread drains the DTB memory into a ring
+	// buffer. It is started by the first read after Enable and stopped
+	// by Disable/Close. Remaining data after Disable is read directly.
+	// Each RPC call locks the connection of its CTestboard (see rpc_io.h),
+	// so several channels can be read by threaded sources at the same time
+	// and sources of different DTBs do not wait for each other.
+	void Threaded(bool on, unsigned int ringSize = DTB_SOURCE_RING_SIZE);
+
 	// --- control and status
 	uint8_t  GetState() { return dtbState; }
 	uint32_t GetRemainingSize() { return dtbRemainingSize; }
 	void Stop() { stopAtEmptyData = true; }
+
+	unsigned int GetRingSize() { return ring.GetSize(); }
+	unsigned int GetRingFill() { return ring.GetFill(); }
+	double GetReaderStallTime() { return readerStall*1e-6; }     // s, ring full
+	double GetConsumerStallTime() { return consumerStall*1e-6; } // s, ring empty
 };
 
 
-// --- File
+// --- Raw data file
+// Binary raw data files start with a header of RAW_FILE_HEADER_SIZE bytes
+// (little endian), followed by the unchanged 16 bit data stream:
+//
+//    0: "PSIRAW01"
+//    8: uint32 header size, uint32 version
+//   16: uint16 DTB board id, uint8 mode (RawDataMode), uint8 deser phase
+//   20: uint32 file index (rotated recordings)
+//   24: uint64 start time, uint64 stop time (us since 1970)
+//   40: uint64 number of data words (0 if not closed)
 
-#define FILE_SOURCE_BLOCK_SIZE 16384
+#define RAW_FILE_HEADER_SIZE 4096
+#define RAW_FILE_VERSION 1
+
+enum RawDataMode { RAW_DESER160 = 0, RAW_DESER400 = 1, RAW_ADC = 2 };
+
+struct CRawFileInfo
+{
+	uint16_t boardId;
+	uint8_t mode;
+	uint8_t deserPhase;
+	uint32_t fileIndex;
+	uint64_t startTime;
+	uint64_t stopTime;
+	uint64_t dataWords;
+	CRawFileInfo() : boardId(0), mode(RAW_DESER160), deserPhase(0),
+		fileIndex(0), startTime(0), stopTime(0), dataWords(0) {}
+	bool Write(FILE *f) const;
+	// header at the start of data; returns the header size (0: no header)
+	unsigned int Read(const void *data, uint64_t size);
+	static uint64_t Now();
+};
+
+
+// --- File
+// The data file is memory mapped and read sequentially (the kernel is
+// advised to read ahead). Raw data files with header are detected and
+// the header is skipped.
+// The optional record index is stored beside the data file (<filename>.idx)
+// and holds the positions of all record start words. With the index a
+// replay can start at any record, and a file can be split into record
+// ranges, each read by its own CBinaryFileSource (e.g. in its own thread).
+//
+//   index file: "PSIRIDX1", uint16 start mask, uint16 start value,
+//               uint32 record count, uint64 data words,
+//               uint64 position[record count] (data words)
+
+#define FILE_SOURCE_BLOCK_SIZE 65536
+#define FILE_SOURCE_READAHEAD (16 << 20)
 
 class CBinaryFileSource : public CSource<uint16_t>
 {
-	FILE *f;
+	string fileName;
+	CRawFileInfo info;
+#ifdef _WIN32
+	void *hFile;
+	void *hMap;
+#else
+	int fd;
+#endif
+	const uint8_t *map;
+	uint64_t mapSize;
+	const uint16_t *data;
+	uint64_t size; // data words
+	uint64_t pos;
+	uint64_t end;
+	uint64_t readahead; // end of the range advised to the kernel
 	uint16_t lastSample;
+	vector<uint64_t> recordIndex;
 
-	unsigned int size;
-	unsigned int pos;
-	vector<uint16_t> buffer;
-	uint16_t FillBuffer();
+	void ReadAhead();
+	bool LoadIndex(uint16_t startMask, uint16_t startValue);
+	bool BuildIndex(uint16_t startMask, uint16_t startValue);
 
-	uint16_t Read() { return (pos < size) ? lastSample = buffer[pos++] : FillBuffer(); }
+	uint16_t Read() { if (pos >= end) throw DS_empty(); return lastSample = data[pos++]; }
 	uint16_t ReadLast() { return lastSample; }
+	CDataBlock<uint16_t> ReadBlock(unsigned int maxSize);
 public:
-	CBinaryFileSource() : f(0), lastSample(0), size(0), pos(0) { buffer.reserve(FILE_SOURCE_BLOCK_SIZE); }
+	CBinaryFileSource();
 	~CBinaryFileSource() { Close(); }
-	bool Open(const char *filename) { return (f = fopen(filename, "rb")) != 0; }
-	void Close() { if (f) { fclose(f); f = 0; } }
+	bool Open(const char *filename);
+	void Close();
+	const CRawFileInfo& GetInfo() { return info; }
+	bool HasHeader() { return (const uint8_t*)data != map; }
+
+	// --- data words
+	uint64_t GetSize() { return size; }
+	uint64_t GetPos() { return pos; }
+	void Seek(uint64_t wordPos);
+	void SetRange(uint64_t first, uint64_t last); // [first, last)
+
+	// --- record index (ROC: 0x8000, 0x8000; module: 0x00f0, 0x0080)
+	// Loads the index file or creates it if it is missing or outdated
+	bool OpenIndex(uint16_t startMask, uint16_t startValue, bool rebuild = false);
+	unsigned int GetRecordCount() { return recordIndex.size(); }
+	uint64_t GetRecordPos(unsigned int n) { return recordIndex[n]; }
+	// reads count records starting with record first
+	bool SelectRecords(unsigned int first, unsigned int count);
+};
+
+
+// === CMemorySource (CSource<uint16_t>) ====================================
+// Serves a data stream from memory, e.g. a stream dump file (hex words
+// as written by CStreamDump) or a raw data file with header (as written
+// by CStreamRecorder). Throws DS_empty at the end of the data.
+
+class CMemorySource : public CSource<uint16_t>
+{
+	vector<uint16_t> buffer;
+	unsigned int pos;
+
+	uint16_t Read() { if (pos >= buffer.size()) throw DS_empty(); return buffer[pos++]; }
+	uint16_t ReadLast() { return pos ? buffer[pos-1] : 0; }
+	CDataBlock<uint16_t> ReadBlock(unsigned int maxSize);
+public:
+	CMemorySource() : pos(0) {}
+	vector<uint16_t>& Data() { return buffer; }
+	bool LoadStreamDump(const char *filename);
+	bool LoadRawFile(const char *filename); // false if no raw file header
+	void Rewind() { pos = 0; }
 };
 
 
@@ -189,14 +431,54 @@ class CStreamDump : public CDataPipe<uint16_t>
 	FILE *f;
 	int row;
 	uint16_t x;
+	void Dump(uint16_t value);
 	uint16_t Read();
 	uint16_t ReadLast() { return x; }
+	CDataBlock<uint16_t> ReadBlock(unsigned int maxSize);
 public:
 	CStreamDump(const char *filename) { row = 0; f = fopen(filename, "wt"); }
 	~CStreamDump() { fclose(f); }
 };
 
 
+// === CStreamRecorder (uint16_t, uint16_t) ==============
+// Records the data stream unchanged to a binary raw data file. The data
+// is written in blocks of RAW_FILE_BLOCK_SIZE bytes. With rotation
+// enabled the recording is split into files of at most maxFileSize
+// bytes named <name>_<n>.<ext>.
+
+#define RAW_FILE_BLOCK_SIZE (1 << 20)
+
+class CStreamRecorder : public CDataPipe<uint16_t>
+{
+	FILE *f;
+	string fileName;
+	uint64_t maxFileSize;
+	CRawFileInfo info;
+	vector<uint16_t> buffer;
+	uint16_t x;
+
+	bool OpenFile();
+	void CloseFile();
+	void Flush();
+	void Record(const uint16_t *data, unsigned int size);
+
+	uint16_t Read();
+	uint16_t ReadLast() { return x; }
+	CDataBlock<uint16_t> ReadBlock(unsigned int maxSize);
+public:
+	CStreamRecorder() : f(0), maxFileSize(0), x(0) {}
+	CStreamRecorder(const char *filename) : f(0), maxFileSize(0), x(0) { Open(filename); }
+	~CStreamRecorder() { Close(); }
+	void SetInfo(uint16_t boardId, RawDataMode mode, uint8_t deserPhase)
+	{ info.boardId = boardId; info.mode = mode; info.deserPhase = deserPhase; }
+	void Rotate(uint64_t maxSize) { maxFileSize = maxSize; }
+	bool Open(const char *filename);
+	void Close();
+	unsigned int GetFileIndex() { return info.fileIndex; }
+};
+
+
 // === CStreamErrorDump (uint16_t, uint16_t) ==============
 
 class CStreamErrorDump : public CDataPipe<uint16_t>
@@ -206,8 +488,10 @@ class CStreamErrorDump : public CDataPipe<uint16_t>
 	unsigned int m, n1, n2;
 
 	uint16_t x;
+	void Check(uint16_t value);
 	uint16_t Read();
 	uint16_t ReadLast() { return x; }
+	CDataBlock<uint16_t> ReadBlock(unsigned int maxSize);
 public:
 	CStreamErrorDump(const char *filename) { good = true; m = n1 = n2 = 0; f = fopen(filename, "wt"); }
 	~CStreamErrorDump() { fclose(f); }
@@ -215,31 +499,105 @@ public:
 };
 
 
-// === CDataRecordScannerROCD (uint16_t, CDataRecord*) ==============
+// === CDataRecordScanner (uint16_t, CDataRecord*) ==============
+// Base class of the record scanners. Reads the data stream in blocks
+// and steps through the samples without a virtual call per sample.
+// In zero copy mode a record is delivered as view into the block of
+// the data source. It is only copied if it straddles a block boundary.
+// The view is valid until the next record is read.
+
+#define SCANNER_BLOCK_SIZE 65536
+#define SCANNER_MAX_RECORD_SIZE 40000
 
-class CDataRecordScannerROC : public CDataPipe<uint16_t, CDataRecord*>
+class CDataRecordScanner : public CDataPipe<uint16_t, CDataRecord*>
 {
+	CDataBlock<uint16_t> block;
+	unsigned int blockPos;
+	uint16_t lastSample;
+
+	bool zeroCopy;
+	bool viewActive;
+	unsigned int viewStart;
+	uint16_t headerMask;
+
+	// --- marker positions of the current block
+	CMarkerSpec markerSpec;
+	bool markerSearch;
+	MarkerSearchKernel markerKernel;
+	bool markersValid;
+	vector<uint32_t> marker;
+	unsigned int markerCount;
+	unsigned int markerPos;
+	bool markerDense; // too many markers: step through the block word by word
+
+	void NextBlock();
+	uint16_t GetMarker(bool inRecord);
+	void CopySample(uint16_t value)
+	{
+		if (record.GetSize() == 0) record.Add(value & headerMask);
+		else if (record.GetSize() < SCANNER_MAX_RECORD_SIZE) record.Add(value & 0x0fff);
+		else record.SetOverflow();
+	}
+protected:
 	unsigned int recCounter;
 	bool nextStartDetected;
 	CDataRecord record;
-	CDataRecord* Read();
+
+	uint16_t GetSample()
+	{
+		if (blockPos >= block.size) NextBlock();
+		return lastSample = block.data[blockPos++];
+	}
+	uint16_t GetLastSample() { return lastSample; }
+
+	// Next sample that may be a record marker. Without marker search
+	// this is the next sample. With marker search the samples between
+	// the markers are skipped (and added to the record if inRecord).
+	uint16_t GetCandidate(bool inRecord)
+	{
+		if (!markerSearch || (markerDense && markersValid && blockPos < block.size))
+			return GetSample();
+		return GetMarker(inRecord);
+	}
+
+	// --- record assembly (the current sample is the one last read)
+	void ClearRecord() { record.Clear(); viewActive = false; }
+	void StartRecord();
+	void AddSample() { if (!viewActive) CopySample(lastSample); }
+	void EndRecord(bool includeCurrent);
+
 	CDataRecord* ReadLast() { return &record; }
+	CDataRecordScanner(uint16_t recordHeaderMask, const CMarkerSpec &markers)
+		: blockPos(0), lastSample(0), zeroCopy(false), viewActive(false), viewStart(0),
+		headerMask(recordHeaderMask), markerSpec(markers), markerSearch(true),
+		markerKernel(MARKER_AUTO), markersValid(false), markerCount(0), markerPos(0), markerDense(false),
+		recCounter(0), nextStartDetected(false) {}
+public:
+	void ZeroCopy(bool on) { zeroCopy = on; }
+	void MarkerSearch(bool on, MarkerSearchKernel kernel = MARKER_AUTO)
+	{ markerSearch = on; markerKernel = kernel; markersValid = false; }
+};
+
+
+// === CDataRecordScannerROCD (uint16_t, CDataRecord*) ==============
+
+class CDataRecordScannerROC : public CDataRecordScanner
+{
+	CDataRecord* Read();
 public:
-	CDataRecordScannerROC() : recCounter(0), nextStartDetected(false) {}
+	CDataRecordScannerROC()
+		: CDataRecordScanner(0x0fff, CMarkerSpec(0x8000, 0x8000, 0x4000, 0x4000)) {}
 };
 
 
 // === CDataRecordScannerMODD (uint16_t, CDataRecord*) ==============
 
-class CDataRecordScannerMODD : public CDataPipe<uint16_t, CDataRecord*>
+class CDataRecordScannerMODD : public CDataRecordScanner
 {
-	unsigned int recCounter;
-	bool nextStartDetected;
-	CDataRecord record;
 	CDataRecord* Read();
-	CDataRecord* ReadLast() { return &record; }
 public:
-	CDataRecordScannerMODD() : recCounter(0), nextStartDetected(false) {}
+	CDataRecordScannerMODD()
+		: CDataRecordScanner(0xffff, CMarkerSpec(0x00f0, 0x0080, 0x00f0, 0x00f0)) {}
 };
 
 
@@ -297,25 +655,40 @@ public:
 };
 
 
+// === CEventDecoder (CDataRecord*, E*) =================================
+// Base class of the record decoders. Decode only depends on the record
+// and may be called by several threads at the same time.
+
+template <class E>
+class CEventDecoderT : public CDataPipe<CDataRecord*, E*>
+{
+	E x;
+	E* Read();
+	E* ReadLast() { return &x; }
+public:
+	virtual void Decode(CDataRecord &sample, E &x) const = 0;
+};
+
+typedef CEventDecoderT<CEvent> CEventDecoder;
+typedef CEventDecoderT<CFlatEvent> CFlatEventDecoder;
+
+
 // === CRocDigDecoder (CDataRecord*, CEvent*) ============================
 
-class CRocDigDecoder : public CDataPipe<CDataRecord*, CEvent*>
+class CRocDigDecoder : public CEventDecoder
 {
-	CEvent x;
-	CEvent* Read();
-	CEvent* ReadLast() { return &x; }
+public:
+	void Decode(CDataRecord &sample, CEvent &x) const;
 };
 
 
 // === CRocAnaDecoder (CDataRecord*, CEvent*) ============================
 
-class CRocAnaDecoder : public CDataPipe<CDataRecord*, CEvent*>
+class CRocAnaDecoder : public CEventDecoder
 {
 	CAnalogLevelDecoder dec;
-	CEvent x;
-	CEvent* Read();
-	CEvent* ReadLast() { return &x; }
 public:
+	void Decode(CDataRecord &sample, CEvent &x) const;
 	void Calibrate(int ublackLevel, int blackLevel)
 	{ dec.Calibrate(ublackLevel, blackLevel); }
 };
@@ -323,11 +696,120 @@ public:
 
 // === CModDigDecoder (CDataRecord*, CEvent*) ============================
 
-class CModDigDecoder : public CDataPipe<CDataRecord*, CEvent*>
+class CModDigDecoder : public CEventDecoder
 {
+public:
+	void Decode(CDataRecord &sample, CEvent &x) const;
+};
+
+
+// === CRocDigFlatDecoder (CDataRecord*, CFlatEvent*) ====================
+
+class CRocDigFlatDecoder : public CFlatEventDecoder
+{
+public:
+	void Decode(CDataRecord &sample, CFlatEvent &x) const;
+};
+
+
+// === CModDigFlatDecoder (CDataRecord*, CFlatEvent*) ====================
+
+class CModDigFlatDecoder : public CFlatEventDecoder
+{
+public:
+	void Decode(CDataRecord &sample, CFlatEvent &x) const;
+};
+
+
+// === CParallelDecoder (CDataRecord*, E*) ===============================
+// Decodes the records with a pool of worker threads. The records are
+// copied into batches, the batches are decoded by the workers and the
+// events are emitted in record order. The decoder must not be connected
+// to a pipe. Upstream exceptions are thrown after all records read
+// before have been emitted.
+// A batch is closed early when an upstream read had to wait for data, and
+// further batches are only read ahead while the upstream delivers without
+// waiting. So the events of a low rate stream are emitted as soon as their
+// record has arrived instead of after a full set of batches (when a fast
+// stream slows down, once after at most 8 records).
+
+#define PARALLEL_DECODER_BATCH_SIZE 64
+#define PARALLEL_DECODER_WAIT_US   200 // an upstream read this long waited for data
+
+template <class E>
+class CParallelDecoderT : public CDataPipe<CDataRecord*, E*>
+{
+	struct CBatch
+	{
+		bool done;
+		unsigned int size;
+		vector<CDataRecord> record;
+		vector<E> event;
+	};
+
+	const CEventDecoderT<E> &decoder;
+	unsigned int nWorkers;
+	vector<std::thread> worker;
+	vector<CBatch> batch;
+
+	// batch sequence numbers: tail <= nextJob <= head
+	unsigned int head;    // next batch to fill
+	unsigned int nextJob; // next batch to decode
+	unsigned int tail;    // batch to emit
+	unsigned int tailPos; // next event in tail batch
+	E *last;
+
+	bool eof;
+	bool readAhead; // last batch was read without waiting
+	std::exception_ptr upstreamError;
+
+	std::mutex lock;
+	std::condition_variable jobAvailable;
+	std::condition_variable jobDone;
+	bool stop;
+
+	void Start();
+	void Stop();
+	void Worker();
+	bool FillBatch();
+	void Fill();
+	E* Read();
+	E* ReadLast() { return last; }
+public:
+	CParallelDecoderT(const CEventDecoderT<E> &eventDecoder, unsigned int workers = 0);
+	~CParallelDecoderT() { Stop(); }
+	unsigned int GetWorkerCount() { return nWorkers; }
+};
+
+typedef CParallelDecoderT<CEvent> CParallelDecoder;
+typedef CParallelDecoderT<CFlatEvent> CFlatParallelDecoder;
+
+
+// === CModEventMerger (n x CEvent*, CEvent*) ============================
+// Merges the events of several DAQ channels of a module into one module
+// event. The channels are aligned by the TBM event number, events of
+// channels lagging behind are skipped.
+
+#define MERGER_MAX_CHANNELS 8
+#define MERGER_MAX_SKIP     16
+
+class CModEventMerger : public CSource<CEvent*>
+{
+	unsigned int nChannels;
+	CSink<CEvent*> in[MERGER_MAX_CHANNELS];
+	CEvent *ev[MERGER_MAX_CHANNELS];
+	unsigned int recCounter;
+	unsigned int skipCount;
+	bool Align();
 	CEvent x;
 	CEvent* Read();
 	CEvent* ReadLast() { return &x; }
+public:
+	CModEventMerger() : nChannels(0), recCounter(0), skipCount(0) {}
+	bool AddChannel(CSource<CEvent*> &src);
+	unsigned int GetChannelCount() { return nChannels; }
+	unsigned int GetSkipCount() { return skipCount; }
+	static unsigned int GetEventNr(CEvent *ev) { return (ev->header >> 8) & 0xff; }
 };
 
 
@@ -342,17 +824,23 @@ protected:
 };
 
 
-// === CRocEventPrinter (CEvent*, CEvent*) ============================
+// === CEventPrinter (CEvent*, CEvent*) ===============================
 
-class CEventPrinter : public CAnalyzer
+template <class E>
+class CEventPrinterT : public CDataPipe<E*>
 {
 	FILE *f;
 	bool listAll;
-	CEvent* Read();
+	E* x;
+	E* Read();
+	E* ReadLast() { return x; }
 public:
-	CEventPrinter(const char *filename) { x = 0; listAll = true; f = fopen(filename, "wt"); }
-	~CEventPrinter() { fclose(f); }
+	CEventPrinterT(const char *filename) { x = 0; listAll = true; f = fopen(filename, "wt"); }
+	~CEventPrinterT() { fclose(f); }
 	void ListOnlyErrors(bool on) { listAll = !on; }
 };
 
+typedef CEventPrinterT<CEvent> CEventPrinter;
+typedef CEventPrinterT<CFlatEvent> CFlatEventPrinter;
+
 
@@ -0,0 +1,1033 @@
+// dtbemu.cpp
+
+#include <string.h>
+#include <stdio.h>
+#include <random>
+#include "pixel_dtb.h"
+#include "synthdata.h"
+#include "dtbemu.h"
+
+
+#define EMU_RPC_TIMESTAMP "DTB emulator"
+#define EMU_FW_VERSION    0x0100
+#define EMU_SW_VERSION    0x0400
+
+
+void CEmuFrame::SetData(unsigned int i, const void *x, unsigned int size)
+{
+	const uint8_t *p = (const uint8_t*)x;
+	data[i].assign(p, p + size);
+}
+
+
+// === CEmuCall =============================================================
+
+bool CEmuCall::Parse(const std::string &callName)
+{
+	name = callName;
+	par.clear();
+	handler = 0;
+	reply = false;
+	requestSize = 0;
+
+	size_t pos = name.rfind('$');
+	if (pos == std::string::npos) return false;
+	pos++;
+	bool first = true;
+	while (pos < name.size())
+	{
+		CEmuParam p;
+		p.comp = -1;
+		if (name[pos] >= '0' && name[pos] <= '5')
+		{
+			p.comp = name[pos] - '0';
+			if (++pos >= name.size()) return false;
+		}
+		switch (name[pos])
+		{
+		case 'v': p.size = 0; break;
+		case 'b':
+		case 'c':
+		case 'C': p.size = 1; break;
+		case 's':
+		case 'S': p.size = 2; break;
+		case 'i':
+		case 'I': p.size = 4; break;
+		case 'l':
+		case 'L': p.size = 8; break;
+		default: return false;
+		}
+		pos++;
+		if (first) { ret = p; first = false; }
+		else par.push_back(p);
+	}
+	if (first) return false;
+
+	reply = ret.size != 0;
+	for (unsigned int i = 0; i < par.size(); i++)
+	{
+		if (par[i].IsOutput()) reply = true;
+		if (par[i].comp < 0) requestSize += par[i].size;
+	}
+	return true;
+}
+
+
+// === CEmuRoc ==============================================================
+
+CEmuRoc::CEmuRoc()
+{
+	// process variation (same chip in every run)
+	std::mt19937 rnd(46);
+	std::normal_distribution<double> thr(0.0, 2.0), phOffset(40.0, 5.0), phGain(220.0, 20.0);
+	for (unsigned int col = 0; col < ROC_NUMCOLS; col++)
+		for (unsigned int row = 0; row < ROC_NUMROWS; row++)
+		{
+			CEmuPixel &p = pixel[col][row];
+			double t = thr(rnd);
+			p.thrOffset = int8_t(t < -6.0 ? -6 : t > 6.0 ? 6 : int(t));
+			p.phOffset = uint8_t(phOffset(rnd));
+			p.phGain = uint8_t(phGain(rnd));
+		}
+	ClearDefects();
+	address = 0;
+	PowerOn();
+}
+
+
+void CEmuRoc::ClearDefects()
+{
+	for (unsigned int col = 0; col < ROC_NUMCOLS; col++)
+		for (unsigned int row = 0; row < ROC_NUMROWS; row++)
+		{
+			CEmuPixel &p = pixel[col][row];
+			p.dead = p.noMask = p.addrError = false;
+			p.trimStuck = 0;
+		}
+	for (unsigned int i = 0; i < ROC_NUMDCOLS; i++) dcolDead[i] = false;
+}
+
+
+void CEmuRoc::PowerOn()
+{
+	memset(dac, 0, sizeof(dac));
+	lastReg = lastData = lastCol = lastRow = 0;
+	for (unsigned int i = 0; i < ROC_NUMDCOLS; i++) dcolEnable[i] = false;
+	for (unsigned int col = 0; col < ROC_NUMCOLS; col++)
+		for (unsigned int row = 0; row < ROC_NUMROWS; row++)
+		{
+			pixel[col][row].trim = 15;
+			pixel[col][row].mask = true;
+			pixel[col][row].cal = false;
+		}
+	calList.clear();
+	rbCount = 0;
+	rbData = 0;
+	Reset();
+}
+
+
+void CEmuRoc::Reset()
+{
+	hits.clear();
+	triggered.clear();
+}
+
+
+bool CEmuRoc::Fires(unsigned int col, unsigned int row, unsigned int trim, unsigned int vcal, bool highRange) const
+{
+	const CEmuPixel &p = pixel[col][row];
+	if (p.dead || dcolDead[col/2]) return false;
+	int t = (trim | p.trimStuck) & 15;
+	int charge = vcal*(highRange ? 7 : 1);
+	int threshold = 120 - dac[VthrComp] + p.thrOffset - dac[Vtrim]*(15 - t)/100;
+	return charge >= threshold;
+}
+
+
+unsigned int CEmuRoc::PulseHeight(unsigned int col, unsigned int row, unsigned int charge) const
+{
+	const CEmuPixel &p = pixel[col][row];
+	unsigned int ph = p.phOffset + charge*p.phGain/1000;
+	return ph > 255 ? 255 : ph;
+}
+
+
+unsigned int CEmuRoc::Readback(double vd, double va, double ia) const
+{
+	// { rocaddr[3:0], sana, s[2:0], data[7:0] }, 16 mV per digit
+	unsigned int sel = dac[0xff] & 15;
+	double x;
+	switch (sel)
+	{
+	case  0: x = lastData; break;
+	case  1: x = lastReg;  break;
+	case  2: x = lastCol;  break;
+	case  3: x = lastRow;  break;
+	case  8: x = vd/0.016; break;
+	case  9: x = va/0.016; break;
+	case 10: x = 2.0*(va < 1.2 ? va : 1.2)/0.016; break;
+	case 11: x = 2.0*1.2/0.016; break;
+	case 12: x = ia*1000.0/(15.0*0.016); break;
+	default: x = 0.0;
+	}
+	unsigned int data = x > 255.0 ? 255 : (unsigned int)(x + 0.5);
+	return (address & 15) << 12 | sel << 8 | data;
+}
+
+
+uint8_t CEmuRoc::NextReadbackBits(double vd, double va, double ia)
+{
+	// one bit per ROC header, MSB first, start marker on the last bit
+	if (rbCount == 0) rbData = Readback(vd, va, ia);
+	uint8_t bits = (rbData >> (15 - rbCount)) & 1;
+	if (rbCount == 15) bits |= 2;
+	rbCount = (rbCount + 1) & 15;
+	return bits;
+}
+
+
+void CEmuRoc::Calibrate(uint64_t t)
+{
+	bool highRange = (dac[CtrlReg] & 0x04) != 0;
+	uint64_t bc = t + EMU_CAL_LATENCY + (dac[CalDel] + 32)/64;
+	for (unsigned int i = 0; i < calList.size(); i++)
+	{
+		unsigned int col = calList[i] / ROC_NUMROWS;
+		unsigned int row = calList[i] % ROC_NUMROWS;
+		const CEmuPixel &p = pixel[col][row];
+		if (!dcolEnable[col/2]) continue;
+		if (p.mask && !p.noMask) continue;
+		if (!Fires(col, row, p.trim, dac[Vcal], highRange)) continue;
+
+		CEmuHit hit;
+		hit.bc = bc;
+		hit.col = col;
+		hit.row = p.addrError ? row ^ 1 : row;
+		hit.ph = PulseHeight(col, row, dac[Vcal]*(highRange ? 7 : 1));
+		hits.push_back(hit);
+	}
+}
+
+
+void CEmuRoc::Trigger(uint64_t t)
+{
+	triggered.push_back(std::vector<CEmuHit>());
+	if (triggered.size() > 32) triggered.pop_front(); // trigger stack full
+
+	unsigned int wbc = dac[WBC];
+	if (t < wbc) return;
+	uint64_t bc = t - wbc;
+	std::vector<CEmuHit> &ev = triggered.back();
+	unsigned int k = 0;
+	for (unsigned int i = 0; i < hits.size(); i++)
+	{
+		if (hits[i].bc == bc) ev.push_back(hits[i]);
+		else if (hits[i].bc > bc) hits[k++] = hits[i];
+	}
+	hits.resize(k);
+}
+
+
+// === CDtbEmulator =========================================================
+
+const CDtbEmulator::CModel CDtbEmulator::models[] =
+{
+	{ "GetRpcVersion",            &CDtbEmulator::Call_GetRpcVersion },
+	{ "GetRpcCallId",             &CDtbEmulator::Call_GetRpcCallId },
+	{ "GetRpcTimestamp",          &CDtbEmulator::Call_GetRpcTimestamp },
+	{ "GetRpcCallCount",          &CDtbEmulator::Call_GetRpcCallCount },
+	{ "GetRpcCallName",           &CDtbEmulator::Call_GetRpcCallName },
+	{ "GetInfo",                  &CDtbEmulator::Call_GetInfo },
+	{ "GetBoardId",               &CDtbEmulator::Call_GetBoardId },
+	{ "GetHWVersion",             &CDtbEmulator::Call_GetHWVersion },
+	{ "GetFWVersion",             &CDtbEmulator::Call_GetFWVersion },
+	{ "GetSWVersion",             &CDtbEmulator::Call_GetSWVersion },
+	{ "Init",                     &CDtbEmulator::Call_Init },
+	{ "cDelay",                   &CDtbEmulator::Call_cDelay },
+	{ "uDelay",                   &CDtbEmulator::Call_uDelay },
+	{ "Pon",                      &CDtbEmulator::Call_Pon },
+	{ "Poff",                     &CDtbEmulator::Call_Poff },
+	{ "_SetVD",                   &CDtbEmulator::Call_SetVD },
+	{ "_SetVA",                   &CDtbEmulator::Call_SetVA },
+	{ "_SetID",                   &CDtbEmulator::Call_SetID },
+	{ "_SetIA",                   &CDtbEmulator::Call_SetIA },
+	{ "_GetVD",                   &CDtbEmulator::Call_GetVD },
+	{ "_GetVA",                   &CDtbEmulator::Call_GetVA },
+	{ "_GetID",                   &CDtbEmulator::Call_GetID },
+	{ "_GetIA",                   &CDtbEmulator::Call_GetIA },
+	{ "SetRocAddress",            &CDtbEmulator::Call_SetRocAddress },
+	{ "Pg_SetCmd",                &CDtbEmulator::Call_Pg_SetCmd },
+	{ "Pg_Stop",                  &CDtbEmulator::Call_Pg_Stop },
+	{ "Pg_Single",                &CDtbEmulator::Call_Pg_Single },
+	{ "Pg_Loop",                  &CDtbEmulator::Call_Pg_Loop },
+	{ "Daq_Open",                 &CDtbEmulator::Call_Daq_Open },
+	{ "Daq_Close",                &CDtbEmulator::Call_Daq_Close },
+	{ "Daq_Start",                &CDtbEmulator::Call_Daq_Start },
+	{ "Daq_Stop",                 &CDtbEmulator::Call_Daq_Stop },
+	{ "Daq_GetSize",              &CDtbEmulator::Call_Daq_GetSize },
+	{ "Daq_Read",                 &CDtbEmulator::Call_Daq_Read },
+	{ "Daq_Select_ADC",           &CDtbEmulator::Call_Daq_Select_ADC },
+	{ "Daq_Select_Deser160",      &CDtbEmulator::Call_Daq_Select_Deser160 },
+	{ "Daq_Select_Deser400",      &CDtbEmulator::Call_Daq_Select_Deser400 },
+	{ "Daq_Select_Datagenerator", &CDtbEmulator::Call_Daq_Select_Datagenerator },
+	{ "Daq_DeselectAll",          &CDtbEmulator::Call_Daq_DeselectAll },
+	{ "roc_I2cAddr",              &CDtbEmulator::Call_roc_I2cAddr },
+	{ "roc_ClrCal",               &CDtbEmulator::Call_roc_ClrCal },
+	{ "roc_SetDAC",               &CDtbEmulator::Call_roc_SetDAC },
+	{ "roc_Pix",                  &CDtbEmulator::Call_roc_Pix },
+	{ "roc_Pix_Trim",             &CDtbEmulator::Call_roc_Pix_Trim },
+	{ "roc_Pix_Mask",             &CDtbEmulator::Call_roc_Pix_Mask },
+	{ "roc_Pix_Cal",              &CDtbEmulator::Call_roc_Pix_Cal },
+	{ "roc_Col_Enable",           &CDtbEmulator::Call_roc_Col_Enable },
+	{ "roc_Col_Mask",             &CDtbEmulator::Call_roc_Col_Mask },
+	{ "roc_Chip_Mask",            &CDtbEmulator::Call_roc_Chip_Mask },
+	{ "TestColPixel",             &CDtbEmulator::Call_TestColPixel },
+	{ "VectorTest",               &CDtbEmulator::Call_VectorTest },
+	{ 0, 0 }
+};
+
+
+CEmuHandler CDtbEmulator::FindModel(const std::string &name)
+{
+	std::string base = name.substr(0, name.rfind('$'));
+	for (unsigned int i = 0; models[i].name; i++)
+		if (base == models[i].name) return models[i].handler;
+	return 0;
+}
+
+
+CDtbEmulator::CDtbEmulator() : inPos(0), outPos(0), protocolErrors(0)
+{
+	InitCalls();
+	Reset();
+}
+
+
+void CDtbEmulator::InitCalls()
+{
+	// fixed ids of GetRpcVersion and GetRpcCallId
+	calls.resize(2);
+	calls[0].Parse("GetRpcVersion$S");
+	calls[0].handler = &CDtbEmulator::Call_GetRpcVersion;
+	calls[1].Parse("GetRpcCallId$i3c");
+	calls[1].handler = &CDtbEmulator::Call_GetRpcCallId;
+}
+
+
+int CDtbEmulator::AddCall(const std::string &name)
+{
+	for (unsigned int i = 0; i < calls.size(); i++)
+		if (calls[i].name == name) return i;
+
+	CEmuCall call;
+	if (!call.Parse(name)) return -1;
+	call.handler = FindModel(name);
+	calls.push_back(call);
+	return calls.size() - 1;
+}
+
+
+void CDtbEmulator::Open()
+{
+	Clear();
+	calls.clear();
+	InitCalls();
+	protocolErrors = 0;
+	Reset();
+}
+
+
+void CDtbEmulator::Reset()
+{
+	clock = 0;
+	power = false;
+	vd = 2500;
+	va = 1500;
+	idLimit = iaLimit = 5000;
+
+	memset(pg, 0, sizeof(pg));
+	pgPeriod = 0;
+	pgLoopClock = 0;
+
+	for (unsigned int i = 0; i < EMU_DAQ_CHANNELS; i++)
+	{
+		daq[i].open = daq[i].running = daq[i].overflow = false;
+		daq[i].capacity = 0;
+		daq[i].fifo.clear();
+		daq[i].readPos = 0;
+	}
+	daqSource = DAQ_NONE;
+	dataGen = dataGenStart = 0;
+	eventCounter = 0;
+
+	i2cAddr = 0;
+	roc.address = 0;
+	roc.PowerOn();
+}
+
+
+// --- RPC messages ---------------------------------------------------------
+
+void CDtbEmulator::Write(const void *buffer, unsigned int size)
+{
+	const uint8_t *p = (const uint8_t*)buffer;
+	in.insert(in.end(), p, p + size);
+	if (in.size() - inPos >= 65536) Process();
+}
+
+
+void CDtbEmulator::Flush()
+{
+	Process();
+}
+
+
+void CDtbEmulator::Clear()
+{
+	in.clear();
+	inPos = 0;
+	out.clear();
+	outPos = 0;
+}
+
+
+void CDtbEmulator::Read(void *buffer, unsigned int size)
+{
+	if (out.size() - outPos < size) Process();
+	if (out.size() - outPos < size) throw CRpcError(CRpcError::READ_TIMEOUT);
+	memcpy(buffer, out.data() + outPos, size);
+	outPos += size;
+	if (outPos == out.size()) { out.clear(); outPos = 0; }
+}
+
+
+void CDtbEmulator::Close()
+{
+	Clear();
+}
+
+
+void CDtbEmulator::Process()
+{
+	while (in.size() - inPos >= 4)
+	{
+		const uint8_t *p = in.data() + inPos;
+		unsigned int avail = in.size() - inPos;
+		if (p[0] != RPC_TYPE_DTB)
+		{ // data message without call or garbage
+			protocolErrors++;
+			if (p[0] == RPC_TYPE_DTB_DATA)
+			{
+				unsigned int size = p[1] | p[2] << 8 | p[3] << 16;
+				if (avail < 4 + size) break;
+				inPos += 4 + size;
+			}
+			else inPos++;
+			continue;
+		}
+
+		unsigned int size = p[3];
+		if (avail < 4 + size) break;
+		unsigned int dataPos = inPos + 4 + size;
+		if (!Execute(p[1] | p[2] << 8, p + 4, size, dataPos)) break; // data incomplete
+		inPos = dataPos;
+	}
+
+	if (inPos == in.size()) { in.clear(); inPos = 0; }
+	else if (inPos >= 65536) { in.erase(in.begin(), in.begin() + inPos); inPos = 0; }
+}
+
+
+bool CDtbEmulator::Execute(unsigned int cmd, const uint8_t *msg, unsigned int size, unsigned int &dataPos)
+{
+	if (cmd >= calls.size()) { protocolErrors++; return true; }
+	const CEmuCall &call = calls[cmd];
+	unsigned int n = call.par.size();
+
+	// --- the data messages of the call must be complete
+	unsigned int i, pos = dataPos;
+	for (i = 0; i < n; i++)
+	{
+		if (!call.par[i].IsDataIn()) continue;
+		if (in.size() - pos < 4) return false;
+		const uint8_t *p = in.data() + pos;
+		if (p[0] != RPC_TYPE_DTB_DATA) { protocolErrors++; return true; }
+		unsigned int dsize = p[1] | p[2] << 8 | p[3] << 16;
+		if (in.size() - pos - 4 < dsize) return false;
+		pos += 4 + dsize;
+	}
+	if (size != call.requestSize) { protocolErrors++; dataPos = pos; return true; }
+
+	// --- parameters
+	frame.ret = 0;
+	frame.value.assign(n, 0);
+	frame.data.resize(n);
+	pos = dataPos;
+	for (i = 0; i < n; i++)
+	{
+		const CEmuParam &par = call.par[i];
+		frame.data[i].clear();
+		if (par.comp < 0)
+		{
+			uint64_t x = 0;
+			for (unsigned int k = 0; k < par.size; k++) x |= uint64_t(*msg++) << (8*k);
+			frame.value[i] = x;
+		}
+		else if (par.IsDataIn())
+		{
+			const uint8_t *p = in.data() + pos;
+			unsigned int dsize = p[1] | p[2] << 8 | p[3] << 16;
+			frame.data[i].assign(p + 4, p + 4 + dsize);
+			pos += 4 + dsize;
+		}
+	}
+	dataPos = pos;
+
+	// the handler may add calls (GetRpcCallId)
+	CEmuHandler handler = call.handler;
+	if (handler) (this->*handler)(frame);
+	if (calls[cmd].reply) PutReply(cmd);
+	return true;
+}
+
+
+void CDtbEmulator::PutReply(unsigned int cmd)
+{
+	const CEmuCall &call = calls[cmd];
+	unsigned int i, k, size = call.ret.size;
+	for (i = 0; i < call.par.size(); i++)
+		if (call.par[i].comp == 0) size += call.par[i].size;
+
+	out.push_back(RPC_TYPE_DTB);
+	out.push_back(uint8_t(cmd));
+	out.push_back(uint8_t(cmd >> 8));
+	out.push_back(uint8_t(size));
+	for (k = 0; k < call.ret.size; k++) out.push_back(uint8_t(frame.ret >> (8*k)));
+	for (i = 0; i < call.par.size(); i++)
+		if (call.par[i].comp == 0)
+			for (k = 0; k < call.par[i].size; k++) out.push_back(uint8_t(frame.value[i] >> (8*k)));
+
+	for (i = 0; i < call.par.size(); i++)
+	{
+		if (!call.par[i].IsDataOut()) continue;
+		const std::vector<uint8_t> &x = frame.data[i];
+		unsigned int dsize = x.size();
+		out.push_back(RPC_TYPE_DTB_DATA);
+		out.push_back(uint8_t(dsize));
+		out.push_back(uint8_t(dsize >> 8));
+		out.push_back(uint8_t(dsize >> 16));
+		out.insert(out.end(), x.begin(), x.end());
+	}
+}
+
+
+// --- time, power ----------------------------------------------------------
+
+void CDtbEmulator::Delay(uint64_t clocks)
+{
+	clock += clocks;
+	if (pgPeriod == 0) return;
+
+	uint64_t loops = (clock - pgLoopClock)/pgPeriod;
+	if (loops && !(daq[0].running && daq[0].open && !daq[0].overflow))
+	{ // no data taken -> only the ROC state of the last pattern matters
+		pgLoopClock += (loops - 1)*pgPeriod;
+		loops = 1;
+	}
+	while (loops--)
+	{
+		RunPattern();
+		pgLoopClock += pgPeriod;
+	}
+}
+
+
+double CDtbEmulator::GetIdigA() const
+{
+	if (!power) return 0.0;
+	double i = (22.0 + 1.5*roc.dac[Vdig])/1000.0;
+	return i < idLimit/10000.0 ? i : idLimit/10000.0;
+}
+
+
+double CDtbEmulator::GetIanaA() const
+{
+	if (!power) return 0.0;
+	double i = (1.5 + 0.22*roc.dac[Vana] + 0.01*(roc.dac[VwllPr] + roc.dac[VwllSh]))/1000.0;
+	return i < iaLimit/10000.0 ? i : iaLimit/10000.0;
+}
+
+
+// --- pattern generator, DAQ -----------------------------------------------
+
+unsigned int CDtbEmulator::RunPattern()
+{
+	unsigned int t = 0;
+	for (unsigned int i = 0; i < EMU_PG_SIZE; i++)
+	{
+		uint16_t cmd = pg[i];
+		if (cmd & PG_RESR) { roc.Reset(); dataGen = dataGenStart; }
+		if (cmd & PG_REST) eventCounter = 0;
+		if (power && (cmd & PG_CAL)) roc.Calibrate(clock + t);
+		if (cmd & PG_TRG)
+		{
+			if (power) roc.Trigger(clock + t);
+			eventCounter++;
+		}
+		if (cmd & PG_TOK) Token();
+
+		unsigned int delay = cmd & 0xff;
+		if (delay == 0) break;
+		t += delay;
+	}
+	return t;
+}
+
+
+void CDtbEmulator::DaqWrite(unsigned int channel, const std::vector<uint16_t> &x)
+{
+	CDaqChannel &ch = daq[channel];
+	if (!ch.open || !ch.running) return;
+	if (ch.Size() + x.size() > ch.capacity) { ch.overflow = true; return; }
+	if (ch.readPos >= 65536 && ch.readPos >= ch.fifo.size()/2)
+	{
+		ch.fifo.erase(ch.fifo.begin(), ch.fifo.begin() + ch.readPos);
+		ch.readPos = 0;
+	}
+	ch.fifo.insert(ch.fifo.end(), x.begin(), x.end());
+}
+
+
+void CDtbEmulator::Token()
+{
+	if (daqSource == DAQ_DATAGEN)
+	{
+		record.assign(1, dataGen++);
+		DaqWrite(0, record);
+		return;
+	}
+	if (!power) return;
+
+	// --- ROC readout of the oldest trigger
+	readout.clear();
+	if (!roc.triggered.empty())
+	{
+		readout.swap(roc.triggered.front());
+		roc.triggered.pop_front();
+	}
+	uint8_t rb = roc.NextReadbackBits(vd/1000.0, va/1000.0, GetIanaA());
+
+	unsigned int i;
+	record.clear();
+	switch (daqSource)
+	{
+	case DAQ_DESER160:
+		record.push_back(0x7f8 | rb);
+		for (i = 0; i < readout.size(); i++)
+		{
+			uint32_t raw = EncodeRawPixel(readout[i].col, readout[i].row, readout[i].ph);
+			record.push_back((raw >> 12) & 0x0fff);
+			record.push_back(raw & 0x0fff);
+		}
+		record.front() |= 0x8000;
+		record.back()  |= 0x4000;
+		break;
+
+	case DAQ_ADC:
+		{
+			// levels: ultra black -400, black 0, address digit d: (d-1)*100
+			record.push_back(-400 & 0x0fff);
+			record.push_back(0);
+			record.push_back(((rb & 1) ? 300 : -100) & 0x0fff);
+			for (i = 0; i < readout.size(); i++)
+			{
+				unsigned int c = readout[i].col/2;
+				unsigned int r = 2*(ROC_NUMROWS - readout[i].row) + (readout[i].col & 1);
+				unsigned int digit[5] = { c/6, c%6, r/36, (r/6)%6, r%6 };
+				for (unsigned int k = 0; k < 5; k++) record.push_back((int(digit[k]) - 1)*100 & 0x0fff);
+				record.push_back(readout[i].ph);
+			}
+			record.front() |= 0x8000;
+			record.back()  |= 0x4000;
+		}
+		break;
+
+	case DAQ_DESER400:
+		{
+			unsigned int header = eventCounter << 8;
+			record.push_back(0x080 | ((header >> 12) & 15));
+			record.push_back(0x090 | ((header >>  8) & 15));
+			record.push_back(0x0a0 | ((header >>  4) & 15));
+			record.push_back(0x0b0 | ( header        & 15));
+			record.push_back(0x070 | rb);
+			for (i = 0; i < readout.size(); i++)
+			{
+				uint32_t raw = EncodeRawPixel(readout[i].col, readout[i].row, readout[i].ph);
+				for (int k = 5; k >= 0; k--)
+					record.push_back(((6 - k) << 4) | ((raw >> (4*k)) & 15));
+			}
+			record.push_back(0x0c0);
+			record.push_back(0x0d0);
+			record.push_back(0x0e0);
+			record.push_back(0x0f0);
+		}
+		break;
+
+	default: return;
+	}
+	DaqWrite(0, record);
+}
+
+
+// --- defects --------------------------------------------------------------
+
+bool CDtbEmulator::LoadDefects(const char *filename)
+{
+	FILE *f = fopen(filename, "rt");
+	if (!f) return false;
+
+	char line[256], type[32];
+	unsigned int lineNr = 0;
+	bool ok = true;
+	while (ok && fgets(line, sizeof(line), f))
+	{
+		lineNr++;
+		char *comment = strchr(line, '#');
+		if (comment) *comment = 0;
+		int col = -1, row = -1, bit = -1;
+		int n = sscanf(line, "%31s %i %i %i", type, &col, &row, &bit);
+		if (n <= 0) continue;
+
+		if (strcmp(type, "dcol") == 0)
+		{
+			if (n != 2 || col < 0 || col >= ROC_NUMDCOLS) ok = false;
+			else roc.dcolDead[col] = true;
+			continue;
+		}
+		if (n < 3 || col < 0 || col >= ROC_NUMCOLS || row < 0 || row >= ROC_NUMROWS) { ok = false; continue; }
+		CEmuPixel &p = roc.pixel[col][row];
+		if      (strcmp(type, "dead")   == 0 && n == 3) p.dead = true;
+		else if (strcmp(type, "nomask") == 0 && n == 3) p.noMask = true;
+		else if (strcmp(type, "addr")   == 0 && n == 3) p.addrError = true;
+		else if (strcmp(type, "trim")   == 0 && n == 4 && bit >= 0 && bit < 4) p.trimStuck |= 1 << bit;
+		else ok = false;
+	}
+	fclose(f);
+	if (!ok) printf("%s(%u): invalid defect\n", filename, lineNr);
+	return ok;
+}
+
+
+unsigned int CDtbEmulator::DefectCount()
+{
+	unsigned int cnt = 0;
+	for (unsigned int col = 0; col < ROC_NUMCOLS; col++)
+		for (unsigned int row = 0; row < ROC_NUMROWS; row++)
+		{
+			const CEmuPixel &p = roc.pixel[col][row];
+			if (p.dead || p.noMask || p.addrError || p.trimStuck || roc.dcolDead[col/2]) cnt++;
+		}
+	return cnt;
+}
+
+
+// === call models ==========================================================
+
+// --- RPC, identification
+
+void CDtbEmulator::Call_GetRpcVersion(CEmuFrame &f) { f.ret = RPC_DTB_VERSION; }
+
+void CDtbEmulator::Call_GetRpcCallId(CEmuFrame &f) { f.ret = uint32_t(AddCall(f.GetString(0))); }
+
+void CDtbEmulator::Call_GetRpcTimestamp(CEmuFrame &f)
+{ f.SetData(0, EMU_RPC_TIMESTAMP, strlen(EMU_RPC_TIMESTAMP)); }
+
+void CDtbEmulator::Call_GetRpcCallCount(CEmuFrame &f) { f.ret = calls.size(); }
+
+void CDtbEmulator::Call_GetRpcCallName(CEmuFrame &f)
+{
+	unsigned int id = f.Par(0);
+	if (id >= calls.size()) return;
+	f.SetData(1, calls[id].name.data(), calls[id].name.size());
+	f.ret = 1;
+}
+
+void CDtbEmulator::Call_GetInfo(CEmuFrame &f)
+{
+	char s[256];
+	snprintf(s, sizeof(s),
+		"Board id:    %i\n"
+		"HW version:  DTB emulator\n"
+		"FW version:  %i.%i\n"
+		"SW version:  %i.%i\n"
+		"ROC:         PSI46dig, %u defect pixel\n",
+		EMU_BOARD_ID, EMU_FW_VERSION >> 8, EMU_FW_VERSION & 0xff,
+		EMU_SW_VERSION >> 8, EMU_SW_VERSION & 0xff, DefectCount());
+	f.SetData(0, s, strlen(s));
+}
+
+void CDtbEmulator::Call_GetBoardId(CEmuFrame &f) { f.ret = EMU_BOARD_ID; }
+
+void CDtbEmulator::Call_GetHWVersion(CEmuFrame &f) { f.SetData(0, "DTB emulator", 12); }
+
+void CDtbEmulator::Call_GetFWVersion(CEmuFrame &f) { f.ret = EMU_FW_VERSION; }
+
+void CDtbEmulator::Call_GetSWVersion(CEmuFrame &f) { f.ret = EMU_SW_VERSION; }
+
+
+// --- DTB
+
+void CDtbEmulator::Call_Init(CEmuFrame &f)
+{
+	// keeps the time and the ROC address pins
+	uint64_t t = clock;
+	uint8_t addr = roc.address;
+	Reset();
+	clock = t;
+	roc.address = addr;
+}
+
+void CDtbEmulator::Call_cDelay(CEmuFrame &f) { Delay(f.Par(0)); }
+
+void CDtbEmulator::Call_uDelay(CEmuFrame &f) { Delay(40ull*f.Par(0)); }
+
+void CDtbEmulator::Call_Pon(CEmuFrame &f)
+{
+	if (power) return;
+	power = true;
+	roc.PowerOn();
+}
+
+void CDtbEmulator::Call_Poff(CEmuFrame &f) { power = false; }
+
+void CDtbEmulator::Call_SetVD(CEmuFrame &f) { vd = f.Par(0); }
+
+void CDtbEmulator::Call_SetVA(CEmuFrame &f) { va = f.Par(0); }
+
+void CDtbEmulator::Call_SetID(CEmuFrame &f) { idLimit = f.Par(0); }
+
+void CDtbEmulator::Call_SetIA(CEmuFrame &f) { iaLimit = f.Par(0); }
+
+void CDtbEmulator::Call_GetVD(CEmuFrame &f) { f.ret = power ? vd : 0; }
+
+void CDtbEmulator::Call_GetVA(CEmuFrame &f) { f.ret = power ? va : 0; }
+
+void CDtbEmulator::Call_GetID(CEmuFrame &f) { f.ret = uint16_t(GetIdigA()*10000.0 + 0.5); }
+
+void CDtbEmulator::Call_GetIA(CEmuFrame &f) { f.ret = uint16_t(GetIanaA()*10000.0 + 0.5); }
+
+void CDtbEmulator::Call_SetRocAddress(CEmuFrame &f) { roc.address = f.Par(0) & 15; }
+
+
+// --- pattern generator
+
+void CDtbEmulator::Call_Pg_SetCmd(CEmuFrame &f)
+{
+	if (f.Par(0) < EMU_PG_SIZE) pg[f.Par(0)] = f.Par(1);
+}
+
+void CDtbEmulator::Call_Pg_Stop(CEmuFrame &f) { pgPeriod = 0; }
+
+void CDtbEmulator::Call_Pg_Single(CEmuFrame &f)
+{
+	unsigned int t = RunPattern();
+	Delay(t);
+}
+
+void CDtbEmulator::Call_Pg_Loop(CEmuFrame &f)
+{
+	pgPeriod = f.Par(0);
+	pgLoopClock = clock;
+}
+
+
+// --- DAQ
+
+void CDtbEmulator::Call_Daq_Open(CEmuFrame &f)
+{
+	unsigned int channel = f.Par(1);
+	if (channel >= EMU_DAQ_CHANNELS) return;
+	CDaqChannel &ch = daq[channel];
+	ch.open = true;
+	ch.running = ch.overflow = false;
+	ch.capacity = f.Par(0);
+	ch.fifo.clear();
+	ch.readPos = 0;
+	f.ret = ch.capacity;
+}
+
+void CDtbEmulator::Call_Daq_Close(CEmuFrame &f)
+{
+	unsigned int channel = f.Par(0);
+	if (channel >= EMU_DAQ_CHANNELS) return;
+	CDaqChannel &ch = daq[channel];
+	ch.open = ch.running = ch.overflow = false;
+	ch.fifo.clear();
+	ch.readPos = 0;
+}
+
+void CDtbEmulator::Call_Daq_Start(CEmuFrame &f)
+{
+	unsigned int channel = f.Par(0);
+	if (channel < EMU_DAQ_CHANNELS && daq[channel].open) daq[channel].running = true;
+}
+
+void CDtbEmulator::Call_Daq_Stop(CEmuFrame &f)
+{
+	unsigned int channel = f.Par(0);
+	if (channel < EMU_DAQ_CHANNELS) daq[channel].running = false;
+}
+
+void CDtbEmulator::Call_Daq_GetSize(CEmuFrame &f)
+{
+	// a host polling the DAQ sees the data of the running pattern loop
+	if (pgPeriod) Delay(EMU_DAQ_CALL_TIME);
+	unsigned int channel = f.Par(0);
+	if (channel < EMU_DAQ_CHANNELS) f.ret = daq[channel].Size();
+}
+
+void CDtbEmulator::Call_Daq_Read(CEmuFrame &f)
+{
+	// (data, blocksize, channel) or (data, blocksize, availsize, channel)
+	bool avail = f.value.size() == 4;
+	if (pgPeriod) Delay(EMU_DAQ_CALL_TIME);
+	unsigned int channel = f.Par(f.value.size() - 1);
+	if (channel >= EMU_DAQ_CHANNELS) { f.ret = DAQ_STOPPED; return; }
+	CDaqChannel &ch = daq[channel];
+
+	unsigned int n = ch.Size();
+	if (n > f.Par(1)) n = f.Par(1);
+	if (n > 0x7fffff) n = 0x7fffff; // data message size
+	f.SetData(0, ch.fifo.data() + ch.readPos, 2*n);
+	ch.readPos += n;
+	if (ch.readPos == ch.fifo.size()) { ch.fifo.clear(); ch.readPos = 0; }
+
+	if (avail) f.value[2] = ch.Size();
+	f.ret = (ch.running ? 0 : DAQ_STOPPED) | (ch.overflow ? DAQ_MEM_OVFL : 0);
+}
+
+void CDtbEmulator::Call_Daq_Select_ADC(CEmuFrame &f) { daqSource = DAQ_ADC; }
+
+void CDtbEmulator::Call_Daq_Select_Deser160(CEmuFrame &f) { daqSource = DAQ_DESER160; }
+
+void CDtbEmulator::Call_Daq_Select_Deser400(CEmuFrame &f) { daqSource = DAQ_DESER400; }
+
+void CDtbEmulator::Call_Daq_Select_Datagenerator(CEmuFrame &f)
+{
+	daqSource = DAQ_DATAGEN;
+	dataGen = dataGenStart = f.Par(0);
+}
+
+void CDtbEmulator::Call_Daq_DeselectAll(CEmuFrame &f) { daqSource = DAQ_NONE; }
+
+
+// --- ROC (commands only reach a powered ROC with matching address)
+
+void CDtbEmulator::Call_roc_I2cAddr(CEmuFrame &f) { i2cAddr = f.Par(0) & 15; }
+
+void CDtbEmulator::Call_roc_ClrCal(CEmuFrame &f)
+{
+	if (!Addressed()) return;
+	for (unsigned int i = 0; i < roc.calList.size(); i++)
+		roc.pixel[roc.calList[i] / ROC_NUMROWS][roc.calList[i] % ROC_NUMROWS].cal = false;
+	roc.calList.clear();
+}
+
+void CDtbEmulator::Call_roc_SetDAC(CEmuFrame &f)
+{
+	if (!Addressed()) return;
+	unsigned int reg = f.Par(0), value = f.Par(1);
+	roc.dac[reg] = value;
+	if (reg != 0xff) { roc.lastReg = reg; roc.lastData = value; }
+}
+
+void CDtbEmulator::Call_roc_Pix(CEmuFrame &f)
+{
+	unsigned int col = f.Par(0), row = f.Par(1), value = f.Par(2);
+	if (!Addressed() || col >= ROC_NUMCOLS || row >= ROC_NUMROWS) return;
+	roc.pixel[col][row].trim = value & 15;
+	roc.pixel[col][row].mask = (value & PIXMASK) != 0;
+	roc.lastCol = col;
+	roc.lastRow = row;
+}
+
+void CDtbEmulator::Call_roc_Pix_Trim(CEmuFrame &f)
+{
+	unsigned int col = f.Par(0), row = f.Par(1);
+	if (!Addressed() || col >= ROC_NUMCOLS || row >= ROC_NUMROWS) return;
+	roc.pixel[col][row].trim = f.Par(2) & 15;
+	roc.pixel[col][row].mask = false;
+	roc.lastCol = col;
+	roc.lastRow = row;
+}
+
+void CDtbEmulator::Call_roc_Pix_Mask(CEmuFrame &f)
+{
+	unsigned int col = f.Par(0), row = f.Par(1);
+	if (!Addressed() || col >= ROC_NUMCOLS || row >= ROC_NUMROWS) return;
+	roc.pixel[col][row].mask = true;
+	roc.lastCol = col;
+	roc.lastRow = row;
+}
+
+void CDtbEmulator::Call_roc_Pix_Cal(CEmuFrame &f)
+{
+	unsigned int col = f.Par(0), row = f.Par(1);
+	if (!Addressed() || col >= ROC_NUMCOLS || row >= ROC_NUMROWS) return;
+	if (!roc.pixel[col][row].cal)
+	{
+		roc.pixel[col][row].cal = true;
+		roc.calList.push_back(col*ROC_NUMROWS + row);
+	}
+	roc.lastCol = col;
+	roc.lastRow = row;
+}
+
+void CDtbEmulator::Call_roc_Col_Enable(CEmuFrame &f)
+{
+	unsigned int col = f.Par(0);
+	if (!Addressed() || col >= ROC_NUMCOLS) return;
+	roc.dcolEnable[col/2] = f.Par(1) != 0;
+}
+
+void CDtbEmulator::Call_roc_Col_Mask(CEmuFrame &f)
+{
+	unsigned int col = f.Par(0);
+	if (!Addressed() || col >= ROC_NUMCOLS) return;
+	for (unsigned int row = 0; row < ROC_NUMROWS; row++) roc.pixel[col][row].mask = true;
+	roc.dcolEnable[col/2] = false;
+}
+
+void CDtbEmulator::Call_roc_Chip_Mask(CEmuFrame &f)
+{
+	if (!Addressed()) return;
+	for (unsigned int col = 0; col < ROC_NUMCOLS; col++)
+		for (unsigned int row = 0; row < ROC_NUMROWS; row++) roc.pixel[col][row].mask = true;
+	for (unsigned int i = 0; i < ROC_NUMDCOLS; i++) roc.dcolEnable[i] = false;
+}
+
+
+// --- wafer test
+
+void CDtbEmulator::Call_TestColPixel(CEmuFrame &f)
+{
+	// threshold level (Vcal) of each pixel of the column, pixel masked after
+	unsigned int col = f.Par(0), trim = f.Par(1) & 15;
+	if (!Addressed() || col >= ROC_NUMCOLS) return;
+
+	bool highRange = (roc.dac[CtrlReg] & 0x04) != 0;
+	std::vector<uint8_t> &res = f.data[3];
+	res.resize(ROC_NUMROWS);
+	for (unsigned int row = 0; row < ROC_NUMROWS; row++)
+	{
+		unsigned int x = 0;
+		while (x < 253 && !roc.Fires(col, row, trim, x, highRange)) x++;
+		res[row] = x;
+		roc.pixel[col][row].trim = trim;
+		roc.pixel[col][row].mask = true;
+	}
+	f.ret = 1;
+}
+
+void CDtbEmulator::Call_VectorTest(CEmuFrame &f) { f.data[1] = f.data[0]; }
@@ -0,0 +1,295 @@
+// dtbemu.h
+//
+// Software DTB: a CRpcIo that decodes the RPC messages of the host in
+// process and answers them from a model of the DTB with one digital ROC.
+// Connected by CTestboard::OpenEmulator, the chip tests and analyzer
+// commands run without hardware at host speed.
+//
+// RPC: call ids are assigned when the host asks for them (GetRpcCallId).
+// The parameters and replies are coded from the call name signature:
+//   request message (scalar parameters), a data message per vector or
+//   string parameter, reply message (return value, reference parameters)
+//   if the call returns something, a data message per output vector.
+// Calls without model are accepted and return zero or empty data.
+//
+// Model:
+//   power supply      VD/VA, supply currents from Vdig/Vana/VwllPr/VwllSh
+//   pattern generator Pg_SetCmd/Pg_Single/Pg_Loop (time in 40 MHz clocks,
+//                     advanced by the pattern, uDelay, cDelay and mDelay)
+//   DAQ               8 channels, source on channel 0: Deser160 (ROC dig
+//                     record), Deser400 (module record with one ROC),
+//                     ADC (ROC ana record) or data generator (counter)
+//   ROC               DACs, I2C address, readback (header bits), 52x80
+//                     pixel with trim, mask and calibrate, double column
+//                     enable, WBC, calibrate timing by CalDel
+//
+// A pixel fires if its charge Vcal (x7 with CtrlReg bit 2) is above the
+// threshold 120 - VthrComp + offset - Vtrim*(15-trim)/100. The hit is in
+// time for a trigger if trigger - calibrate = WBC + 5 + (CalDel+32)/64.
+//
+// Defects (text file, one per line, # comment):
+//   dead <col> <row>        pixel never fires
+//   nomask <col> <row>      pixel fires when masked
+//   addr <col> <row>        pixel reports row address with bit 0 flipped
+//   trim <col> <row> <bit>  trim bit has no effect
+//   dcol <dcol>             double column never fires
+
+#pragma once
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <deque>
+#include "rpc_io.h"
+
+
+#define EMU_PG_SIZE       256
+#define EMU_DAQ_CHANNELS    8
+#define EMU_CAL_LATENCY     5   // clocks from calibrate to hit (CalDel = 0)
+#define EMU_BOARD_ID        0
+#define EMU_DAQ_CALL_TIME 400   // clocks per Daq_GetSize/Daq_Read while Pg_Loop runs
+
+
+class CDtbEmulator;
+
+
+// === RPC call description =================================================
+
+struct CEmuParam
+{
+	int comp;          // -1 value, 0 reference, 1 vector, 2 vectorR, 3 string, 4 stringR, 5 HWvectorR
+	unsigned int size; // bytes per value/element (0 = void)
+	bool IsOutput() const { return comp == 0 || comp == 2 || comp == 4 || comp == 5; }
+	bool IsDataIn() const { return comp == 1 || comp == 3; }
+	bool IsDataOut() const { return comp == 2 || comp == 4 || comp == 5; }
+};
+
+
+// parameters of the call in execution (indexed by parameter position)
+struct CEmuFrame
+{
+	uint64_t ret;
+	std::vector<uint64_t> value;              // value and reference parameters
+	std::vector< std::vector<uint8_t> > data; // vector and string parameters
+
+	unsigned int Par(unsigned int i) const { return (unsigned int)value[i]; }
+	void SetData(unsigned int i, const void *x, unsigned int size);
+	std::string GetString(unsigned int i) const
+	{ return std::string(data[i].begin(), data[i].end()); }
+};
+
+
+typedef void (CDtbEmulator::*CEmuHandler)(CEmuFrame &f);
+
+
+struct CEmuCall
+{
+	std::string name;
+	CEmuParam ret;
+	std::vector<CEmuParam> par;
+	CEmuHandler handler;   // 0: no model
+	bool reply;            // return value or output parameters
+	unsigned int requestSize;
+
+	bool Parse(const std::string &callName);
+};
+
+
+// === ROC model ============================================================
+
+struct CEmuPixel
+{
+	uint8_t trim;
+	bool mask;
+	bool cal;
+	// defects
+	bool dead, noMask, addrError;
+	uint8_t trimStuck; // trim bits without effect
+	// process variation
+	int8_t thrOffset;
+	uint8_t phOffset;
+	uint8_t phGain; // 1/1000
+};
+
+
+struct CEmuHit
+{
+	uint64_t bc;
+	uint8_t col, row, ph;
+};
+
+
+class CEmuRoc
+{
+public:
+	uint8_t address;    // hardware address (SetRocAddress)
+	uint8_t dac[256];
+	uint8_t lastReg, lastData;
+	uint8_t lastCol, lastRow;
+	bool dcolEnable[26];
+	bool dcolDead[26];
+	CEmuPixel pixel[52][80];
+	std::vector<uint16_t> calList;         // col*80 + row of pixel with calibrate
+	std::vector<CEmuHit> hits;             // pending hits in the pipeline
+	std::deque< std::vector<CEmuHit> > triggered; // events waiting for the token
+
+	// readback
+	unsigned int rbCount;
+	uint16_t rbData;
+
+	CEmuRoc();
+	void PowerOn();
+	void Reset();
+	void ClearDefects();
+
+	bool Fires(unsigned int col, unsigned int row, unsigned int trim, unsigned int vcal, bool highRange) const;
+	unsigned int PulseHeight(unsigned int col, unsigned int row, unsigned int charge) const;
+	unsigned int Readback(double vd, double va, double ia) const;
+	uint8_t NextReadbackBits(double vd, double va, double ia);
+
+	void Calibrate(uint64_t t);
+	void Trigger(uint64_t t);
+};
+
+
+// === DTB emulator =========================================================
+
+class CDtbEmulator : public CRpcIo
+{
+	// --- RPC
+	std::vector<uint8_t> in;
+	unsigned int inPos;
+	std::vector<uint8_t> out;
+	unsigned int outPos;
+	std::vector<CEmuCall> calls;
+	CEmuFrame frame;
+	unsigned int protocolErrors;
+
+	void InitCalls();
+	int AddCall(const std::string &name);
+	void Process();
+	bool Execute(unsigned int cmd, const uint8_t *msg, unsigned int size, unsigned int &dataPos);
+	void PutReply(unsigned int cmd);
+
+	// --- time, power
+	uint64_t clock;  // 40 MHz clocks
+	bool power;
+	uint16_t vd, va; // mV
+	uint16_t idLimit, iaLimit; // 100 uA
+
+	double GetIdigA() const;
+	double GetIanaA() const;
+
+	// --- pattern generator
+	uint16_t pg[EMU_PG_SIZE];
+	uint16_t pgPeriod;   // loop period (0 = stopped)
+	uint64_t pgLoopClock;
+	unsigned int RunPattern();
+
+	// --- DAQ
+	enum DaqSource { DAQ_NONE, DAQ_DESER160, DAQ_DESER400, DAQ_ADC, DAQ_DATAGEN };
+	struct CDaqChannel
+	{
+		bool open, running, overflow;
+		uint32_t capacity;
+		std::vector<uint16_t> fifo;
+		unsigned int readPos;
+		unsigned int Size() const { return fifo.size() - readPos; }
+	} daq[EMU_DAQ_CHANNELS];
+	DaqSource daqSource;
+	uint16_t dataGen;
+	uint16_t dataGenStart;
+	uint8_t eventCounter;
+	std::vector<uint16_t> record;
+	std::vector<CEmuHit> readout;
+	void DaqWrite(unsigned int channel, const std::vector<uint16_t> &x);
+	void Token();
+
+	// --- ROC
+	uint8_t i2cAddr;
+	CEmuRoc roc;
+	bool Addressed() const { return power && i2cAddr == roc.address; }
+
+	void Reset();
+
+	// --- call models
+	void Call_GetRpcVersion(CEmuFrame &f);
+	void Call_GetRpcCallId(CEmuFrame &f);
+	void Call_GetRpcTimestamp(CEmuFrame &f);
+	void Call_GetRpcCallCount(CEmuFrame &f);
+	void Call_GetRpcCallName(CEmuFrame &f);
+	void Call_GetInfo(CEmuFrame &f);
+	void Call_GetBoardId(CEmuFrame &f);
+	void Call_GetHWVersion(CEmuFrame &f);
+	void Call_GetFWVersion(CEmuFrame &f);
+	void Call_GetSWVersion(CEmuFrame &f);
+	void Call_Init(CEmuFrame &f);
+	void Call_cDelay(CEmuFrame &f);
+	void Call_uDelay(CEmuFrame &f);
+	void Call_Pon(CEmuFrame &f);
+	void Call_Poff(CEmuFrame &f);
+	void Call_SetVD(CEmuFrame &f);
+	void Call_SetVA(CEmuFrame &f);
+	void Call_SetID(CEmuFrame &f);
+	void Call_SetIA(CEmuFrame &f);
+	void Call_GetVD(CEmuFrame &f);
+	void Call_GetVA(CEmuFrame &f);
+	void Call_GetID(CEmuFrame &f);
+	void Call_GetIA(CEmuFrame &f);
+	void Call_SetRocAddress(CEmuFrame &f);
+	void Call_Pg_SetCmd(CEmuFrame &f);
+	void Call_Pg_Stop(CEmuFrame &f);
+	void Call_Pg_Single(CEmuFrame &f);
+	void Call_Pg_Loop(CEmuFrame &f);
+	void Call_Daq_Open(CEmuFrame &f);
+	void Call_Daq_Close(CEmuFrame &f);
+	void Call_Daq_Start(CEmuFrame &f);
+	void Call_Daq_Stop(CEmuFrame &f);
+	void Call_Daq_GetSize(CEmuFrame &f);
+	void Call_Daq_Read(CEmuFrame &f);
+	void Call_Daq_Select_ADC(CEmuFrame &f);
+	void Call_Daq_Select_Deser160(CEmuFrame &f);
+	void Call_Daq_Select_Deser400(CEmuFrame &f);
+	void Call_Daq_Select_Datagenerator(CEmuFrame &f);
+	void Call_Daq_DeselectAll(CEmuFrame &f);
+	void Call_roc_I2cAddr(CEmuFrame &f);
+	void Call_roc_ClrCal(CEmuFrame &f);
+	void Call_roc_SetDAC(CEmuFrame &f);
+	void Call_roc_Pix(CEmuFrame &f);
+	void Call_roc_Pix_Trim(CEmuFrame &f);
+	void Call_roc_Pix_Mask(CEmuFrame &f);
+	void Call_roc_Pix_Cal(CEmuFrame &f);
+	void Call_roc_Col_Enable(CEmuFrame &f);
+	void Call_roc_Col_Mask(CEmuFrame &f);
+	void Call_roc_Chip_Mask(CEmuFrame &f);
+	void Call_TestColPixel(CEmuFrame &f);
+	void Call_VectorTest(CEmuFrame &f);
+
+	struct CModel { const char *name; CEmuHandler handler; };
+	static const CModel models[];
+	static CEmuHandler FindModel(const std::string &name);
+public:
+	CDtbEmulator();
+	~CDtbEmulator() {}
+
+	// --- CRpcIo
+	void Write(const void *buffer, unsigned int size);
+	void Flush();
+	void Clear();
+	void Read(void *buffer, unsigned int size);
+	void Close();
+
+	// resets the DTB and ROC state (defects are kept)
+	void Open();
+
+	// DTB time passing without RPC call (host mDelay)
+	void Delay(uint64_t clocks);
+
+	// messages that could not be decoded
+	unsigned int GetProtocolErrors() { return protocolErrors; }
+
+	// --- defects
+	void ClearDefects() { roc.ClearDefects(); }
+	bool LoadDefects(const char *filename);
+	unsigned int DefectCount();
+};
@@ -0,0 +1,241 @@
+// dtbsource.cpp
+//
+// Data source of the DTB (separate from datastream.cpp, so that the
+// offline tools can be linked without the DTB interface)
+
+#include "datastream.h"
+
+
+// === CDtbSource (CSource<uint16_t>) ================================
+
+bool CDtbSource::Open(CTestboard &dtb, unsigned int dataChannel,
+		bool endless, unsigned int dtbBufferSize)
+
+{ PROFILING
+	if (isOpen) Close();
+	if (dataChannel > 8) return false;
+	channel = dataChannel;
+	tb = &dtb;
+	stopAtEmptyData = !endless;
+	dtbFifoSize = dtbBufferSize;
+
+	// --- DTB control/state
+	dtbRemainingSize = 0;
+	dtbState = 0;
+
+	// --- data buffer
+	lastSample = 0;
+	pos = size = 0;
+	data = 0;
+	buffer.clear();
+	dataFromRing = false;
+	readerStarted = false;
+	if (threaded) ring.Init(ring.GetSize());
+
+	isOpen = tb->Daq_Open(dtbFifoSize, channel) != 0;
+	return isOpen;
+}
+
+
+bool CDtbSource::OpenRocAna(CTestboard &dtb, uint8_t tinDelay, uint8_t toutDelay, uint16_t timeout,
+	bool endless, unsigned int dtbBufferSize)
+{ PROFILING
+	if (!Open(dtb, 0, endless, dtbBufferSize)) return false;
+	dtb.Daq_Select_ADC(timeout, // 1..65535
+		0,  // source: tin/tout
+		tinDelay,  // tin delay 0..63
+		toutDelay); // tout delay 0..63
+	dtb.SignalProbeADC(PROBEA_SDATA1, GAIN_4);
+	dtb.uDelay(800); // to stabilize ADC input signal
+	return true;
+}
+
+
+bool CDtbSource::OpenRocDig(CTestboard &dtb, uint8_t deserAdjust,
+		bool endless, unsigned int dtbBufferSize, unsigned int dataChannel)
+{ PROFILING
+	if (!Open(dtb, dataChannel, endless, dtbBufferSize)) return false;
+	tb->Daq_Select_Deser160(deserAdjust);
+	return true;
+}
+
+
+bool CDtbSource::OpenModDig(CTestboard &dtb, bool endless, unsigned int dtbBufferSize,
+		unsigned int dataChannel)
+{ PROFILING
+	if (!Open(dtb, dataChannel, endless, dtbBufferSize)) return false;
+	tb->Daq_Select_Deser400();
+	return true;
+}
+
+
+bool CDtbSource::OpenSimulator(CTestboard &dtb, bool endless, unsigned int dtbBufferSize)
+{ PROFILING
+	if (!Open(dtb, 0, endless, dtbBufferSize)) return false;
+	tb->Daq_Select_Datagenerator(0);
+	return true;
+}
+
+
+void CDtbSource::Close()
+{ PROFILING
+	StopReader();
+	if (!isOpen) return;
+	tb->Daq_Close(channel);
+	isOpen = false;
+}
+
+void CDtbSource::Enable()
+{ PROFILING
+	StopReader(); // may have ended by itself (empty, overflow, error)
+	if (!isOpen) return;
+	tb->Daq_Start(channel);
+	readerStarted = false;
+}
+
+void CDtbSource::Disable()
+{ PROFILING
+	StopReader();
+	if (!isOpen) return;
+	tb->Daq_Stop(channel);
+}
+
+
+void CDtbSource::Threaded(bool on, unsigned int ringSize)
+{
+	StopReader();
+	threaded = on;
+	if (threaded) ring.Init(ringSize < 2*DTB_SOURCE_BLOCK_SIZE ? 2*DTB_SOURCE_BLOCK_SIZE : ringSize);
+}
+
+
+void CDtbSource::StartReader()
+{
+	StopReader();
+	readerStarted = true;
+	readerStop = false;
+	readerExit = READER_STOPPED;
+	readerRunning = true;
+	reader = std::thread(&CDtbSource::ReaderLoop, this);
+}
+
+
+void CDtbSource::StopReader()
+{
+	if (!reader.joinable()) return;
+	readerStop = true;
+	reader.join();
+}
+
+
+void CDtbSource::ReaderLoop()
+{
+	vector<uint16_t> x;
+	uint32_t remaining;
+	x.reserve(DTB_SOURCE_BLOCK_SIZE);
+	try
+	{
+		while (!readerStop)
+		{
+			if (ring.GetFree() < DTB_SOURCE_BLOCK_SIZE)
+			{ // pipeline too slow
+				std::chrono::steady_clock::time_point t0 = std::chrono::steady_clock::now();
+				std::this_thread::sleep_for(std::chrono::microseconds(100));
+				readerStall += std::chrono::duration_cast<std::chrono::microseconds>
+					(std::chrono::steady_clock::now() - t0).count();
+				continue;
+			}
+
+			uint8_t state = tb->Daq_Read(x, DTB_SOURCE_BLOCK_SIZE, remaining, channel);
+			dtbState = state;
+			dtbRemainingSize = remaining;
+			if (logging) printf("%i(%u/%u)\n", int(state), (unsigned int)(x.size()), remaining);
+			if (x.size()) ring.Write(x.data(), x.size());
+			else
+			{
+				if (stopAtEmptyData) { readerExit = READER_EMPTY; break; }
+				if (state & (DAQ_FIFO_OVFL | DAQ_MEM_OVFL)) { readerExit = READER_OVERFLOW; break; }
+			}
+		}
+	}
+	catch (...) { readerExit = READER_DTB_ERROR; } // CRpcError, bad_alloc, ...
+	readerRunning = false;
+}
+
+
+bool CDtbSource::FillBufferFromRing()
+{ PROFILING
+	if (dataFromRing) ring.Release(size);
+	dataFromRing = false;
+	pos = size = 0;
+
+	if (!readerStarted) StartReader();
+
+	CDataBlock<uint16_t> block = ring.Peek();
+	if (block.size == 0)
+	{
+		std::chrono::steady_clock::time_point t0 = std::chrono::steady_clock::now();
+		while ((block = ring.Peek()).size == 0)
+		{
+			if (!readerRunning)
+			{
+				block = ring.Peek();
+				if (block.size) break;
+				switch (readerExit)
+				{
+				case READER_EMPTY: throw DS_empty();
+				case READER_OVERFLOW: throw DS_buffer_overflow();
+				case READER_DTB_ERROR: throw DS_dtb_error();
+				default: return false; // reader stopped -> read directly
+				}
+			}
+			std::this_thread::sleep_for(std::chrono::microseconds(50));
+		}
+		consumerStall += std::chrono::duration_cast<std::chrono::microseconds>
+			(std::chrono::steady_clock::now() - t0).count();
+	}
+
+	data = block.data;
+	size = block.size;
+	dataFromRing = true;
+	return true;
+}
+
+
+void CDtbSource::FillBuffer()
+{ PROFILING
+	if (!isOpen) throw DS_no_dtb_access();
+	if (threaded && FillBufferFromRing()) return;
+
+	pos = size = 0;
+	uint8_t state;
+	uint32_t remaining;
+	do
+	{
+		state = tb->Daq_Read(buffer, DTB_SOURCE_BLOCK_SIZE, remaining, channel);
+		dtbState = state;
+		dtbRemainingSize = remaining;
+		if (logging) printf("%i(%u/%u)\n", int(state), (unsigned int)(buffer.size()), remaining);
+		if (buffer.size() == 0)
+		{
+			if (stopAtEmptyData) throw DS_empty();
+			if (state & (DAQ_FIFO_OVFL | DAQ_MEM_OVFL)) throw DS_buffer_overflow();
+		}
+
+	} while (buffer.size() == 0);
+
+	data = buffer.data();
+	size = buffer.size();
+}
+
+
+CDataBlock<uint16_t> CDtbSource::ReadBlock(unsigned int maxSize)
+{
+	if (pos >= size) FillBuffer();
+	unsigned int n = size - pos;
+	if (n > maxSize) n = maxSize;
+	CDataBlock<uint16_t> block(data + pos, n);
+	pos += n;
+	if (n) lastSample = data[pos-1];
+	return block;
+}
@@ -0,0 +1,342 @@
+// eventfile.cpp
+
+#include <string.h>
+#include "eventfile.h"
+
+
+static const char fileMagic[8]  = { 'P','S','I','E','V','T','0','1' };
+static const char indexMagic[8] = { 'P','S','I','E','V','I','D','X' };
+
+#define EVENT_HEADER_SIZE  24
+#define FILE_HEADER_SIZE   16
+#define FILE_TRAILER_SIZE  24
+
+
+static bool FileSeek(FILE *f, uint64_t pos)
+{
+#ifdef _WIN32
+	return _fseeki64(f, pos, SEEK_SET) == 0;
+#else
+	return fseeko(f, off_t(pos), SEEK_SET) == 0;
+#endif
+}
+
+
+static uint64_t FileSize(FILE *f)
+{
+#ifdef _WIN32
+	_fseeki64(f, 0, SEEK_END);
+	return _ftelli64(f);
+#else
+	fseeko(f, 0, SEEK_END);
+	return ftello(f);
+#endif
+}
+
+
+// size of an event in the file
+static unsigned int EventSize(unsigned int nRoc, unsigned int nPixel)
+{
+	unsigned int size = EVENT_HEADER_SIZE + 5*nRoc + 3*nPixel;
+	size = (size + 1) & ~1u;
+	return size + 2*nPixel;
+}
+
+
+template <class T>
+static inline uint8_t* Store(uint8_t *p, T value)
+{
+	memcpy(p, &value, sizeof(T));
+	return p + sizeof(T);
+}
+
+
+template <class T>
+static inline const uint8_t* Load(const uint8_t *p, T &value)
+{
+	memcpy(&value, p, sizeof(T));
+	return p + sizeof(T);
+}
+
+
+// === CEventFileWriter (CFlatEvent*, CFlatEvent*) ==========================
+
+bool CEventFileWriter::Open(const char *filename)
+{
+	Close();
+	f = fopen(filename, "wb");
+	if (!f) return false;
+
+	buffer.clear();
+	buffer.reserve(EVENTFILE_BUFFER_SIZE + 4096);
+	index.clear();
+	filePos = 0;
+
+	uint8_t header[FILE_HEADER_SIZE];
+	memcpy(header, fileMagic, 8);
+	uint8_t *p = Store(header + 8, uint32_t(EVENTFILE_VERSION));
+	Store(p, uint32_t(0));
+	Put(header, FILE_HEADER_SIZE);
+	return true;
+}
+
+
+void CEventFileWriter::Close()
+{
+	if (!f) return;
+
+	// --- event index and trailer
+	uint64_t indexOffset = filePos;
+	for (unsigned int i = 0; i < index.size(); i++)
+	{
+		uint8_t entry[16];
+		uint8_t *p = Store(entry, index[i].offset);
+		p = Store(p, index[i].recordNr);
+		Store(p, index[i].error);
+		Put(entry, 16);
+	}
+
+	uint8_t trailer[FILE_TRAILER_SIZE];
+	uint8_t *p = Store(trailer, indexOffset);
+	p = Store(p, uint32_t(index.size()));
+	p = Store(p, uint32_t(0));
+	memcpy(p, indexMagic, 8);
+	Put(trailer, FILE_TRAILER_SIZE);
+
+	Flush();
+	fclose(f);
+	f = 0;
+}
+
+
+void CEventFileWriter::Put(const void *data, unsigned int size)
+{
+	const uint8_t *p = (const uint8_t*)data;
+	buffer.insert(buffer.end(), p, p + size);
+	filePos += size;
+	if (buffer.size() >= EVENTFILE_BUFFER_SIZE) Flush();
+}
+
+
+void CEventFileWriter::Flush()
+{
+	if (f && buffer.size()) fwrite(buffer.data(), 1, buffer.size(), f);
+	buffer.clear();
+}
+
+
+void CEventFileWriter::Write(const CFlatEvent &x)
+{
+	unsigned int nRoc = x.RocCount();
+	unsigned int nPixel = x.PixelCount();
+	if (nRoc > 255) nRoc = 255;
+	nPixel = x.rocOffset[nRoc];
+	unsigned int size = EventSize(nRoc, nPixel);
+
+	CEventIndexEntry entry;
+	entry.offset = filePos;
+	entry.recordNr = x.recordNr;
+	entry.error = x.error;
+	index.push_back(entry);
+
+	// build the event in the buffer
+	unsigned int start = buffer.size();
+	buffer.resize(start + size);
+	uint8_t *p = buffer.data() + start;
+	p = Store(p, uint32_t(size));
+	p = Store(p, uint32_t(x.recordNr));
+	p = Store(p, int32_t(x.error));
+	p = Store(p, uint16_t(x.header));
+	p = Store(p, uint16_t(x.trailer));
+	p = Store(p, uint8_t(x.deviceType));
+	p = Store(p, uint8_t(nRoc));
+	p = Store(p, uint16_t(0));
+	p = Store(p, uint32_t(nPixel));
+
+	unsigned int r;
+	for (r = 0; r < nRoc; r++) p = Store(p, uint16_t(x.rocHeader[r]));
+	for (r = 0; r < nRoc; r++) p = Store(p, uint16_t(x.PixelCount(r)));
+	if (nRoc) { memcpy(p, x.rocError.data(), nRoc); p += nRoc; }
+
+	if (nPixel)
+	{
+		memcpy(p, x.x.data(),  nPixel); p += nPixel;
+		memcpy(p, x.y.data(),  nPixel); p += nPixel;
+		memcpy(p, x.ph.data(), nPixel); p += nPixel;
+		if ((p - buffer.data() - start) & 1) *p++ = 0;
+		memcpy(p, x.pixelError.data(), 2*nPixel);
+	}
+	else if ((p - buffer.data() - start) & 1) *p = 0;
+
+	filePos += size;
+	if (buffer.size() >= EVENTFILE_BUFFER_SIZE) Flush();
+}
+
+
+CFlatEvent* CEventFileWriter::Read()
+{ PROFILING
+	x = Get();
+	if (f && (!onlyErrors || x->error)) Write(*x);
+	return x;
+}
+
+
+// === CEventFileReader (CFlatEvent*) =======================================
+
+bool CEventFileReader::Open(const char *filename)
+{
+	Close();
+	f = fopen(filename, "rb");
+	if (!f) return false;
+
+	uint8_t header[FILE_HEADER_SIZE];
+	if (fread(header, 1, FILE_HEADER_SIZE, f) != FILE_HEADER_SIZE
+		|| memcmp(header, fileMagic, 8) != 0)
+	{
+		Close();
+		return false;
+	}
+
+	if (!ReadIndex() && !ScanIndex())
+	{
+		Close();
+		return false;
+	}
+	next = 0;
+	return true;
+}
+
+
+void CEventFileReader::Close()
+{
+	if (f) { fclose(f); f = 0; }
+	index.clear();
+	next = 0;
+}
+
+
+bool CEventFileReader::ReadIndex()
+{
+	uint64_t fileSize = FileSize(f);
+	if (fileSize < FILE_HEADER_SIZE + FILE_TRAILER_SIZE) return false;
+
+	uint8_t trailer[FILE_TRAILER_SIZE];
+	if (!FileSeek(f, fileSize - FILE_TRAILER_SIZE)) return false;
+	if (fread(trailer, 1, FILE_TRAILER_SIZE, f) != FILE_TRAILER_SIZE) return false;
+	if (memcmp(trailer + 16, indexMagic, 8) != 0) return false;
+
+	uint64_t indexOffset;
+	uint32_t count;
+	Load(Load(trailer, indexOffset), count);
+	if (indexOffset + 16ull*count + FILE_TRAILER_SIZE != fileSize) return false;
+
+	vector<uint8_t> data(16*size_t(count));
+	if (!FileSeek(f, indexOffset)) return false;
+	if (count && fread(data.data(), 16, count, f) != count) return false;
+
+	index.resize(count);
+	const uint8_t *p = data.data();
+	for (unsigned int i = 0; i < count; i++)
+	{
+		p = Load(p, index[i].offset);
+		p = Load(p, index[i].recordNr);
+		p = Load(p, index[i].error);
+	}
+	return true;
+}
+
+
+bool CEventFileReader::ScanIndex()
+{
+	index.clear();
+	uint64_t fileSize = FileSize(f);
+	uint64_t pos = FILE_HEADER_SIZE;
+	uint8_t header[EVENT_HEADER_SIZE];
+	while (FileSeek(f, pos) && fread(header, 1, EVENT_HEADER_SIZE, f) == EVENT_HEADER_SIZE)
+	{
+		uint32_t size;
+		CEventIndexEntry entry;
+		entry.offset = pos;
+		Load(Load(Load(header, size), entry.recordNr), entry.error);
+		if (size < EVENT_HEADER_SIZE || pos + size > fileSize) break;
+		index.push_back(entry);
+		pos += size;
+	}
+	return true;
+}
+
+
+bool CEventFileReader::ReadEvent(unsigned int n, CFlatEvent &e)
+{
+	if (!f || n >= index.size()) return false;
+	if (!FileSeek(f, index[n].offset)) return false;
+
+	uint32_t size;
+	if (fread(&size, 4, 1, f) != 1 || size < EVENT_HEADER_SIZE) return false;
+	buffer.resize(size);
+	if (fread(buffer.data() + 4, 1, size - 4, f) != size - 4) return false;
+
+	const uint8_t *p = buffer.data() + 4;
+	uint32_t recordNr, nPixel;
+	int32_t error;
+	uint16_t header, trailer, reserved;
+	uint8_t deviceType, nRoc;
+	p = Load(p, recordNr);
+	p = Load(p, error);
+	p = Load(p, header);
+	p = Load(p, trailer);
+	p = Load(p, deviceType);
+	p = Load(p, nRoc);
+	p = Load(p, reserved);
+	p = Load(p, nPixel);
+	if (EventSize(nRoc, nPixel) != size) return false;
+
+	e.Clear();
+	e.recordNr = recordNr;
+	e.error = error;
+	e.header = header;
+	e.trailer = trailer;
+	e.deviceType = CEvent::DeviceType(deviceType);
+
+	const uint8_t *count = p + 2*nRoc;
+	const uint8_t *rocError = count + 2*nRoc;
+	unsigned int r, pixelSum = 0;
+	for (r = 0; r < nRoc; r++)
+	{
+		uint16_t h, n;
+		Load(p + 2*r, h);
+		Load(count + 2*r, n);
+		e.rocHeader.push_back(h);
+		e.rocError.push_back(rocError[r]);
+		pixelSum += n;
+		e.rocOffset.push_back(pixelSum);
+	}
+	if (pixelSum != nPixel) return false;
+	p = rocError + nRoc;
+
+	e.raw.assign(nPixel, 0);
+	e.rawError.assign(nPixel, 0);
+	e.x.resize(nPixel);
+	e.y.resize(nPixel);
+	e.ph.resize(nPixel);
+	e.pixelError.resize(nPixel);
+	if (nPixel)
+	{
+		memcpy(e.x.data(),  p, nPixel); p += nPixel;
+		memcpy(e.y.data(),  p, nPixel); p += nPixel;
+		memcpy(e.ph.data(), p, nPixel); p += nPixel;
+		if ((p - buffer.data()) & 1) p++;
+		memcpy(e.pixelError.data(), p, 2*nPixel);
+	}
+	return true;
+}
+
+
+CFlatEvent* CEventFileReader::Read()
+{ PROFILING
+	if (onlyErrors)
+		while (next < index.size() && index[next].error == 0) next++;
+	if (next >= index.size()) throw DS_empty();
+	if (!ReadEvent(next++, x)) throw EF_read_error();
+	return &x;
+}
@@ -0,0 +1,108 @@
+// eventfile.h
+//
+// Binary file format for decoded events (little endian):
+//
+//   file header:  "PSIEVT01", uint32 version, uint32 reserved
+//   event:        uint32 size (bytes of the event including size)
+//                 uint32 recordNr, int32 error,
+//                 uint16 header, uint16 trailer,
+//                 uint8 deviceType, uint8 nRoc, uint16 reserved,
+//                 uint32 nPixel,
+//                 uint16 rocHeader[nRoc], uint16 rocPixelCount[nRoc],
+//                 uint8  rocError[nRoc],
+//                 uint8  x[nPixel], int8 y[nPixel], uint8 ph[nPixel],
+//                 uint16 pixelError[nPixel] (2 byte aligned)
+//   event index:  { uint64 offset, uint32 recordNr, int32 error } per event
+//   file trailer: uint64 index offset, uint32 event count,
+//                 uint32 reserved, "PSIEVIDX"
+//
+// The pixel data of an event is stored column by column. The index is
+// written when the file is closed. Files without index (e.g. after a
+// crash) are indexed by scanning the events when they are opened.
+
+#pragma once
+
+#include <stdio.h>
+#include <stdint.h>
+#include <vector>
+#include "datastream.h"
+
+
+DATAPIPE_ERROR(EF_read_error, "Event file read error")
+
+
+#define EVENTFILE_VERSION 1
+#define EVENTFILE_BUFFER_SIZE (1 << 20)
+
+
+struct CEventIndexEntry
+{
+	uint64_t offset;
+	uint32_t recordNr;
+	int32_t error;
+};
+
+
+// === CEventFileWriter (CFlatEvent*, CFlatEvent*) ==========================
+// Writes the events passing through to an event file
+
+class CEventFileWriter : public CDataPipe<CFlatEvent*>
+{
+	FILE *f;
+	vector<uint8_t> buffer;
+	uint64_t filePos;
+	vector<CEventIndexEntry> index;
+	bool onlyErrors;
+
+	void Put(const void *data, unsigned int size);
+	void Flush();
+	void Write(const CFlatEvent &x);
+
+	CFlatEvent* x;
+	CFlatEvent* Read();
+	CFlatEvent* ReadLast() { return x; }
+public:
+	CEventFileWriter() : f(0), filePos(0), onlyErrors(false), x(0) {}
+	CEventFileWriter(const char *filename) : f(0), filePos(0), onlyErrors(false), x(0)
+	{ Open(filename); }
+	~CEventFileWriter() { Close(); }
+	bool Open(const char *filename);
+	void Close();
+	bool IsOpen() { return f != 0; }
+	void WriteOnlyErrors(bool on) { onlyErrors = on; }
+	unsigned int GetEventCount() { return index.size(); }
+};
+
+
+// === CEventFileReader (CFlatEvent*) =======================================
+// Reads an event file sequentially as data source or by event number
+
+class CEventFileReader : public CSource<CFlatEvent*>
+{
+	FILE *f;
+	vector<CEventIndexEntry> index;
+	vector<uint8_t> buffer;
+	unsigned int next;
+	bool onlyErrors;
+
+	bool ReadIndex();
+	bool ScanIndex();
+
+	CFlatEvent x;
+	CFlatEvent* Read();
+	CFlatEvent* ReadLast() { return &x; }
+public:
+	CEventFileReader() : f(0), next(0), onlyErrors(false) {}
+	~CEventFileReader() { Close(); }
+	bool Open(const char *filename);
+	void Close();
+	unsigned int GetEventCount() { return index.size(); }
+	const CEventIndexEntry& GetIndex(unsigned int n) { return index[n]; }
+
+	// reads event n into e
+	bool ReadEvent(unsigned int n, CFlatEvent &e);
+
+	// position of the next event read as data source
+	void Seek(unsigned int n) { next = n; }
+	void ReadOnlyErrors(bool on) { onlyErrors = on; }
+};
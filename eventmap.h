@@ -0,0 +1,125 @@
+// eventmap.h
+//
+// Event statistics pipes for CEvent and CFlatEvent streams:
+// CEventCounterT counts events, pixels and events with error,
+// CEventMapT accumulates hit maps per ROC and flags events with a wrong
+// ROC count or pixel address (error bit 0x0800).
+
+#pragma once
+
+#include <algorithm>
+#include <vector>
+#include "datastream.h"
+
+
+// === CEventCounterT (E*, E*) =============================================
+
+template <class E>
+class CEventCounterT : public CDataPipe<E*>
+{
+	E* x;
+	E* Read();
+	E* ReadLast() { return x; }
+public:
+	unsigned int nEvents;
+	unsigned int nPixels;
+	unsigned int nErrors;
+	void Reset() { nEvents = nPixels = nErrors = 0; }
+	CEventCounterT() { x = 0; Reset(); }
+	void Print() { printf("nEvents: %u;  nPixels: %u;  nErrors: %u\n", nEvents, nPixels, nErrors); }
+};
+
+typedef CEventCounterT<CEvent> CEventCounter;
+typedef CEventCounterT<CFlatEvent> CFlatEventCounter;
+
+template <class E>
+E* CEventCounterT<E>::Read()
+{
+	x = this->Get();
+	nEvents++;
+	if (x->error) nErrors++;
+	for (unsigned int r = 0; r < x->RocCount(); r++)
+		nPixels += x->PixelCount(r);
+	return x;
+}
+
+
+// === CEventMapT (E*, E*) =================================================
+
+template <class E>
+class CEventMapT : public CDataPipe<E*>
+{
+	unsigned int nRocs;
+	std::vector<unsigned int> map;
+	E* x;
+	E* Read();
+	E* ReadLast() { return x; }
+public:
+	unsigned int nWrongRocCount;
+	unsigned int nWrongAddress;
+	unsigned int &Pixel(unsigned int r, unsigned int x, unsigned int y)
+	{ return map[(r*52 + x)*80 + y]; }
+	void Reset();
+	void Report();
+	CEventMapT(unsigned int rocCount = 8) : nRocs(rocCount), map(rocCount*52*80) { x = 0; Reset(); }
+};
+
+typedef CEventMapT<CEvent> CEventMap;
+typedef CEventMapT<CFlatEvent> CFlatEventMap;
+
+template <class E>
+void CEventMapT<E>::Reset()
+{
+	std::fill(map.begin(), map.end(), 0);
+	nWrongRocCount = nWrongAddress = 0;
+}
+
+template <class E>
+void CEventMapT<E>::Report()
+{
+	Log.section("PIXELMAP");
+	Log.printf("Errors: RocCount=%u, Address=%u\n", nWrongRocCount, nWrongAddress);
+	int r, x, y;
+	for (r=0; r<int(nRocs); r++)
+	{
+		Log.printf("ROC %i\n", r);
+		for (y=51; y>=0; y--)
+		{
+			Log.printf("%2i: ", y);
+			for (x=0; x<52; x++)
+			{
+				unsigned int n = Pixel(r, x, y);
+				if (n == 0)           Log.printf("   .");
+				else if (n < 1000)    Log.printf(" %3u", n);
+				else if (n < 1000000) Log.printf("%3uk", n/1000);
+				else                  Log.printf("%3uM", n/10000000);
+			}
+			Log.printf("\n");
+		}
+	}
+}
+
+template <class E>
+E* CEventMapT<E>::Read()
+{
+	x = this->Get();
+	bool error = false;
+	if (x->RocCount() == nRocs)
+	{
+		for (unsigned int r = 0; r < x->RocCount(); r++)
+		{
+			unsigned int nP = x->PixelCount(r);
+			for (unsigned int p = 0; p < nP; p++)
+			{
+				unsigned int px = x->PixelX(r, p);
+				unsigned int py = x->PixelY(r, p);
+				if (px < 52 && py < 80) Pixel(r, px, py)++;
+				else { nWrongAddress++; error = true; }
+			}
+		}
+	}
+	else { nWrongRocCount++; error = true; }
+
+	if (error) x->error |= 0x0800;
+	return x;
+}
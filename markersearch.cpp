@@ -0,0 +1,195 @@
+// markersearch.cpp
+
+#include "markersearch.h"
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define MARKER_HAVE_SSE2
+#include <emmintrin.h>
+#endif
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define MARKER_HAVE_AVX2
+#include <immintrin.h>
+#define MARKER_TARGET_AVX2 __attribute__((target("avx2")))
+#elif defined(_MSC_VER) && defined(_M_X64)
+#define MARKER_HAVE_AVX2
+#include <immintrin.h>
+#define MARKER_TARGET_AVX2
+#endif
+
+#ifdef _MSC_VER
+#include <intrin.h>
+static inline unsigned int LowestBit(uint32_t x)
+{ unsigned long n; _BitScanForward(&n, x); return n; }
+#else
+static inline unsigned int LowestBit(uint32_t x) { return __builtin_ctz(x); }
+#endif
+
+
+// === scalar ===============================================================
+
+static inline unsigned int FindMarkersTail(const uint16_t *data, unsigned int i,
+	unsigned int size, const CMarkerSpec &spec, uint32_t *pos, unsigned int n)
+{
+	for (; i < size; i++) if (spec.IsMarker(data[i])) pos[n++] = i;
+	return n;
+}
+
+
+unsigned int FindMarkersScalar(const uint16_t *data, unsigned int size,
+	const CMarkerSpec &spec, uint32_t *pos)
+{
+	return FindMarkersTail(data, 0, size, spec, pos, 0);
+}
+
+
+// === SSE2: 8 words per step ===============================================
+
+#ifdef MARKER_HAVE_SSE2
+
+unsigned int FindMarkersSSE2(const uint16_t *data, unsigned int size,
+	const CMarkerSpec &spec, uint32_t *pos)
+{
+	const __m128i m1 = _mm_set1_epi16(short(spec.mask1));
+	const __m128i v1 = _mm_set1_epi16(short(spec.value1));
+	const __m128i m2 = _mm_set1_epi16(short(spec.mask2));
+	const __m128i v2 = _mm_set1_epi16(short(spec.value2));
+
+	unsigned int n = 0;
+	unsigned int i = 0;
+	for (; i + 8 <= size; i += 8)
+	{
+		__m128i x = _mm_loadu_si128((const __m128i*)(data + i));
+		__m128i hit = _mm_or_si128(
+			_mm_cmpeq_epi16(_mm_and_si128(x, m1), v1),
+			_mm_cmpeq_epi16(_mm_and_si128(x, m2), v2));
+		// two mask bits per word -> keep the even ones
+		uint32_t bits = _mm_movemask_epi8(hit) & 0x5555;
+		while (bits)
+		{
+			pos[n++] = i + (LowestBit(bits) >> 1);
+			bits &= bits - 1;
+		}
+	}
+	return FindMarkersTail(data, i, size, spec, pos, n);
+}
+
+#else
+
+unsigned int FindMarkersSSE2(const uint16_t *data, unsigned int size,
+	const CMarkerSpec &spec, uint32_t *pos)
+{ return FindMarkersScalar(data, size, spec, pos); }
+
+#endif
+
+
+// === AVX2: 16 words per step ==============================================
+
+#ifdef MARKER_HAVE_AVX2
+
+MARKER_TARGET_AVX2
+unsigned int FindMarkersAVX2(const uint16_t *data, unsigned int size,
+	const CMarkerSpec &spec, uint32_t *pos)
+{
+	const __m256i m1 = _mm256_set1_epi16(short(spec.mask1));
+	const __m256i v1 = _mm256_set1_epi16(short(spec.value1));
+	const __m256i m2 = _mm256_set1_epi16(short(spec.mask2));
+	const __m256i v2 = _mm256_set1_epi16(short(spec.value2));
+
+	unsigned int n = 0;
+	unsigned int i = 0;
+	for (; i + 16 <= size; i += 16)
+	{
+		__m256i x = _mm256_loadu_si256((const __m256i*)(data + i));
+		__m256i hit = _mm256_or_si256(
+			_mm256_cmpeq_epi16(_mm256_and_si256(x, m1), v1),
+			_mm256_cmpeq_epi16(_mm256_and_si256(x, m2), v2));
+		uint32_t bits = uint32_t(_mm256_movemask_epi8(hit)) & 0x55555555;
+		while (bits)
+		{
+			pos[n++] = i + (LowestBit(bits) >> 1);
+			bits &= bits - 1;
+		}
+	}
+	return FindMarkersTail(data, i, size, spec, pos, n);
+}
+
+#else
+
+unsigned int FindMarkersAVX2(const uint16_t *data, unsigned int size,
+	const CMarkerSpec &spec, uint32_t *pos)
+{ return FindMarkersSSE2(data, size, spec, pos); }
+
+#endif
+
+
+// === kernel selection =====================================================
+
+bool MarkerKernelSupported(MarkerSearchKernel kernel)
+{
+	switch (kernel)
+	{
+	case MARKER_SCALAR:
+	case MARKER_AUTO:
+		return true;
+	case MARKER_SSE2:
+#ifdef MARKER_HAVE_SSE2
+		return true;
+#else
+		return false;
+#endif
+	case MARKER_AVX2:
+#if defined(MARKER_HAVE_AVX2) && defined(__GNUC__)
+		return __builtin_cpu_supports("avx2") != 0;
+#elif defined(MARKER_HAVE_AVX2)
+		{
+			int info[4];
+			__cpuid(info, 0);
+			if (info[0] < 7) return false;
+			__cpuidex(info, 7, 0);
+			return (info[1] & (1 << 5)) != 0;
+		}
+#else
+		return false;
+#endif
+	}
+	return false;
+}
+
+
+const char* MarkerKernelName(MarkerSearchKernel kernel)
+{
+	switch (kernel)
+	{
+	case MARKER_SCALAR: return "scalar";
+	case MARKER_SSE2:   return "SSE2";
+	case MARKER_AVX2:   return "AVX2";
+	case MARKER_AUTO:   return "auto";
+	}
+	return "?";
+}
+
+
+unsigned int FindMarkers(const uint16_t *data, unsigned int size,
+	const CMarkerSpec &spec, uint32_t *pos, MarkerSearchKernel kernel)
+{
+	static const bool haveAVX2 = MarkerKernelSupported(MARKER_AVX2);
+	static const bool haveSSE2 = MarkerKernelSupported(MARKER_SSE2);
+
+	switch (kernel)
+	{
+	case MARKER_AUTO:
+		if (haveAVX2) return FindMarkersAVX2(data, size, spec, pos);
+		if (haveSSE2) return FindMarkersSSE2(data, size, spec, pos);
+		break;
+	case MARKER_AVX2:
+		if (haveAVX2) return FindMarkersAVX2(data, size, spec, pos);
+		break;
+	case MARKER_SSE2:
+		if (haveSSE2) return FindMarkersSSE2(data, size, spec, pos);
+		break;
+	default:
+		break;
+	}
+	return FindMarkersScalar(data, size, spec, pos);
+}
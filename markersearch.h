@@ -0,0 +1,42 @@
+// markersearch.h
+//
+// Search kernels for the record boundary markers of the data stream.
+// A word is a marker if it matches at least one of two mask/value
+// pairs (record start and record end). The kernels store the positions
+// of all markers of a block, the record scanners step from marker to
+// marker instead of testing every word.
+
+#pragma once
+
+#include <stdint.h>
+
+
+struct CMarkerSpec
+{
+	uint16_t mask1, value1; // record start
+	uint16_t mask2, value2; // record end
+	CMarkerSpec(uint16_t m1, uint16_t v1, uint16_t m2, uint16_t v2)
+		: mask1(m1), value1(v1), mask2(m2), value2(v2) {}
+	bool IsMarker(uint16_t x) const
+	{ return (x & mask1) == value1 || (x & mask2) == value2; }
+};
+
+
+enum MarkerSearchKernel { MARKER_SCALAR, MARKER_SSE2, MARKER_AVX2, MARKER_AUTO };
+
+// Stores the positions of all markers in data[0..size-1] into pos
+// (pos must have room for size entries) and returns the number of markers.
+unsigned int FindMarkersScalar(const uint16_t *data, unsigned int size,
+	const CMarkerSpec &spec, uint32_t *pos);
+unsigned int FindMarkersSSE2(const uint16_t *data, unsigned int size,
+	const CMarkerSpec &spec, uint32_t *pos);
+unsigned int FindMarkersAVX2(const uint16_t *data, unsigned int size,
+	const CMarkerSpec &spec, uint32_t *pos);
+
+// Best kernel supported by the CPU (kernels not supported fall back
+// to the scalar one)
+unsigned int FindMarkers(const uint16_t *data, unsigned int size,
+	const CMarkerSpec &spec, uint32_t *pos, MarkerSearchKernel kernel = MARKER_AUTO);
+
+bool MarkerKernelSupported(MarkerSearchKernel kernel);
+const char* MarkerKernelName(MarkerSearchKernel kernel);
@@ -0,0 +1,154 @@
+// multitest.cpp
+
+#include <string.h>
+#include <chrono>
+#include <thread>
+#include <mutex>
+#include "psi46test.h"
+#include "datastream.h"
+#include "dtbemu.h"
+#include "usbtuning.h"
+#include "multitest.h"
+
+
+// serializes the USB device open of the threads
+static std::mutex openLock;
+
+
+static double Seconds(std::chrono::steady_clock::time_point t0)
+{
+	return std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+}
+
+
+static bool Connect(CMultiTestBoard &b, CDtbEmulator &emu)
+{
+	if (b.dtb.compare(0, 3, "emu") == 0)
+	{
+		tb.OpenEmulator(emu, false);
+		return true;
+	}
+
+	std::lock_guard<std::mutex> lock(openLock);
+	if (!tb.Open(b.dtb, false))
+	{
+		b.error = string("USB error: ") + tb.ConnectionError();
+		return false;
+	}
+	ApplyUsbTuning(tb, false);
+	return true;
+}
+
+
+static void TestBoard(CMultiTestBoard &b, const CSettings &base, int entry)
+{
+	std::chrono::steady_clock::time_point t0 = std::chrono::steady_clock::now();
+
+	CDtbEmulator emu;
+	try
+	{
+		// --- per board settings and log file
+		settings = base;
+		string name = "psi46test_" + b.dtb + ".ini";
+		FILE *f = fopen(name.c_str(), "rt");
+		if (f)
+		{
+			fclose(f);
+			if (!settings.Read(name.c_str())) { b.error = "error reading " + name; return; }
+		}
+
+		name = "multitest_" + b.dtb + ".log";
+		if (!Log.append(name.c_str())) { b.error = "error creating " + name; return; }
+
+		if (!Connect(b, emu)) { Log.close(); return; }
+
+		// --- chip test (as test_chip)
+		nEntry = entry;
+		g_chipdata.Invalidate();
+		g_chipdata.nEntry = entry;
+		Log.section("CHIP1", false);
+		Log.printf(" %s\n", b.chipId.c_str());
+		strncpy(g_chipdata.chipId, b.chipId.c_str(), sizeof(g_chipdata.chipId) - 1);
+		g_chipdata.chipId[sizeof(g_chipdata.chipId) - 1] = 0;
+
+		GetTimeStamp(g_chipdata.startTime);
+		Log.timestamp("BEGIN");
+
+		tb.SetLed(0x10);
+		bool repeat;
+		b.bin = settings.rocType == 0 ? TestRocAna::test_roc(repeat) : TestRocDig::test_roc(repeat);
+		tb.SetLed(0x00);
+		tb.Flush();
+
+		GetTimeStamp(g_chipdata.endTime);
+		Log.timestamp("END");
+		Log.puts("\n");
+		b.ok = true;
+	}
+	catch (CRpcError &e)
+	{
+		b.error = string("RPC error: ") + e.GetMsg();
+	}
+	catch (DataPipeException &e)
+	{
+		b.error = string("data error: ") + e.what();
+	}
+	catch (std::exception &e)
+	{
+		b.error = string("error: ") + e.what();
+	}
+	catch (...)
+	{
+		b.error = "unknown exception";
+	}
+	tb.Close();
+	Log.close();
+	b.chip = g_chipdata;
+
+	if (b.ok)
+	{
+		string name = "multitest_" + b.dtb + ".txt";
+		FILE *f = fopen(name.c_str(), "at");
+		if (f) { g_chipdata.Save(f); fclose(f); }
+	}
+	b.time = Seconds(t0);
+}
+
+
+// a USB DTB can only be opened once: not the one of the shell and
+// not twice in the list
+static bool InUse(vector<CMultiTestBoard> &boards, unsigned int i)
+{
+	CMultiTestBoard &b = boards[i];
+	if (b.dtb.compare(0, 3, "emu") == 0) return false;
+	if (tb.IsConnected() && b.dtb == tb.GetUsbId())
+	{
+		b.error = "DTB is open in the shell (close it first)";
+		return true;
+	}
+	for (unsigned int k = 0; k < i; k++)
+		if (boards[k].dtb == b.dtb)
+		{
+			b.error = "DTB listed twice";
+			return true;
+		}
+	return false;
+}
+
+
+double MultiTest(vector<CMultiTestBoard> &boards)
+{
+	std::chrono::steady_clock::time_point t0 = std::chrono::steady_clock::now();
+
+	vector<std::thread> threads;
+	for (unsigned int i = 0; i < boards.size(); i++)
+	{
+		boards[i].ok = false;
+		boards[i].error.clear();
+		if (InUse(boards, i)) continue;
+		threads.push_back(std::thread(TestBoard, std::ref(boards[i]), std::cref(settings), ++nEntry));
+	}
+	for (unsigned int i = 0; i < threads.size(); i++) threads[i].join();
+
+	return Seconds(t0);
+}
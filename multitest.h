@@ -0,0 +1,39 @@
+// multitest.h
+//
+// Parallel chip test on several DTBs. Each board is tested by a thread of
+// its own with its own CTestboard, settings, log file and CChip result
+// (tb, settings, Log and g_chipdata are thread_local, see psi46test.h):
+//
+//   settings  copy of the settings of the main thread, then the board
+//             file psi46test_<dtb>.ini if it exists (only the tags in it)
+//   log       multitest_<dtb>.log (appended)
+//   results   CChip::Save of each chip appended to multitest_<dtb>.txt
+//
+// DTB names starting with "emu" connect a software DTB (see dtbemu.h).
+
+#pragma once
+
+#include <string>
+#include <vector>
+#include "chipdatabase.h"
+
+
+struct CMultiTestBoard
+{
+	std::string dtb;     // USB name of the DTB
+	std::string chipId;
+	bool ok;             // test done
+	std::string error;   // if !ok
+	int bin;
+	double time;         // s (open to close)
+	CChip chip;          // result of the test
+
+	CMultiTestBoard() : ok(false), bin(0), time(0.0) {}
+};
+
+
+// Tests one chip on each board, returns the wall time (s).
+double MultiTest(std::vector<CMultiTestBoard> &boards);
+
+// time stamp for CChip (cmd_wafertest.cpp)
+void GetTimeStamp(char datetime[]);
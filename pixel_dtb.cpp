@@ -1,7 +1,11 @@
 // psi46_tb.cpp
 
 #include "pixel_dtb.h"
+#include "dtbemu.h"
 #include <stdio.h>
+#include <string.h>
+#include <map>
+#include <mutex>
 
 #ifndef _WIN32
 #include <unistd.h>
@@ -36,6 +40,444 @@ bool CTestboard::RpcLink(bool verbose)
 }
 
 
+void CTestboard::GetRpcCallNames(vector<string> &names)
+{
+	names.clear();
+	for (unsigned int i = 0; i < rpc_cmdListSize; i++)
+	{
+		int id = rpc_cmdId[i];
+		if (id < 0) continue;
+		if (names.size() <= (unsigned int)id) names.resize(id + 1);
+		names[id] = rpc_cmdName[i];
+	}
+}
+
+
+// === call id cache ========================================================
+//
+// file: for each DTB a block of
+//   DTB <board id> <rpc timestamp>
+//   <call id> <call name>
+//   ...
+// separated by an empty line
+// The file is shared by all boards (multitest: one thread per board).
+
+static std::mutex rpcCacheLock;
+
+struct CRpcCacheBlock
+{
+	int boardId;
+	string timestamp;
+	vector< std::pair<unsigned int, int> > ids; // rpc_cmdName index, call id
+};
+
+
+// reply of GetRpcTimestamp (void, string data message)
+class CRpcDeferredTimestamp : public CRpcDeferredCall
+{
+public:
+	string value;
+	CRpcDeferredTimestamp(uint16_t callId, unsigned int cmdIndex)
+		: CRpcDeferredCall(callId, cmdIndex) {}
+	void Receive(CRpcIo &rpc_io)
+	{
+		rpcMessage msg;
+		msg.Receive(rpc_io);
+		msg.Check(cmd, 0);
+		rpc_Receive(rpc_io, value);
+	}
+};
+
+
+static bool RpcCacheRead(const char *filename, const std::map<string, unsigned int> &index,
+	vector<CRpcCacheBlock> &blocks)
+{
+	std::lock_guard<std::mutex> lock(rpcCacheLock);
+	FILE *f = fopen(filename, "rt");
+	if (!f) return false;
+
+	char line[512];
+	while (fgets(line, sizeof(line), f))
+	{
+		line[strcspn(line, "\r\n")] = 0;
+		int id, pos;
+		if (sscanf(line, "DTB %i %n", &id, &pos) == 1)
+		{
+			blocks.push_back(CRpcCacheBlock());
+			blocks.back().boardId = id;
+			blocks.back().timestamp = line + pos;
+			continue;
+		}
+		if (blocks.empty()) continue;
+
+		char name[256];
+		if (sscanf(line, "%i %255s", &id, name) != 2) continue;
+		std::map<string, unsigned int>::const_iterator i = index.find(name);
+		if (i == index.end() || id < 0) continue;
+		blocks.back().ids.push_back(std::make_pair(i->second, id));
+	}
+	fclose(f);
+	return true;
+}
+
+
+CRpcFuture<int32_t> CTestboard::GetRpcCallIdDeferred(string &callName)
+{
+	RPC_THREAD_LOCK
+	rpcMessage msg;
+	msg.Create(rpc_cmdId[1]);
+	msg.Send(*rpc_io);
+	rpc_Send(*rpc_io, callName);
+	return CRpcFuture<int32_t>(*rpc_io, rpc_Defer(*rpc_io, new CRpcDeferredValue<int32_t>(rpc_cmdId[1], 1)));
+}
+
+
+bool CTestboard::RpcCacheValidate(int idTs, int idBid, int &boardId, string &ts)
+{
+	RPC_THREAD_LOCK
+	unsigned int iTs  = rpc_CmdIndex("GetRpcTimestamp$");
+	unsigned int iBid = rpc_CmdIndex("GetBoardId$");
+
+	// one transfer: the lookups of both calls, then both calls with the
+	// cached ids
+	string name = rpc_cmdName[iTs];
+	CRpcFuture<int32_t> lookupTs = GetRpcCallIdDeferred(name);
+	name = rpc_cmdName[iBid];
+	CRpcFuture<int32_t> lookupBid = GetRpcCallIdDeferred(name);
+	rpcMessage msg;
+	msg.Create(idTs);
+	msg.Send(*rpc_io);
+	std::shared_ptr<CRpcDeferredTimestamp> tsCall =
+		rpc_Defer(*rpc_io, new CRpcDeferredTimestamp(idTs, iTs));
+	msg.Create(idBid);
+	msg.Send(*rpc_io);
+	CRpcFuture<uint16_t> bid(*rpc_io, rpc_Defer(*rpc_io, new CRpcDeferredValue<uint16_t>(idBid, iBid)));
+
+	rpc_cmdId[iTs]  = lookupTs.Get();
+	rpc_cmdId[iBid] = lookupBid.Get();
+	if (rpc_cmdId[iTs] == idTs && rpc_cmdId[iBid] == idBid)
+	{
+		boardId = bid.Get();
+		rpc_Sync(*rpc_io, tsCall.get());
+		if (tsCall->error.error != CRpcError::OK) throw tsCall->error;
+		ts = tsCall->value;
+		return true;
+	}
+
+	// other firmware: the cached ids called other functions, skip their
+	// replies up to the reply of GetRpcVersion (fixed id)
+	rpc_Cancel(*rpc_io);
+	msg.Create(rpc_cmdId[0]);
+	msg.Send(*rpc_io);
+	rpc_io->Flush();
+	for (int n = 0; n < 16; n++)
+	{
+		try
+		{
+			msg.Receive(*rpc_io);
+			if (msg.GetCmd() == rpc_cmdId[0]) return false;
+		}
+		catch (CRpcError &e)
+		{
+			if (e.error != CRpcError::NO_CMD_MSG) throw;
+		}
+	}
+	throw CRpcError(CRpcError::WRONG_MSG_TYPE);
+}
+
+
+bool CTestboard::RpcCacheLoad(const char *filename)
+{
+	rpcCacheFile = filename;
+	rpcCacheBoardId = -1;
+	rpcCacheTimestamp.clear();
+
+	std::map<string, unsigned int> index;
+	for (unsigned int i = 2; i < rpc_cmdListSize; i++) index[rpc_cmdName[i]] = i;
+	vector<CRpcCacheBlock> blocks;
+	RpcCacheRead(filename, index, blocks);
+
+	// call ids of the key calls: last written block
+	unsigned int iTs  = rpc_CmdIndex("GetRpcTimestamp$");
+	unsigned int iBid = rpc_CmdIndex("GetBoardId$");
+	int idTs = -1, idBid = -1;
+	if (!blocks.empty())
+	{
+		const vector< std::pair<unsigned int, int> > &ids = blocks.back().ids;
+		for (unsigned int k = 0; k < ids.size(); k++)
+		{
+			if (ids[k].first == iTs)  idTs  = ids[k].second;
+			if (ids[k].first == iBid) idBid = ids[k].second;
+		}
+	}
+
+	// --- key: board id and rpc timestamp of the firmware
+	int boardId;
+	string ts;
+	bool valid = false;
+	try
+	{
+		if (idTs >= 0 && idBid >= 0) valid = RpcCacheValidate(idTs, idBid, boardId, ts);
+		if (!valid)
+		{
+			boardId = GetBoardId();
+			GetRpcTimestamp(ts);
+		}
+	}
+	catch (CRpcError &e)
+	{
+		return false;
+	}
+	rpcCacheBoardId = boardId;
+	rpcCacheTimestamp = ts;
+	if (!valid) return false;
+
+	// --- ids of this key, no lookups
+	for (unsigned int b = 0; b < blocks.size(); b++)
+	{
+		if (blocks[b].boardId != boardId || blocks[b].timestamp != ts) continue;
+		const vector< std::pair<unsigned int, int> > &ids = blocks[b].ids;
+		for (unsigned int k = 0; k < ids.size(); k++) rpc_cmdId[ids[k].first] = ids[k].second;
+		return true;
+	}
+	return false;
+}
+
+
+bool CTestboard::RpcCacheSave()
+{
+	if (rpcCacheBoardId < 0) return false;
+
+	// keep the blocks of the other boards
+	std::lock_guard<std::mutex> lock(rpcCacheLock);
+	string text;
+	FILE *f = fopen(rpcCacheFile.c_str(), "rt");
+	if (f)
+	{
+		char line[512];
+		bool skip = false;
+		while (fgets(line, sizeof(line), f))
+		{
+			int id;
+			if (sscanf(line, "DTB %i", &id) == 1) skip = id == rpcCacheBoardId;
+			if (!skip) text += line;
+		}
+		fclose(f);
+	}
+
+	f = fopen(rpcCacheFile.c_str(), "wt");
+	if (!f) return false;
+	fputs(text.c_str(), f);
+	fprintf(f, "DTB %i %s\n", rpcCacheBoardId, rpcCacheTimestamp.c_str());
+	for (unsigned int i = 2; i < rpc_cmdListSize; i++)
+		if (rpc_cmdId[i] >= 0) fprintf(f, "%i %s\n", rpc_cmdId[i], rpc_cmdName[i]);
+	fprintf(f, "\n");
+	bool ok = fclose(f) == 0;
+
+	rpcCacheBoardId = -1;
+	return ok;
+}
+
+
+// === RPC capture ==========================================================
+
+bool CTestboard::CaptureStart(const char *filename)
+{
+	CaptureStop();
+	rpc_Sync(*rpc_io);
+	rpc_io->Flush();
+
+	vector<CRpcCallIdEntry> ids;
+	for (unsigned int i = 2; i < rpc_cmdListSize; i++)
+	{
+		if (rpc_cmdId[i] < 0) continue;
+		CRpcCallIdEntry e;
+		e.id = rpc_cmdId[i];
+		e.name = rpc_cmdName[i];
+		ids.push_back(e);
+	}
+	if (!capture.Start(filename, *rpc_io, rpc_timestamp, ids)) return false;
+	rpc_io = &capture;
+	return true;
+}
+
+
+bool CTestboard::CaptureStop()
+{
+	if (!capture.IsRunning()) return true;
+	try
+	{
+		rpc_Sync(*rpc_io);
+		rpc_io->Flush();
+	}
+	catch (CRpcError &e) {}
+	rpc_io = capture.GetConnection();
+	return capture.Stop();
+}
+
+
+bool CTestboard::OpenReplay(CRpcReplay &r, bool init)
+{
+	replay = &r;
+	r.Open();
+	rpc_Connect(r);
+
+	std::map<string, unsigned int> index;
+	for (unsigned int i = 2; i < rpc_cmdListSize; i++) index[rpc_cmdName[i]] = i;
+	const vector<CRpcCallIdEntry> &ids = r.GetCallIds();
+	for (unsigned int k = 0; k < ids.size(); k++)
+	{
+		std::map<string, unsigned int>::iterator i = index.find(ids[k].name);
+		if (i != index.end()) rpc_cmdId[i->second] = ids[k].id;
+	}
+
+	if (init) Init();
+	return true;
+}
+
+
+// === I/O thread ===========================================================
+
+bool CTestboard::IoThreadStart()
+{
+	if (ioThread.IsRunning()) return true;
+	if (capture.IsRunning()) return false;
+	rpc_Sync(*rpc_io);
+	rpc_io->Flush();
+	ioThread.Start(*rpc_io);
+	rpc_io = &ioThread;
+	return true;
+}
+
+
+bool CTestboard::IoThreadStop()
+{
+	if (!ioThread.IsRunning()) return true;
+	if (capture.IsRunning()) return false;
+	rpc_Sync(*rpc_io);
+	rpc_io = ioThread.GetConnection();
+	ioThread.Stop();
+	return true;
+}
+
+
+// === deferred calls =======================================================
+
+unsigned int CTestboard::rpc_CmdIndex(const char *prefix)
+{
+	size_t n = strlen(prefix);
+	for (unsigned int i = 0; i < rpc_cmdListSize; i++)
+		if (strncmp(rpc_cmdName[i], prefix, n) == 0) return i;
+	throw CRpcError(CRpcError::UNKNOWN_CMD);
+}
+
+
+CRpcFuture<uint16_t> CTestboard::GetBoardIdDeferred()
+{
+	static const unsigned int index = rpc_CmdIndex("GetBoardId$");
+	return rpc_Deferred<uint16_t>(index);
+}
+
+
+CRpcFuture<uint16_t> CTestboard::_GetVDDeferred()
+{
+	static const unsigned int index = rpc_CmdIndex("_GetVD$");
+	return rpc_Deferred<uint16_t>(index);
+}
+
+
+CRpcFuture<uint16_t> CTestboard::_GetVADeferred()
+{
+	static const unsigned int index = rpc_CmdIndex("_GetVA$");
+	return rpc_Deferred<uint16_t>(index);
+}
+
+
+CRpcFuture<uint16_t> CTestboard::_GetIDDeferred()
+{
+	static const unsigned int index = rpc_CmdIndex("_GetID$");
+	return rpc_Deferred<uint16_t>(index);
+}
+
+
+CRpcFuture<uint16_t> CTestboard::_GetIADeferred()
+{
+	static const unsigned int index = rpc_CmdIndex("_GetIA$");
+	return rpc_Deferred<uint16_t>(index);
+}
+
+
+CRpcFuture<uint16_t> CTestboard::GetADCDeferred(uint8_t addr)
+{
+	static const unsigned int index = rpc_CmdIndex("GetADC$");
+	RPC_THREAD_LOCK
+	uint16_t id = rpc_GetCallId(index);
+	rpcMessage msg;
+	msg.Create(id);
+	msg.Put_UINT8(addr);
+	msg.Send(*rpc_io);
+	return CRpcFuture<uint16_t>(*rpc_io, rpc_Defer(*rpc_io, new CRpcDeferredValue<uint16_t>(id, index)));
+}
+
+
+CRpcFuture<uint32_t> CTestboard::Daq_GetSizeDeferred(uint8_t channel)
+{
+	static const unsigned int index = rpc_CmdIndex("Daq_GetSize$");
+	RPC_THREAD_LOCK
+	uint16_t id = rpc_GetCallId(index);
+	rpcMessage msg;
+	msg.Create(id);
+	msg.Put_UINT8(channel);
+	msg.Send(*rpc_io);
+	return CRpcFuture<uint32_t>(*rpc_io, rpc_Defer(*rpc_io, new CRpcDeferredValue<uint32_t>(id, index)));
+}
+
+
+CRpcFuture<uint8_t> CTestboard::UpgradeDataDeferred(string &record)
+{
+	static const unsigned int index = rpc_CmdIndex("UpgradeData$");
+	RPC_THREAD_LOCK
+	uint16_t id = rpc_GetCallId(index);
+	rpcMessage msg;
+	msg.Create(id);
+	msg.Send(*rpc_io);
+	rpc_Send(*rpc_io, record);
+	return CRpcFuture<uint8_t>(*rpc_io, rpc_Defer(*rpc_io, new CRpcDeferredValue<uint8_t>(id, index)));
+}
+
+
+CRpcDataFuture<uint8_t, uint16_t> CTestboard::Daq_ReadDeferred(uint32_t blocksize, uint8_t channel)
+{
+	// Daq_Read is overloaded: uint8_t Daq_Read(HWvectorR<uint16_t>&, uint32_t, uint8_t)
+	static const unsigned int index = rpc_CmdIndex("Daq_Read$C5SIC");
+	RPC_THREAD_LOCK
+	uint16_t id = rpc_GetCallId(index);
+	rpcMessage msg;
+	msg.Create(id);
+	msg.Put_UINT32(blocksize);
+	msg.Put_UINT8(channel);
+	msg.Send(*rpc_io);
+	return CRpcDataFuture<uint8_t, uint16_t>(*rpc_io,
+		rpc_Defer(*rpc_io, new CRpcDeferredData<uint8_t, uint16_t>(id, index)));
+}
+
+
+CRpcDataFuture<bool, uint8_t> CTestboard::TestColPixelDeferred(uint8_t col, uint8_t trimbit, bool sensor_cal)
+{
+	static const unsigned int index = rpc_CmdIndex("TestColPixel$");
+	RPC_THREAD_LOCK
+	uint16_t id = rpc_GetCallId(index);
+	rpcMessage msg;
+	msg.Create(id);
+	msg.Put_UINT8(col);
+	msg.Put_UINT8(trimbit);
+	msg.Put_BOOL(sensor_cal);
+	msg.Send(*rpc_io);
+	return CRpcDataFuture<bool, uint8_t>(*rpc_io,
+		rpc_Defer(*rpc_io, new CRpcDeferredData<bool, uint8_t>(id, index)));
+}
+
+
 bool CTestboard::EnumNext(string &name)
 {
 	char s[64];
@@ -129,10 +571,23 @@ bool CTestboard::FindDTB(string &usbId)
 }
 
 
-bool CTestboard::Open(string &usbId, bool init)
+bool CTestboard::Open(string &name, bool init)
 {
 	rpc_Clear();
-	if (!usb.Open(&(usbId[0]))) return false;
+	if (!usb.Open(&(name[0]))) return false;
+	usbId = name;
+
+	RpcCacheLoad(RPC_CACHE_FILE);
+	if (init) Init();
+	return true;
+}
+
+
+bool CTestboard::OpenEmulator(CDtbEmulator &emu, bool init)
+{
+	emulator = &emu;
+	emu.Open();
+	rpc_Connect(emu);
 
 	if (init) Init();
 	return true;
@@ -142,7 +597,26 @@ bool CTestboard::Open(string &usbId, bool init)
 void CTestboard::Close()
 {
 //	if (usb.Connected()) Daq_Close();
+	rpc_Cancel(*rpc_io);
+	CaptureStop();
+	IoThreadStop();
+	if (replay)
+	{
+		replay->Close();
+		replay = 0;
+		rpc_Connect(usb);
+		return;
+	}
+	if (emulator)
+	{
+		emulator->Close();
+		emulator = 0;
+		rpc_Connect(usb);
+		return;
+	}
+	RpcCacheSave();
 	usb.Close();
+	usbId.clear();
 	rpc_Clear();
 }
 
@@ -150,9 +624,19 @@ void CTestboard::Close()
 void CTestboard::mDelay(uint16_t ms)
 {
 	Flush();
+	if (emulator)
+	{
+		RPC_THREAD_LOCK
+		if (ioThread.IsRunning()) ioThread.WaitIdle();
+		emulator->Delay(40000ull*ms);
+		return;
+	}
+	if (replay) return;
+	capture.WaitBegin();
 #ifdef _WIN32
 	Sleep(ms);			// Windows
 #else
 	usleep(ms*1000);	// Linux
 #endif
+	capture.WaitEnd();
 }
@@ -25,6 +25,13 @@
 #endif
 
 #include "usb.h"
+#include "rpc_capture.h"
+#include "rpc_iothread.h"
+
+class CDtbEmulator;
+
+// call id cache of the DTB functions (see RpcCacheLoad)
+#define RPC_CACHE_FILE "rpc_callid.txt"
 
 // size of ROC pixel array
 #define ROC_NUMROWS  80  // # rows
@@ -75,11 +82,25 @@ class CTestboard
 	CPipeClient pipe;
 #endif
 	CUSB usb;
+	CDtbEmulator *emulator; // connected to the software DTB (see dtbemu.h)
+	CRpcReplay *replay;     // connected to a RPC capture replay
+	CRpcCapture capture;
+	CRpcIoThread ioThread;
+
+	// call id cache key (board id < 0: no cache)
+	string rpcCacheFile;
+	int rpcCacheBoardId;
+	string rpcCacheTimestamp;
+
+	string usbId; // of the open USB connection
+
+	CRpcFuture<int32_t> GetRpcCallIdDeferred(string &callName);
+	bool RpcCacheValidate(int idTs, int idBid, int &boardId, string &ts);
 
 public:
 	CRpcIo& GetIo() { return *rpc_io; }
 
-	CTestboard() { RPC_INIT rpc_io = &usb; }
+	CTestboard() : emulator(0), replay(0), rpcCacheBoardId(-1) { RPC_INIT rpc_io = &usb; }
 	~CTestboard() { RPC_EXIT }
 
 
@@ -96,6 +117,39 @@ public:
 
 	bool RpcLink(bool verbose = true);
 
+	// names[call id] = call name of the linked calls (for RpcStat)
+	void GetRpcCallNames(vector<string> &names);
+
+	// Call id cache: RpcCacheLoad (called by Open before Init) reads the
+	// board id and RPC timestamp of the DTB in one transfer. It also sends
+	// the GetRpcCallId lookups of these two calls and calls them with the
+	// ids of the last cached block. The ids are assumed to be stable,
+	// because they are at the start of the RPC table. If the key has a
+	// block, its call ids are taken without lookups. Otherwise (or if the
+	// two ids have changed) the calls are linked lazily. RpcCacheSave
+	// (called by Close) then stores the ids resolved so far for the key.
+	bool RpcCacheLoad(const char *filename);
+	bool RpcCacheSave();
+
+	// RPC capture (see rpc_capture.h): CaptureStart puts the capture
+	// between the host and the current connection, starting with the call
+	// ids resolved so far. OpenReplay connects a loaded capture instead of
+	// the DTB and takes its call ids.
+	bool CaptureStart(const char *filename);
+	bool CaptureStop();
+	bool IsCapturing() { return capture.IsRunning(); }
+	const CRpcCaptureTiming& GetCaptureTiming() { return capture.GetTiming(); }
+	bool OpenReplay(CRpcReplay &r, bool init=true);
+
+	// I/O thread (see rpc_iothread.h): a thread of its own owns the
+	// connection and does all transfers, the calling threads queue their
+	// requests and reads. Calls return without waiting for the USB
+	// transfer. Start and stop it (like the capture) only while no other
+	// thread uses the testboard. Not available while capturing.
+	bool IoThreadStart();
+	bool IoThreadStop();
+	bool IsIoThread() { return ioThread.IsRunning(); }
+
 	// === DTB connection ====================================================
 
 	bool EnumFirst(unsigned int &nDevices) { return usb.EnumFirst(nDevices); };
@@ -104,6 +158,7 @@ public:
 
 	bool FindDTB(string &usbId);
 	bool Open(string &name, bool init=true); // opens a connection
+	bool OpenEmulator(CDtbEmulator &emu, bool init=true); // connects the software DTB
 	void Close();				// closes the connection to the testboard
 
 #ifdef _WIN32
@@ -111,12 +166,57 @@ public:
 	void ClosePipe() { pipe.Close(); }
 #endif
 
-	bool IsConnected() { return usb.Connected(); }
+	bool IsConnected() { return emulator || replay || usb.Connected(); }
+	const string& GetUsbId() { return usbId; } // empty if not connected by USB
+	bool IsEmulated() { return emulator != 0; }
+	bool IsReplay() { return replay != 0; }
 	const char * ConnectionError()
-	{ return usb.GetErrorMsg(usb.GetLastError()); }
+	{ return (emulator || replay) ? "" : usb.GetErrorMsg(usb.GetLastError()); }
+
+	bool SetUsbTuning(const CUsbTuning &tuning)
+	{
+		RPC_THREAD_LOCK
+		if (ioThread.IsRunning()) ioThread.WaitIdle();
+		return usb.SetTuning(tuning);
+	}
+	const CUsbTuning& GetUsbTuning() { return usb.GetTuning(); }
+
+	void Flush() { RPC_THREAD_LOCK rpc_io->Flush(); }
+	void Clear() { RPC_THREAD_LOCK rpc_Cancel(*rpc_io); rpc_io->Clear(); }
+
+
+	// === deferred calls ====================================================
+	// The request is sent without waiting for the reply. The result is read
+	// when the future is resolved, all pending replies by Sync.
+
+private:
+	// rpc_cmdName index of the first call whose name starts with prefix
+	static unsigned int rpc_CmdIndex(const char *prefix);
+
+	// sends a call without parameters and queues its reply
+	template <class T>
+	CRpcFuture<T> rpc_Deferred(unsigned int index)
+	{
+		RPC_THREAD_LOCK
+		uint16_t id = rpc_GetCallId(index);
+		rpcMessage msg;
+		msg.Create(id);
+		msg.Send(*rpc_io);
+		return CRpcFuture<T>(*rpc_io, rpc_Defer(*rpc_io, new CRpcDeferredValue<T>(id, index)));
+	}
+public:
+	void Sync() { rpc_Sync(*rpc_io); }
 
-	void Flush() { rpc_io->Flush(); }
-	void Clear() { rpc_io->Clear(); }
+	CRpcFuture<uint16_t> GetBoardIdDeferred();
+	CRpcFuture<uint16_t> _GetVDDeferred();
+	CRpcFuture<uint16_t> _GetVADeferred();
+	CRpcFuture<uint16_t> _GetIDDeferred();
+	CRpcFuture<uint16_t> _GetIADeferred();
+	CRpcFuture<uint16_t> GetADCDeferred(uint8_t addr);
+	CRpcFuture<uint32_t> Daq_GetSizeDeferred(uint8_t channel = 0);
+	CRpcFuture<uint8_t>  UpgradeDataDeferred(string &record);
+	CRpcDataFuture<uint8_t, uint16_t> Daq_ReadDeferred(uint32_t blocksize = 65536, uint8_t channel = 0);
+	CRpcDataFuture<bool, uint8_t> TestColPixelDeferred(uint8_t col, uint8_t trimbit, bool sensor_cal);
 
 
 	// === DTB identification ================================================
@@ -271,10 +371,14 @@ public:
 	void SetIA(double A) { _SetIA(uint16_t(A*10000)); }  // set VA current limit
 	void SetID(double A) { _SetID(uint16_t(A*10000)); }  // set VD current limit
 
-	double GetVA() { return _GetVA()/1000.0; }   // get VA voltage in V
-	double GetVD() { return _GetVD()/1000.0; }	 // get VD voltage in V
-	double GetIA() { return _GetIA()/10000.0; }  // get VA current in A
-	double GetID() { return _GetID()/10000.0; }  // get VD current in A
+	double GetVA() { return VoltageFromRaw(_GetVA()); }  // get VA voltage in V
+	double GetVD() { return VoltageFromRaw(_GetVD()); }  // get VD voltage in V
+	double GetIA() { return CurrentFromRaw(_GetIA()); }  // get VA current in A
+	double GetID() { return CurrentFromRaw(_GetID()); }  // get VD current in A
+
+	// raw values of _GetVD/VA/ID/IA (and their deferred calls) in V and A
+	static double VoltageFromRaw(uint16_t mV) { return mV/1000.0; }
+	static double CurrentFromRaw(uint16_t uA100) { return uA100/10000.0; }
 
 	RPC_EXPORT void HVon();
 	RPC_EXPORT void HVoff();
@@ -0,0 +1,192 @@
+// pixelalive.cpp
+
+#include "psi46test.h"
+#include "profiler.h"
+#include "pixelalive.h"
+
+
+namespace PixelAlive
+{
+
+// === serial ===============================================================
+
+static void ScanSerial()
+{
+	unsigned char col, row;
+	for (col=0; col<ROC_NUMCOLS; col++)
+	{
+		tb.roc_Col_Enable(col, true);
+		tb.uDelay(10);
+		for (row=0; row<ROC_NUMROWS; row++)
+		{
+			tb.roc_Pix_Cal (col, row, false);
+			tb.uDelay(20);
+			tb.Pg_Single();
+			tb.uDelay(10);
+			tb.roc_Pix_Trim(col, row, 15);
+			tb.uDelay(5);
+			tb.Pg_Single();
+			tb.uDelay(10);
+
+			tb.roc_Pix_Mask(col, row);
+			tb.roc_ClrCal();
+		}
+		tb.roc_Col_Enable(col, false);
+		tb.uDelay(10);
+	}
+}
+
+
+static void AnalyzeSerial(CSink<CEvent*> &data, CPixelMap &map)
+{
+	// for each col, for each row, (masked pixel, unmasked pixel)
+	unsigned char col, row;
+	for (col=0; col<ROC_NUMCOLS; col++)
+	{
+		for (row=0; row<ROC_NUMROWS; row++)
+		{
+			// must be empty readout
+			CEvent *ev = data.Get();
+			map.SetMaskedCount(col, row, ev->roc[0].pixel.size());
+
+			// must be single pixel hit
+			ev = data.Get();
+			map.SetUnmaskedCount(col, row, ev->roc[0].pixel.size());
+			if (ev->roc[0].pixel.size() > 0)
+			{
+				map.SetDefectColCode(col, row, ev->roc[0].pixel[0].x != col);
+				map.SetDefectRowCode(col, row, ev->roc[0].pixel[0].y != row);
+				map.SetPulseHeight(col, row, ev->roc[0].pixel[0].ph);
+			}
+		}
+	}
+}
+
+
+// === parallel =============================================================
+// trigger group k = 0 ... 2*ROC_NUMROWS-1 calibrates the pixels
+// (2*dcol + k/ROC_NUMROWS, k%ROC_NUMROWS) of all double columns
+
+static void ScanParallel()
+{
+	unsigned char dcol, col, row;
+	for (dcol=0; dcol<ROC_NUMDCOLS; dcol++) tb.roc_Col_Enable(2*dcol, true);
+	tb.uDelay(10);
+
+	for (unsigned int k=0; k<2*ROC_NUMROWS; k++)
+	{
+		col = k / ROC_NUMROWS;
+		row = k % ROC_NUMROWS;
+		for (dcol=0; dcol<ROC_NUMDCOLS; dcol++) tb.roc_Pix_Cal(2*dcol + col, row, false);
+		tb.uDelay(20);
+		tb.Pg_Single();
+		tb.uDelay(10);
+		for (dcol=0; dcol<ROC_NUMDCOLS; dcol++) tb.roc_Pix_Trim(2*dcol + col, row, 15);
+		tb.uDelay(5);
+		tb.Pg_Single();
+		tb.uDelay(10);
+
+		for (dcol=0; dcol<ROC_NUMDCOLS; dcol++) tb.roc_Pix_Mask(2*dcol + col, row);
+		tb.roc_ClrCal();
+	}
+
+	for (dcol=0; dcol<ROC_NUMDCOLS; dcol++) tb.roc_Col_Enable(2*dcol, false);
+	tb.uDelay(10);
+}
+
+
+static void AnalyzeMasked(const CEvent *ev, unsigned int col0, unsigned int row, CPixelMap &map)
+{
+	unsigned int dcol, i;
+	unsigned int count[ROC_NUMDCOLS] = { 0 };
+	const vector<CRocPixel> &mp = ev->roc[0].pixel;
+	for (i=0; i<mp.size(); i++)
+		if ((unsigned int)(mp[i].x) < ROC_NUMCOLS) count[mp[i].x/2]++;
+	for (dcol=0; dcol<ROC_NUMDCOLS; dcol++)
+		map.SetMaskedCount(2*dcol + col0, row, count[dcol]);
+}
+
+
+static void AnalyzeUnmasked(const CEvent *ev, unsigned int col0, unsigned int row, CPixelMap &map)
+{
+	unsigned int dcol, i;
+
+	// hits per double column, hits without pixel
+	vector<const CRocPixel*> hits[ROC_NUMDCOLS];
+	vector<const CRocPixel*> stray;
+	const vector<CRocPixel> &up = ev->roc[0].pixel;
+	for (i=0; i<up.size(); i++)
+	{
+		if ((unsigned int)(up[i].x) < ROC_NUMCOLS) hits[up[i].x/2].push_back(&up[i]);
+		else stray.push_back(&up[i]);
+	}
+
+	// beside the hit of its own pixel a double column can only have hits
+	// with address error of a foreign double column
+	for (dcol=0; dcol<ROC_NUMDCOLS; dcol++)
+	{
+		if (hits[dcol].size() < 2) continue;
+		for (i=0; i<hits[dcol].size(); i++)
+		{
+			const CRocPixel *p = hits[dcol][i];
+			if ((unsigned int)(p->x) == 2*dcol + col0 && (unsigned int)(p->y) == row) break;
+		}
+		if (i == hits[dcol].size()) continue;
+		const CRocPixel *own = hits[dcol][i];
+		for (i=0; i<hits[dcol].size(); i++)
+			if (hits[dcol][i] != own) stray.push_back(hits[dcol][i]);
+		hits[dcol].clear();
+		hits[dcol].push_back(own);
+	}
+
+	// unique stray hit and unique pixel without hit
+	if (stray.size() == 1)
+	{
+		unsigned int missing = ROC_NUMDCOLS, n = 0;
+		for (dcol=0; dcol<ROC_NUMDCOLS; dcol++)
+			if (hits[dcol].empty()) { missing = dcol; n++; }
+		if (n == 1) hits[missing].push_back(stray[0]);
+	}
+
+	for (dcol=0; dcol<ROC_NUMDCOLS; dcol++)
+	{
+		unsigned int col = 2*dcol + col0;
+		map.SetUnmaskedCount(col, row, hits[dcol].size());
+		if (hits[dcol].size() > 0)
+		{
+			const CRocPixel *p = hits[dcol][0];
+			map.SetDefectColCode(col, row, (unsigned int)(p->x) != col);
+			map.SetDefectRowCode(col, row, (unsigned int)(p->y) != row);
+			map.SetPulseHeight(col, row, p->ph);
+		}
+	}
+}
+
+
+static void AnalyzeParallel(CSink<CEvent*> &data, CPixelMap &map)
+{
+	for (unsigned int k=0; k<2*ROC_NUMROWS; k++)
+	{
+		// must be empty readouts
+		AnalyzeMasked(data.Get(), k / ROC_NUMROWS, k % ROC_NUMROWS, map);
+
+		// must be one hit per double column
+		AnalyzeUnmasked(data.Get(), k / ROC_NUMROWS, k % ROC_NUMROWS, map);
+	}
+}
+
+
+// === interface ============================================================
+
+void Scan(bool parallel)
+{ PROFILING
+	if (parallel) ScanParallel(); else ScanSerial();
+}
+
+
+void Analyze(CSink<CEvent*> &data, CPixelMap &map, bool parallel)
+{ PROFILING
+	if (parallel) AnalyzeParallel(data, map); else AnalyzeSerial(data, map);
+}
+
+} // namespace PixelAlive
@@ -0,0 +1,38 @@
+// pixelalive.h
+//
+// Scan and analysis of the pixel alive test, shared by the digital and
+// analog chip test (TestRocDig/TestRocAna::test_pixel). For each pixel two
+// calibrate triggers are sent, the first with the pixel masked, the second
+// unmasked, and the readouts fill the pixel map (masked and unmasked hit
+// count, column and row address defect, pulse height).
+//
+//   serial    one pixel per trigger pair, column by column
+//             (4160 x 2 triggers)
+//   parallel  one pixel in each double column per trigger pair
+//             (160 x 2 triggers), [PIXEL_ALIVE_PARALLEL] true
+//
+// In the parallel mode the hits are attributed by the double column of
+// their decoded address. A pixel with a column address error inside its
+// double column or a row address error is found as in the serial mode.
+// A column address error that changes the double column puts the hit into
+// a foreign double column: it is given back to its pixel if it is the
+// only hit without pixel and exactly one pixel of the trigger has no hit,
+// otherwise the pixel is reported without hit and the foreign pixel with
+// two hits (both defect).
+
+#pragma once
+
+#include "datastream.h"
+#include "pixelmap.h"
+
+
+namespace PixelAlive
+{
+
+// sends the calibrate triggers, all columns disabled before and after
+void Scan(bool parallel);
+
+// reads the events of Scan from data and fills map
+void Analyze(CSink<CEvent*> &data, CPixelMap &map, bool parallel);
+
+}
@@ -0,0 +1,121 @@
+// pixeldecoder.h
+//
+// Table based decoding of the 24 bit raw pixel words of the digital ROC.
+// The column digit pair (c1,c0) and the row digits (r2,r1,r0) of a raw
+// word are each translated with one lookup in a table generated at
+// compile time. The result is bit-identical to CRocPixel::DecodeRaw:
+//
+//   raw:   c1(3) | c0(3) | r2(3) | r1(3) | r0(3) | ph(4) | 0 | ph(4)
+//   error: { ph | x | y | c1 | c0 | r2 | r1 | r0 }
+
+#pragma once
+
+#include <stdint.h>
+#include "datastream.h"
+
+
+// === lookup tables ========================================================
+
+struct CPixelColEntry
+{
+	uint8_t x2;    // 2*column
+	uint8_t error; // c1, c0 and x error bits
+};
+
+struct CPixelRowEntry
+{
+	int8_t  y;
+	uint8_t odd;   // row & 1 (added to x)
+	uint8_t error; // r2, r1, r0 and y error bits
+};
+
+
+// index = (c1 << 3) + c0
+constexpr CPixelColEntry PixelColEntry(unsigned int i)
+{
+	return CPixelColEntry {
+		uint8_t(2*((i >> 3)*6 + (i & 7))),
+		uint8_t(((i >> 3) >= 6 ? 16 : 0) | ((i & 7) >= 6 ? 8 : 0)
+			| (2*((i >> 3)*6 + (i & 7)) + 1 >= 52 ? 64 : 0)) };
+}
+
+constexpr unsigned int PixelRow(unsigned int i)
+{ return ((i >> 6)*6 + ((i >> 3) & 7))*6 + (i & 7); }
+
+// index = (r2 << 6) + (r1 << 3) + r0
+constexpr CPixelRowEntry PixelRowEntry(unsigned int i)
+{
+	return CPixelRowEntry {
+		int8_t(80 - int(PixelRow(i)/2)),
+		uint8_t(PixelRow(i) & 1),
+		uint8_t(((i >> 6) >= 6 ? 4 : 0) | (((i >> 3) & 7) >= 6 ? 2 : 0) | ((i & 7) >= 6 ? 1 : 0)
+			| ((unsigned int)(80 - int(PixelRow(i)/2)) >= 80 ? 32 : 0)) };
+}
+
+
+template <unsigned int... I> struct CIndexList {};
+
+template <unsigned int N, unsigned int... I>
+struct CMakeIndexList : CMakeIndexList<N-1, N-1, I...> {};
+
+template <unsigned int... I>
+struct CMakeIndexList<0, I...> { typedef CIndexList<I...> type; };
+
+
+template <class L> struct CPixelTables;
+
+template <unsigned int... I>
+struct CPixelTables< CIndexList<I...> >
+{
+	static constexpr CPixelColEntry col[sizeof...(I)] = { PixelColEntry(I & 0x3f)... };
+	static constexpr CPixelRowEntry row[sizeof...(I)] = { PixelRowEntry(I)... };
+};
+
+template <unsigned int... I>
+constexpr CPixelColEntry CPixelTables< CIndexList<I...> >::col[sizeof...(I)];
+
+template <unsigned int... I>
+constexpr CPixelRowEntry CPixelTables< CIndexList<I...> >::row[sizeof...(I)];
+
+// col[0..63], row[0..511]
+typedef CPixelTables< CMakeIndexList<512>::type > PixelTables;
+
+
+// === decoding =============================================================
+
+// Decodes n raw words into separate x, y, ph and error arrays.
+template <class TX, class TY, class TPH, class TE>
+inline void DecodeRawPixels(const uint32_t *raw, unsigned int n,
+	TX *x, TY *y, TPH *ph, TE *error)
+{
+	for (unsigned int i = 0; i < n; i++)
+	{
+		uint32_t r = raw[i];
+		const CPixelColEntry &c = PixelTables::col[(r >> 18) & 0x3f];
+		const CPixelRowEntry &w = PixelTables::row[(r >>  9) & 0x1ff];
+		x[i]  = TX(c.x2 + w.odd);
+		y[i]  = TY(w.y);
+		ph[i] = TPH((r & 0x0f) + ((r >> 1) & 0xf0));
+		error[i] = TE(((r & 0x10) << 3) | c.error | w.error);
+	}
+}
+
+
+// Decodes pixel.raw into the other fields of the pixel.
+inline void DecodeRawPixel(CRocPixel &pixel)
+{
+	unsigned int r = pixel.raw;
+	const CPixelColEntry &c = PixelTables::col[(r >> 18) & 0x3f];
+	const CPixelRowEntry &w = PixelTables::row[(r >>  9) & 0x1ff];
+	pixel.x  = c.x2 + w.odd;
+	pixel.y  = w.y;
+	pixel.ph = (r & 0x0f) + ((r >> 1) & 0xf0);
+	pixel.error = ((r & 0x10) << 3) | c.error | w.error;
+}
+
+
+// Decodes pixel[i].raw of n pixels.
+inline void DecodeRawPixels(CRocPixel *pixel, unsigned int n)
+{
+	for (unsigned int i = 0; i < n; i++) DecodeRawPixel(pixel[i]);
+}
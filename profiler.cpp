@@ -68,3 +68,198 @@ void Watchpoint::Report(const char *filename)
 
 #endif
 
+
+
+#ifndef _WIN32
+
+#include <stdio.h>
+#include <time.h>
+#include <algorithm>
+#include <mutex>
+#include "profiler.h"
+
+
+// === registry of watchpoints and threads ==================================
+// Allocated once and never freed: threads may still run while the
+// report is written at exit.
+
+struct CProfilerRegistry
+{
+	std::mutex lock;
+	std::vector<std::string> name;
+	std::list<CProfilerThread*> thread;   // running
+	std::vector<CProfilerStat> total;     // of the finished threads
+	unsigned int finished;
+	uint64_t startTicks;
+	double startTime;
+};
+
+static double ProfilerTime()
+{
+	timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return t.tv_sec + t.tv_nsec*1e-9;
+}
+
+static CProfilerRegistry* NewRegistry()
+{
+	CProfilerRegistry *r = new CProfilerRegistry;
+	r->finished = 0;
+	r->startTicks = ProfilerTicks();
+	r->startTime = ProfilerTime();
+	return r;
+}
+
+static CProfilerRegistry& Registry()
+{
+	static CProfilerRegistry *r = NewRegistry();
+	return *r;
+}
+
+
+static void AddStat(CProfilerStat &s, const CProfilerStat &ts)
+{
+	s.n += ts.n;
+	s.tIncl += ts.tIncl;
+	s.tExcl += ts.tExcl;
+	if (ts.tMin < s.tMin) s.tMin = ts.tMin;
+	if (ts.tMax > s.tMax) s.tMax = ts.tMax;
+}
+
+
+struct CProfilerThreadExit
+{
+	~CProfilerThreadExit() { CProfilerThread::Exit(); }
+};
+
+
+thread_local CProfilerThread* CProfilerThread::current = 0;
+
+CProfilerThread* CProfilerThread::Create()
+{
+	static thread_local CProfilerThreadExit atExit;
+	(void)atExit;
+
+	current = new CProfilerThread;
+	CProfilerRegistry &r = Registry();
+	std::lock_guard<std::mutex> guard(r.lock);
+	r.thread.push_back(current);
+	return current;
+}
+
+
+void CProfilerThread::Exit()
+{
+	if (!current) return;
+	CProfilerRegistry &r = Registry();
+	std::lock_guard<std::mutex> guard(r.lock);
+	if (r.total.size() < current->stat.size()) r.total.resize(current->stat.size());
+	for (unsigned int i = 0; i < current->stat.size(); i++)
+		AddStat(r.total[i], current->stat[i]);
+	r.thread.remove(current);
+	r.finished++;
+	delete current;
+	current = 0;
+}
+
+
+// "void CClass<T>::Func(int) [with T = int]" -> "CClass<T>::Func [T = int]"
+static std::string FunctionName(const char *fname)
+{
+	std::string s(fname);
+	size_t end = s.find('(');
+	if (end == std::string::npos) return s;
+	size_t start = end;
+	int depth = 0;
+	while (start > 0)
+	{
+		char c = s[start-1];
+		if (c == '>') depth++;
+		else if (c == '<') depth--;
+		else if ((c == ' ' || c == '*' || c == '&') && depth == 0) break;
+		start--;
+	}
+	std::string name = s.substr(start, end - start);
+	size_t with = s.find("[with ");
+	if (with != std::string::npos) name += " [" + s.substr(with + 6);
+	return name;
+}
+
+
+Watchpoint::Watchpoint(const char *fname)
+{
+	CProfilerRegistry &r = Registry();
+	std::lock_guard<std::mutex> guard(r.lock);
+	id = r.name.size();
+	r.name.push_back(FunctionName(fname));
+}
+
+
+// === report at exit =======================================================
+
+struct CProfilerEntry
+{
+	std::string name;
+	CProfilerStat s;
+	bool operator<(const CProfilerEntry &e) const { return s.tExcl > e.s.tExcl; }
+};
+
+
+static void ProfilerReport(const char *filename)
+{
+	CProfilerRegistry &r = Registry();
+	std::lock_guard<std::mutex> guard(r.lock);
+	if (r.name.empty()) return;
+
+	// ticks -> seconds
+	double dt = ProfilerTime() - r.startTime;
+	uint64_t dTicks = ProfilerTicks() - r.startTicks;
+	double tick = (dTicks && dt > 0.0) ? dt/dTicks : 1e-9;
+
+	// finished threads and this thread (the others are still running)
+	std::vector<CProfilerEntry> entry(r.name.size());
+	unsigned int i;
+	for (i = 0; i < entry.size(); i++) entry[i].name = r.name[i];
+	for (i = 0; i < r.total.size() && i < entry.size(); i++) AddStat(entry[i].s, r.total[i]);
+	unsigned int threads = r.finished, running = 0;
+	std::list<CProfilerThread*>::iterator t;
+	for (t = r.thread.begin(); t != r.thread.end(); t++)
+	{
+		if (*t != CProfilerThread::Current()) { running++; continue; }
+		threads++;
+		for (i = 0; i < (*t)->stat.size() && i < entry.size(); i++) AddStat(entry[i].s, (*t)->stat[i]);
+	}
+	std::sort(entry.begin(), entry.end());
+
+	FILE *f = fopen(filename, "wt");
+	if (!f) return;
+
+	unsigned int width = 8;
+	for (i = 0; i < entry.size(); i++)
+		if (entry[i].name.size() > width) width = entry[i].name.size();
+	if (width > 60) width = 60;
+
+	fprintf(f, "run time %.3f s, %u threads", dt, threads);
+	if (running) fprintf(f, " (%u still running, not included)", running);
+	fprintf(f, "\n\n");
+	fprintf(f, "%-*s %10s %11s %11s %11s %11s %11s\n", width, "function",
+		"calls", "incl [s]", "excl [s]", "min [us]", "avg [us]", "max [us]");
+	for (i = 0; i < entry.size(); i++)
+	{
+		const CProfilerStat &s = entry[i].s;
+		if (s.n == 0) continue;
+		fprintf(f, "%-*s %10llu %11.6f %11.6f %11.3f %11.3f %11.3f\n", width,
+			entry[i].name.c_str(), (unsigned long long)s.n,
+			s.tIncl*tick, s.tExcl*tick,
+			s.tMin*tick*1e6, double(s.tIncl)/s.n*tick*1e6, s.tMax*tick*1e6);
+	}
+	fclose(f);
+}
+
+
+static struct CProfilerAtExit
+{
+	~CProfilerAtExit() { ProfilerReport("profiler_report.txt"); }
+} profilerAtExit;
+
+#endif
@@ -10,8 +10,12 @@
 // GCC:  __func__     __FUNCTION__  __PRETT_FUNCTION__
 
 #ifdef ENABLE_PROFILING
+#ifdef _WIN32
 #define PROFILING static Watchpoint profiler_watchpoint(__FUNCTION__); AutoCounter profiler_counter(profiler_watchpoint);
 #else
+#define PROFILING static Watchpoint profiler_watchpoint(__PRETTY_FUNCTION__); AutoCounter profiler_counter(profiler_watchpoint);
+#endif
+#else
 #define PROFILING
 #endif
 
@@ -49,4 +53,100 @@ public:
 	~AutoCounter() { Stop(); }
 };
 
+#else // Linux, Darwin
+
+// Each thread accumulates its own statistics (no locking per call) and
+// adds them to the registry when it ends. Threads still running at exit
+// are left out of the report.
+// Exclusive time = inclusive time - time of the profiled functions called.
+// The report (profiler_report.txt, sorted by exclusive time) is written
+// at program exit.
+
+#include <stdint.h>
+#include <vector>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+inline uint64_t ProfilerTicks() { return __rdtsc(); }
+#else
+#include <time.h>
+inline uint64_t ProfilerTicks()
+{
+	timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return uint64_t(t.tv_sec)*1000000000 + t.tv_nsec;
+}
+#endif
+
+
+class AutoCounter;
+
+class Watchpoint
+{
+	unsigned int id;
+public:
+	Watchpoint(const char *fname);
+	friend class AutoCounter;
+};
+
+
+struct CProfilerStat
+{
+	uint64_t n;
+	uint64_t tIncl, tExcl; // ticks
+	uint64_t tMin, tMax;   // ticks per call
+	unsigned int active;   // recursion depth
+	CProfilerStat() : n(0), tIncl(0), tExcl(0), tMin(~uint64_t(0)), tMax(0), active(0) {}
+};
+
+
+class CProfilerThread
+{
+	static thread_local CProfilerThread *current;
+	static CProfilerThread* Create();
+public:
+	std::vector<CProfilerStat> stat;
+	AutoCounter *active; // innermost running counter
+	CProfilerThread() : active(0) {}
+	static CProfilerThread* Get() { return current ? current : Create(); }
+	static CProfilerThread* Current() { return current; } // 0: none
+	static void Exit(); // at thread exit: adds stat to the registry
+	CProfilerStat& Stat(unsigned int id)
+	{
+		if (id >= stat.size()) stat.resize(id + 1);
+		return stat[id];
+	}
+};
+
+
+class AutoCounter
+{
+	CProfilerThread *m_thread;
+	AutoCounter *m_parent;
+	unsigned int m_id;
+	uint64_t m_start;
+	uint64_t m_child;
+public:
+	AutoCounter(Watchpoint &handle)
+		: m_thread(CProfilerThread::Get()), m_id(handle.id), m_child(0)
+	{
+		m_parent = m_thread->active;
+		m_thread->active = this;
+		m_thread->Stat(m_id).active++;
+		m_start = ProfilerTicks();
+	}
+	~AutoCounter()
+	{
+		uint64_t dt = ProfilerTicks() - m_start;
+		CProfilerStat &s = m_thread->stat[m_id];
+		s.n++;
+		if (--s.active == 0) s.tIncl += dt;
+		s.tExcl += dt - m_child;
+		if (dt < s.tMin) s.tMin = dt;
+		if (dt > s.tMax) s.tMax = dt;
+		if (m_parent) m_parent->m_child += dt;
+		m_thread->active = m_parent;
+	}
+};
+
 #endif
@@ -15,6 +15,7 @@
 #include <stdio.h>
 #include <stdarg.h>
 #include <time.h>
+#include <mutex>
 #include "protocol.h"
 #include "psi46test.h"
 
@@ -59,6 +60,8 @@ void CProtocol::close()
 void CProtocol::timestamp(const char s[])
 {
 	if (f == NULL) return;
+	static std::mutex timeLock; // localtime, asctime: static buffer
+	std::lock_guard<std::mutex> lock(timeLock);
 	time_t t;
 	struct tm *dt;
 	time(&t);
@@ -0,0 +1,267 @@
+// psi46bench.cpp
+//
+// Micro benchmarks of the data pipeline on synthetic data (no DTB needed):
+//
+//   psi46bench [-e <events>] [-h <hits>] [-r <rocs>] [-x <error rate>]
+//              [-l <loops>] [-seed <n>] [-s <prefix>]
+//
+//   -e     events per data type (default 100000)
+//   -h     mean hits per ROC and event (default 2)
+//   -r     ROCs per module event (default 8)
+//   -x     fraction of events with an injected error (default 0)
+//   -l     loops per benchmark, the fastest loop is reported (default 5)
+//   -seed  random seed (default 1)
+//   -s     save the generated streams as raw data files
+//          <prefix>_rocdig.bin, <prefix>_rocana.bin, <prefix>_modd.bin
+//
+// The data is the same for the same parameters, so the results of two
+// builds can be compared directly.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <chrono>
+#include "datastream.h"
+#include "eventmap.h"
+#include "synthdata.h"
+
+
+// === vector source (T*) ===================================================
+
+template <class T>
+class CVectorSource : public CSource<T*>
+{
+	vector<T> &v;
+	unsigned int pos;
+	T* Read() { if (pos >= v.size()) throw DS_empty(); return &v[pos++]; }
+	T* ReadLast() { return pos ? &v[pos-1] : 0; }
+public:
+	CVectorSource(vector<T> &data) : v(data), pos(0) {}
+	void Rewind() { pos = 0; }
+};
+
+
+// === benchmark ============================================================
+
+static int loops = 5;
+
+static double Seconds(std::chrono::steady_clock::time_point t0)
+{
+	return std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+}
+
+
+static void Report(const char *name, const char *unit, uint64_t n, double t)
+{
+	printf("  %-28s %10llu %-7s %9.2f M/s %9.1f ns\n", name,
+		(unsigned long long)n, unit, n/t*1e-6, t/n*1e9);
+}
+
+
+// pulls all samples of sink, restarting the source for each loop
+template <class T, class S>
+static void Run(const char *name, const char *unit, S &src, CSink<T> &sink)
+{
+	double tMin = 1e30;
+	uint64_t n = 0;
+	for (int loop = 0; loop < loops; loop++)
+	{
+		src.Rewind();
+		n = 0;
+		std::chrono::steady_clock::time_point t0 = std::chrono::steady_clock::now();
+		try { while (true) { sink.Get(); n++; } }
+		catch (DS_empty &) {}
+		double t = Seconds(t0);
+		if (t < tMin) tMin = t;
+	}
+	Report(name, unit, n, tMin);
+}
+
+
+// scans data into records (copies)
+template <class S>
+static void Scan(vector<uint16_t> &data, vector<CDataRecord> &records)
+{
+	CMemorySource src;
+	src.Data().swap(data);
+	S scanner;
+	CSink<CDataRecord*> sink;
+	src >> scanner >> sink;
+	records.clear();
+	try
+	{
+		while (true)
+		{
+			CDataRecord *r = sink.Get();
+			records.push_back(CDataRecord());
+			records.back().Copy(*r);
+		}
+	}
+	catch (DS_empty &) {}
+	src.Data().swap(data);
+}
+
+
+// decodes records into events
+template <class D>
+static void Decode(D &decoder, vector<CDataRecord> &records, vector<CEvent> &events)
+{
+	CVectorSource<CDataRecord> src(records);
+	CSink<CEvent*> sink;
+	src >> decoder >> sink;
+	events.clear();
+	try { while (true) events.push_back(*sink.Get()); }
+	catch (DS_empty &) {}
+}
+
+
+static void Save(const std::string &prefix, const char *name, vector<uint16_t> &data)
+{
+	std::string filename = prefix + "_" + name + ".bin";
+	CMemorySource src;
+	src.Data().swap(data);
+	CStreamRecorder rec;
+	CSink<uint16_t> sink;
+	src >> rec >> sink;
+	if (rec.Open(filename.c_str()))
+	{
+		try { while (true) sink.GetBlock(RAW_FILE_BLOCK_SIZE); }
+		catch (DS_empty &) {}
+		rec.Close();
+		printf("  %s saved\n", filename.c_str());
+	}
+	else printf("  could not write %s\n", filename.c_str());
+	src.Data().swap(data);
+}
+
+
+static void Usage()
+{
+	printf("usage: psi46bench [-e <events>] [-h <hits>] [-r <rocs>] [-x <error rate>]\n"
+		"                  [-l <loops>] [-seed <n>] [-s <prefix>]\n");
+}
+
+
+int main(int argc, char* argv[])
+{
+	CSynthConfig cfg;
+	std::string prefix;
+	for (int i = 1; i < argc; i++)
+	{
+		if (i+1 >= argc) { Usage(); return 1; }
+		if      (strcmp(argv[i], "-e") == 0) cfg.events = atoi(argv[++i]);
+		else if (strcmp(argv[i], "-h") == 0) cfg.hits = atof(argv[++i]);
+		else if (strcmp(argv[i], "-r") == 0) cfg.rocs = atoi(argv[++i]);
+		else if (strcmp(argv[i], "-x") == 0) cfg.errorRate = atof(argv[++i]);
+		else if (strcmp(argv[i], "-l") == 0) loops = atoi(argv[++i]);
+		else if (strcmp(argv[i], "-seed") == 0) cfg.seed = atoi(argv[++i]);
+		else if (strcmp(argv[i], "-s") == 0) prefix = argv[++i];
+		else { Usage(); return 1; }
+	}
+	if (loops < 1) loops = 1;
+
+	printf("%u events, %.2f hits/ROC, %u ROCs/module, error rate %.4f, seed %u, %i loops\n",
+		cfg.events, cfg.hits, cfg.rocs, cfg.errorRate, cfg.seed, loops);
+
+	// --- generate the streams
+	vector<uint16_t> data[3];
+	for (int t = 0; t < 3; t++)
+	{
+		cfg.type = SynthDataType(t);
+		CSyntheticData gen(cfg);
+		std::chrono::steady_clock::time_point t0 = std::chrono::steady_clock::now();
+		gen.Generate(data[t]);
+		double t1 = Seconds(t0);
+		printf("%-8s %10u words (generated in %.3f s)\n",
+			CSyntheticData::TypeName(cfg.type), (unsigned int)data[t].size(), t1);
+	}
+	if (!prefix.empty())
+	{
+		Save(prefix, "rocdig", data[SYNTH_ROCDIG]);
+		Save(prefix, "rocana", data[SYNTH_ROCANA]);
+		Save(prefix, "modd",   data[SYNTH_MODD]);
+	}
+
+	// --- record scanners
+	printf("scanner:\n");
+	{
+		CMemorySource src;
+		src.Data().swap(data[SYNTH_ROCDIG]);
+		CDataRecordScannerROC scanner;
+		CSink<CDataRecord*> sink;
+		src >> scanner >> sink;
+		Run("ROC (copy)", "records", src, sink);
+		scanner.ZeroCopy(true);
+		Run("ROC (zero copy)", "records", src, sink);
+		src.Data().swap(data[SYNTH_ROCDIG]);
+	}
+	{
+		CMemorySource src;
+		src.Data().swap(data[SYNTH_MODD]);
+		CDataRecordScannerMODD scanner;
+		CSink<CDataRecord*> sink;
+		src >> scanner >> sink;
+		Run("MODD (copy)", "records", src, sink);
+		scanner.ZeroCopy(true);
+		Run("MODD (zero copy)", "records", src, sink);
+		src.Data().swap(data[SYNTH_MODD]);
+	}
+
+	vector<CDataRecord> recRocDig, recRocAna, recModd;
+	Scan<CDataRecordScannerROC> (data[SYNTH_ROCDIG], recRocDig);
+	Scan<CDataRecordScannerROC> (data[SYNTH_ROCANA], recRocAna);
+	Scan<CDataRecordScannerMODD>(data[SYNTH_MODD],   recModd);
+
+	// --- decoders
+	printf("decoder:\n");
+	CRocDigDecoder rocDig;
+	CRocAnaDecoder rocAna;
+	rocAna.Calibrate(cfg.ubLevel, cfg.bLevel);
+	CModDigDecoder modDig;
+	{
+		CVectorSource<CDataRecord> src(recRocDig);
+		CSink<CEvent*> sink;
+		src >> rocDig >> sink;
+		Run("CRocDigDecoder", "events", src, sink);
+	}
+	{
+		CVectorSource<CDataRecord> src(recRocAna);
+		CSink<CEvent*> sink;
+		src >> rocAna >> sink;
+		Run("CRocAnaDecoder", "events", src, sink);
+	}
+	{
+		CVectorSource<CDataRecord> src(recModd);
+		CSink<CEvent*> sink;
+		src >> modDig >> sink;
+		Run("CModDigDecoder", "events", src, sink);
+	}
+	{
+		CModDigFlatDecoder modDigFlat;
+		CVectorSource<CDataRecord> src(recModd);
+		CSink<CFlatEvent*> sink;
+		src >> modDigFlat >> sink;
+		Run("CModDigFlatDecoder", "events", src, sink);
+	}
+
+	// --- analysis
+	printf("analysis:\n");
+	{
+		vector<CEvent> events;
+		Decode(modDig, recModd, events);
+		CVectorSource<CEvent> src(events);
+		CEventMap map(cfg.rocs);
+		CSink<CEvent*> sink;
+		src >> map >> sink;
+		Run("CEventMap", "events", src, sink);
+	}
+	{
+		CVectorSource<CDataRecord> src(recRocAna);
+		CLevelHistogram histo;
+		CSink<CDataRecord*> sink;
+		src >> histo >> sink;
+		Run("CLevelHistogram (CHistogram)", "records", src, sink);
+	}
+	return 0;
+}
@@ -0,0 +1,100 @@
+// psi46emutest.cpp
+//
+// Regression test of the chip test on the software DTB (no DTB needed,
+// see dtbemu.h):
+//
+//   psi46emutest <defect file> <bin> <defect pixels>
+//
+// Runs TestRocDig::test_roc with the default settings on an emulated ROC
+// with the defects of <defect file> ("-" = no defects), once with the
+// serial and once with the parallel pixel alive test, and compares the
+// bin and the number of defect pixels with the expected values. Returns
+// 0 if both runs give the expected result. The log of the last run is
+// written to psi46emutest.log. make emutest runs the standard cases.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "psi46test.h"
+#include "datastream.h"
+#include "dtbemu.h"
+
+
+// --- globals of the chip test ----------------------------------------------
+thread_local int nEntry;
+
+thread_local CTestboard tb;
+thread_local CSettings settings;
+CProber prober;
+thread_local CProtocol Log;
+
+
+static bool Run(const char *defects, bool parallel, int expBin, unsigned int expDefects)
+{
+	printf("%-24s %-8s ", defects, parallel ? "parallel" : "serial");
+
+	CDtbEmulator emu;
+	if (strcmp(defects, "-") != 0 && !emu.LoadDefects(defects))
+	{
+		printf("error reading defect file\n");
+		return false;
+	}
+
+	settings = CSettings();
+	settings.pixelAliveParallel = parallel;
+	nEntry = 1;
+	g_chipdata.Invalidate();
+	g_chipdata.nEntry = nEntry;
+
+	int bin;
+	bool repeat;
+	try
+	{
+		tb.OpenEmulator(emu, false);
+		bin = TestRocDig::test_roc(repeat);
+		tb.Flush();
+	}
+	catch (CRpcError &e)
+	{
+		printf("RPC error: %s\n", e.GetMsg());
+		tb.Close();
+		return false;
+	}
+	catch (DataPipeException &e)
+	{
+		printf("data error: %s\n", e.what());
+		tb.Close();
+		return false;
+	}
+	tb.Close();
+
+	unsigned int defectCount = g_chipdata.pixmap.DefectPixelCount();
+	bool ok = bin == expBin && defectCount == expDefects && emu.GetProtocolErrors() == 0;
+	printf("bin %2i  defects %4u  protocol errors %u  %s\n",
+		bin, defectCount, emu.GetProtocolErrors(), ok ? "ok" : "FAILED");
+	return ok;
+}
+
+
+int main(int argc, char* argv[])
+{
+	if (argc != 4)
+	{
+		printf("usage: psi46emutest <defect file> <bin> <defect pixels>\n");
+		return 2;
+	}
+	int expBin = atoi(argv[2]);
+	unsigned int expDefects = atoi(argv[3]);
+
+	if (!Log.open("psi46emutest.log"))
+	{
+		printf("error creating psi46emutest.log\n");
+		return 2;
+	}
+
+	bool ok = Run(argv[1], false, expBin, expDefects);
+	ok = Run(argv[1], true, expBin, expDefects) && ok;
+
+	Log.close();
+	return ok ? 0 : 1;
+}
@@ -0,0 +1,78 @@
+// psi46replay.cpp
+//
+// Standalone offline replay of raw data files (no DTB needed):
+//
+//   psi46replay <file> <chain> [-w <workers>] [-f] [-r <first> <count>]
+//               [-l <loops>] [-a <ublack> <black>]
+//
+//   chain: rocdig, rocana or modd
+//   -w     decode with <workers> threads
+//   -f     flat event decoder (rocdig, modd)
+//   -r     replay <count> records starting with record <first>
+//          (creates the record index <file>.idx if necessary)
+//   -l     repeat the replay <loops> times
+//   -a     analog levels (rocana)
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "replay.h"
+
+
+static void Usage()
+{
+	printf("usage: psi46replay <file> <chain> [-w <workers>] [-f] [-r <first> <count>]\n"
+		"                   [-l <loops>] [-a <ublack> <black>]\n"
+		"  chain: rocdig, rocana, modd\n");
+}
+
+
+int main(int argc, char* argv[])
+{
+	if (argc < 3) { Usage(); return 1; }
+
+	CReplayOptions options;
+	if (!ReplayChainFromName(argv[2], options.chain)) { Usage(); return 1; }
+
+	int loops = 1;
+	for (int i = 3; i < argc; i++)
+	{
+		if (strcmp(argv[i], "-w") == 0 && i+1 < argc) options.workers = atoi(argv[++i]);
+		else if (strcmp(argv[i], "-f") == 0) options.flat = true;
+		else if (strcmp(argv[i], "-r") == 0 && i+2 < argc)
+		{
+			options.firstRecord = atoi(argv[++i]);
+			options.recordCount = atoi(argv[++i]);
+		}
+		else if (strcmp(argv[i], "-l") == 0 && i+1 < argc) loops = atoi(argv[++i]);
+		else if (strcmp(argv[i], "-a") == 0 && i+2 < argc)
+		{
+			options.ubLevel = atoi(argv[++i]);
+			options.bLevel  = atoi(argv[++i]);
+		}
+		else { Usage(); return 1; }
+	}
+
+	printf("replay %s (%s%s, %u workers)\n", argv[1],
+		ReplayChainName(options.chain), options.flat ? " flat" : "", options.workers);
+	for (int loop = 0; loop < loops; loop++)
+	{
+		CReplayStats stats;
+		try
+		{
+			if (!Replay(argv[1], options, stats))
+			{
+				printf("Could not replay %s\n", argv[1]);
+				return 2;
+			}
+		}
+		catch (DataPipeException &e)
+		{
+			printf("%s\n", e.what());
+			return 3;
+		}
+		if (loops > 1) printf("loop %i\n", loop + 1);
+		stats.Print(stdout);
+	}
+	return 0;
+}
@@ -22,12 +22,12 @@ using namespace std;
 
 
 // --- globals ---------------------------------------
-int nEntry; // counts the chip tests
+thread_local int nEntry; // counts the chip tests
 
-CTestboard tb;
-CSettings settings;  // global settings
+thread_local CTestboard tb;
+thread_local CSettings settings;  // global settings
 CProber prober;
-CProtocol Log;
+thread_local CProtocol Log;
 
 
 
@@ -86,6 +86,7 @@ int main(int argc, char* argv[])
 					   "%s"
 					   "-------------------------------------------------\n", info.c_str());
 				Log.puts(info.c_str());
+				ApplyUsbTuning(tb);
 				tb.Welcome();
 				tb.Flush();
 			}
@@ -127,5 +128,9 @@ int main(int argc, char* argv[])
 		e.What();
 	}
 
+	vector<string> rpcNames;
+	tb.GetRpcCallNames(rpcNames);
+	RpcStat.Write("rpc_statistics.txt", rpcNames);
+
 	return 0;
 }
@@ -28,14 +28,15 @@
 
 
 // global variables
-extern int nEntry; // counts the entries in the log file
+// per thread: multitest runs a chip test per DTB in a thread of its own
+extern thread_local int nEntry; // counts the entries in the log file
 
-extern CTestboard tb;
-extern CSettings settings;  // global settings
+extern thread_local CTestboard tb;
+extern thread_local CSettings settings;  // global settings
 extern CProber prober; // prober
-extern CProtocol Log;  // log file
+extern thread_local CProtocol Log;  // log file
 
-extern CChip g_chipdata;
+extern thread_local CChip g_chipdata;
 
 void cmd();
 
@@ -0,0 +1,134 @@
+// replay.cpp
+
+#include <string.h>
+#include "replay.h"
+
+
+static const char *chainName[3] = { "rocdig", "rocana", "modd" };
+
+const char* ReplayChainName(ReplayChain chain)
+{
+	return (unsigned int)chain < 3 ? chainName[chain] : "?";
+}
+
+
+bool ReplayChainFromName(const char *name, ReplayChain &chain)
+{
+	for (unsigned int i = 0; i < 3; i++)
+		if (strcmp(name, chainName[i]) == 0) { chain = ReplayChain(i); return true; }
+	return false;
+}
+
+
+void CReplayStats::Print(FILE *f) const
+{
+	double t = (tTotal > 0.0) ? tTotal : 1e-9;
+	fprintf(f, "  %llu words, %llu records, %llu events (%llu with error), %llu pixels\n",
+		(unsigned long long)words, (unsigned long long)records,
+		(unsigned long long)events, (unsigned long long)eventErrors, (unsigned long long)pixels);
+	fprintf(f, "  %.3f s: %.2f Mwords/s, %.1f krecords/s, %.1f kevents/s\n",
+		tTotal, words/t*1e-6, records/t*1e-3, events/t*1e-3);
+	fprintf(f, "  source  %8.3f s %5.1f%%\n", tSource,  100.0*tSource/t);
+	fprintf(f, "  scanner %8.3f s %5.1f%%\n", tScanner, 100.0*tScanner/t);
+	fprintf(f, "  decoder %8.3f s %5.1f%%\n", tDecoder, 100.0*tDecoder/t);
+	fprintf(f, "  sink    %8.3f s %5.1f%%\n", tSink,    100.0*tSink/t);
+}
+
+
+// === chain ================================================================
+
+template <class E>
+static void ReplayRun(CBinaryFileSource &src, CDataRecordScanner &scanner,
+	CEventDecoderT<E> &decoder, unsigned int workers, CReplayStats &stats)
+{
+	CStageTimer<uint16_t> tSrc;
+	CStageTimer<CDataRecord*> tScan;
+	CStageTimer<E*> tDec;
+	CParallelDecoderT<E> parallel(decoder, workers ? workers : 1);
+	CSink<E*> sink;
+
+	scanner.ZeroCopy(true);
+	if (workers) src >> tSrc >> scanner >> tScan >> parallel >> tDec >> sink;
+	else         src >> tSrc >> scanner >> tScan >> decoder  >> tDec >> sink;
+
+	std::chrono::steady_clock::time_point t0 = std::chrono::steady_clock::now();
+	try
+	{
+		while (true)
+		{
+			E *x = sink.Get();
+			for (unsigned int r = 0; r < x->RocCount(); r++) stats.pixels += x->PixelCount(r);
+			if (x->error) stats.eventErrors++;
+		}
+	}
+	catch (DS_empty &) {}
+	stats.tTotal = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+
+	stats.words    = tSrc.GetCount();
+	stats.records  = tScan.GetCount();
+	stats.events   = tDec.GetCount();
+	stats.tSource  = tSrc.GetTime();
+	stats.tScanner = tScan.GetTime() - tSrc.GetTime();
+	stats.tDecoder = tDec.GetTime() - tScan.GetTime();
+	stats.tSink    = stats.tTotal - tDec.GetTime();
+}
+
+
+bool Replay(const char *filename, const CReplayOptions &options, CReplayStats &stats)
+{
+	stats = CReplayStats();
+	if (options.flat && options.chain == REPLAY_ROCANA) return false;
+
+	CBinaryFileSource src;
+	if (!src.Open(filename)) return false;
+
+	bool module = options.chain == REPLAY_MODD;
+	if (options.firstRecord || options.recordCount)
+	{
+		if (module) src.OpenIndex(0x00f0, 0x0080);
+		else        src.OpenIndex(0x8000, 0x8000);
+		unsigned int count = options.recordCount ? options.recordCount : src.GetRecordCount();
+		if (!src.SelectRecords(options.firstRecord, count)) return false;
+	}
+
+	CDataRecordScannerROC  scannerRoc;
+	CDataRecordScannerMODD scannerMod;
+	CDataRecordScanner &scanner = module ?
+		static_cast<CDataRecordScanner&>(scannerMod) : static_cast<CDataRecordScanner&>(scannerRoc);
+
+	switch (options.chain)
+	{
+	case REPLAY_ROCDIG:
+		if (options.flat)
+		{
+			CRocDigFlatDecoder decoder;
+			ReplayRun<CFlatEvent>(src, scanner, decoder, options.workers, stats);
+		}
+		else
+		{
+			CRocDigDecoder decoder;
+			ReplayRun<CEvent>(src, scanner, decoder, options.workers, stats);
+		}
+		break;
+	case REPLAY_ROCANA:
+		{
+			CRocAnaDecoder decoder;
+			decoder.Calibrate(options.ubLevel, options.bLevel);
+			ReplayRun<CEvent>(src, scanner, decoder, options.workers, stats);
+		}
+		break;
+	case REPLAY_MODD:
+		if (options.flat)
+		{
+			CModDigFlatDecoder decoder;
+			ReplayRun<CFlatEvent>(src, scanner, decoder, options.workers, stats);
+		}
+		else
+		{
+			CModDigDecoder decoder;
+			ReplayRun<CEvent>(src, scanner, decoder, options.workers, stats);
+		}
+		break;
+	}
+	return true;
+}
@@ -0,0 +1,92 @@
+// replay.h
+//
+// Offline replay of recorded raw data files (CStreamRecorder files or
+// headerless binary dumps) through the decoder chains of the analyze and
+// daqreadm commands. The data is pulled as fast as possible, the
+// throughput and the time spent in each stage are measured.
+// Used by the replay command and by the standalone psi46replay tool.
+
+#pragma once
+
+#include <stdio.h>
+#include <chrono>
+#include "datastream.h"
+
+
+enum ReplayChain { REPLAY_ROCDIG, REPLAY_ROCANA, REPLAY_MODD };
+
+const char* ReplayChainName(ReplayChain chain);
+bool ReplayChainFromName(const char *name, ReplayChain &chain);
+
+
+struct CReplayOptions
+{
+	ReplayChain chain;
+	unsigned int workers; // 0: decoder in the reading thread
+	bool flat;            // flat event decoder (ROC dig, MODD)
+	unsigned int firstRecord;
+	unsigned int recordCount; // 0: all records (record index if != 0)
+	int ubLevel, bLevel;  // analog levels for ROC ana
+	CReplayOptions() : chain(REPLAY_MODD), workers(0), flat(false),
+		firstRecord(0), recordCount(0), ubLevel(-400), bLevel(0) {}
+};
+
+
+struct CReplayStats
+{
+	uint64_t words;
+	uint64_t records;
+	uint64_t events;
+	uint64_t pixels;
+	uint64_t eventErrors;
+	double tTotal;
+	// time spent in the stages (without the upstream stages)
+	double tSource, tScanner, tDecoder, tSink;
+	CReplayStats() : words(0), records(0), events(0), pixels(0), eventErrors(0),
+		tTotal(0.0), tSource(0.0), tScanner(0.0), tDecoder(0.0), tSink(0.0) {}
+	void Print(FILE *f) const;
+};
+
+
+// === CStageTimer (T, T) ===================================================
+// Measures the time spent upstream of the timer (including the stages
+// before) and counts the samples passing through.
+
+template <class T>
+class CStageTimer : public CDataPipe<T>
+{
+	std::chrono::steady_clock::duration t;
+	uint64_t count;
+	T x;
+
+	T Read()
+	{
+		std::chrono::steady_clock::time_point t0 = std::chrono::steady_clock::now();
+		try { x = this->Get(); }
+		catch (...) { t += std::chrono::steady_clock::now() - t0; throw; }
+		t += std::chrono::steady_clock::now() - t0;
+		count++;
+		return x;
+	}
+	T ReadLast() { return x; }
+	CDataBlock<T> ReadBlock(unsigned int maxSize)
+	{
+		std::chrono::steady_clock::time_point t0 = std::chrono::steady_clock::now();
+		CDataBlock<T> block;
+		try { block = this->GetBlock(maxSize); }
+		catch (...) { t += std::chrono::steady_clock::now() - t0; throw; }
+		t += std::chrono::steady_clock::now() - t0;
+		count += block.size;
+		if (block.size) x = block[block.size-1];
+		return block;
+	}
+public:
+	CStageTimer() : t(0), count(0), x() {}
+	double GetTime() const { return std::chrono::duration<double>(t).count(); }
+	uint64_t GetCount() const { return count; }
+};
+
+
+// Replays the file. Returns false if the file cannot be opened
+// or the options are invalid.
+bool Replay(const char *filename, const CReplayOptions &options, CReplayStats &stats);
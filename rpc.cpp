@@ -17,6 +17,7 @@ void rpcMessage::Create(uint16_t cmd)
 
 void rpcMessage::Send(CRpcIo &rpc_io)
 {
+	RpcStat.CallStart(m_cmd, 4 + m_size);
 	rpc_io.Write(&m_type, 1);
 	rpc_io.Write(&m_cmd,  2);
 	rpc_io.Write(&m_size, 1);
@@ -26,12 +27,13 @@ void rpcMessage::Send(CRpcIo &rpc_io)
 
 void rpcMessage::Receive(CRpcIo &rpc_io)
 {
+	if (!rpc_io.deferred.empty()) rpc_Sync(rpc_io);
 	m_pos = 0;
 	rpc_io.Read(&m_type, 1);
 	if (m_type == RPC_TYPE_DTB) {}
 	else if (m_type == RPC_TYPE_DTB_DATA)
 	{ // remove unexpected data message from queue
-		uint16_t size = 0;
+		uint32_t size = 0;
 		rpc_io.Read(&size, 3);
 		rpc_DataSink(rpc_io, size);
 		throw CRpcError(CRpcError::NO_CMD_MSG);
@@ -50,6 +52,7 @@ void rpcMessage::Receive(CRpcIo &rpc_io)
 	rpc_io.Read(&m_cmd, 2);
 	rpc_io.Read(&m_size, 1);
 	if (m_size) rpc_io.Read(m_par, m_size);
+	RpcStat.CallDone(m_cmd, 4 + m_size);
 }
 
 
@@ -57,6 +60,7 @@ void rpcMessage::Receive(CRpcIo &rpc_io)
 
 void CDataHeader::RecvHeader(CRpcIo &rpc_io)
 {
+	if (!rpc_io.deferred.empty()) rpc_Sync(rpc_io);
 	rpc_io.Read(&m_type, 1);
 	if (m_type == RPC_TYPE_DTB_DATA) {}
 	else if (m_type == RPC_TYPE_DTB)
@@ -81,12 +85,14 @@ void CDataHeader::RecvHeader(CRpcIo &rpc_io)
 
 	m_size = 0;
 	rpc_io.Read(&m_size, 3);
+	RpcStat.DataReceived(4 + m_size);
 }
 
 
 
 void rpc_SendRaw(CRpcIo &rpc_io, const void *x, uint32_t size)
 {
+	RpcStat.DataSent(4 + size);
 	uint8_t value = RPC_TYPE_DTB_DATA;
 	rpc_io.Write(&value, 1);
 	rpc_io.Write(&size, 3);
@@ -98,8 +104,14 @@ void rpc_SendRaw(CRpcIo &rpc_io, const void *x, uint32_t size)
 void rpc_DataSink(CRpcIo &rpc_io, uint32_t size)
 {
 	if (size == 0) return;
-	CBuffer buffer(size);
-	rpc_io.Read(&buffer, size);
+	RpcStat.DataReceived(size);
+	uint8_t scratch[RPC_SINK_SCRATCH];
+	while (size)
+	{
+		uint32_t n = (size < RPC_SINK_SCRATCH) ? size : RPC_SINK_SCRATCH;
+		rpc_io.Read(scratch, n);
+		size -= n;
+	}
 }
 
 
@@ -107,13 +119,57 @@ void rpc_Receive(CRpcIo &rpc_io, string &x)
 {
 	CDataHeader msg;
 	msg.RecvHeader(rpc_io);
-	x.clear();
-	x.reserve(msg.m_size);
-	char ch;
-	for (uint32_t i=0; i<msg.m_size; i++)
+	x.resize(msg.m_size);
+	if (msg.m_size) rpc_io.Read(&(x[0]), msg.m_size);
+}
+
+
+// === deferred calls =======================================================
+
+void rpc_Sync(CRpcIo &rpc_io, const CRpcDeferredCall *until)
+{
+	RPC_IO_LOCK(rpc_io)
+	if (until && until->ready) return;
+	if (rpc_io.deferred.empty() || rpc_io.deferredSync) return;
+
+	rpc_io.deferredSync = true;
+	try
+	{
+		rpc_io.Flush();
+		while (!rpc_io.deferred.empty())
+		{
+			std::shared_ptr<CRpcDeferredCall> call = rpc_io.deferred.front();
+			rpc_io.deferred.pop_front();
+			try { call->Receive(rpc_io); }
+			catch (CRpcError &e)
+			{
+				// the stream is out of sync -> fail all pending calls
+				e.SetFunction(call->index);
+				call->Fail(e);
+				rpc_Cancel(rpc_io, e);
+				break;
+			}
+			call->ready = true;
+			if (call.get() == until) break;
+		}
+	}
+	catch (CRpcError &e)
+	{
+		rpc_Cancel(rpc_io, e);
+	}
+	rpc_io.deferredSync = false;
+}
+
+
+void rpc_Cancel(CRpcIo &rpc_io, const CRpcError &error)
+{
+	RPC_IO_LOCK(rpc_io)
+	while (!rpc_io.deferred.empty())
 	{
-		rpc_io.Read(&ch, 1);
-		x.push_back(ch);
+		CRpcError e(error);
+		e.SetFunction(rpc_io.deferred.front()->index);
+		rpc_io.deferred.front()->Fail(e);
+		rpc_io.deferred.pop_front();
 	}
 }
 
@@ -9,6 +9,7 @@
 #include "config.h"
 #include "rpc_io.h"
 #include "rpc_error.h"
+#include "rpc_stat.h"
 
 #ifdef ENABLE_RPC_PROFILING
 #define RPC_PROFILING PROFILING
@@ -16,16 +17,11 @@
 #define RPC_PROFILING
 #endif
 
-#ifdef ENABLE_MULTITHREADING
-#include <boost/thread.hpp>
-#define RPC_THREAD boost::mutex m_sync;
-#define RPC_THREAD_LOCK boost::lock_guard<boost::mutex> lock(m_sync);
-#define RPC_THREAD_UNLOCK
-#else
+// the lock belongs to the connection (rpc_io), so deferred calls resolved
+// by a CRpcFuture are serialized with the calls of all other threads
 #define RPC_THREAD
-#define RPC_THREAD_LOCK
+#define RPC_THREAD_LOCK RPC_IO_LOCK(*rpc_io)
 #define RPC_THREAD_UNLOCK
-#endif
 
 using namespace std;
 
@@ -70,16 +66,6 @@ extern CRpcIoNull RpcIoNull;
 
 
 
-class CBuffer
-{
-	uint8_t *p;
-public:
-	CBuffer(uint16_t size) { p = new uint8_t[size]; }
-	~CBuffer() { delete[] p; }
-	uint8_t* operator&() { return p; }
-};
-
-
 // === message ==============================================================
 
 class rpcMessage
@@ -149,8 +135,11 @@ public:
 
 void rpc_SendRaw(CRpcIo &rpc_io, const void *x, uint32_t size);
 
+// discards size bytes through a fixed scratch area
 void rpc_DataSink(CRpcIo &rpc_io, uint32_t size);
 
+#define RPC_SINK_SCRATCH 4096
+
 
 template <class T>
 inline void rpc_Send(CRpcIo &rpc_io, const vector<T> &x)
@@ -169,7 +158,8 @@ void rpc_Receive(CRpcIo &rpc_io, vector<T> &x)
 		rpc_DataSink(rpc_io, msg.m_size);
 		throw CRpcError(CRpcError::WRONG_DATA_SIZE);
 	}
-	x.assign(msg.m_size/sizeof(T), 0);
+	// resize keeps the capacity and only initializes the added elements
+	x.resize(msg.m_size/sizeof(T));
 	if (x.size() != 0) rpc_io.Read(&(x[0]), msg.m_size);
 }
 
@@ -183,6 +173,124 @@ inline void rpc_Send(CRpcIo &rpc_io, const string &x)
 void rpc_Receive(CRpcIo &rpc_io, string &x);
 
 
+// === deferred calls =======================================================
+// A deferred call sends the request without flush and returns a future.
+// The replies are read in call order when the result of a future is
+// requested, by rpc_Sync, or before a blocking call reads its reply.
+// So many requests can be in flight in one USB transfer.
+
+class CRpcDeferredCall
+{
+public:
+	uint16_t cmd;       // call id
+	unsigned int index; // rpc_cmdName index
+	bool ready;
+	CRpcError error;
+	CRpcDeferredCall(uint16_t callId, unsigned int cmdIndex)
+		: cmd(callId), index(cmdIndex), ready(false) {}
+	virtual ~CRpcDeferredCall() {}
+	virtual void Receive(CRpcIo &rpc_io) = 0;
+	void Fail(const CRpcError &e) { error = e; ready = true; }
+};
+
+// reads the pending replies up to (and including) call "until" or all
+// (nothing if "until" is ready)
+void rpc_Sync(CRpcIo &rpc_io, const CRpcDeferredCall *until = 0);
+
+// fails all pending calls (e.g. after clearing the connection)
+void rpc_Cancel(CRpcIo &rpc_io, const CRpcError &error = CRpcError(CRpcError::READ_ERROR));
+
+
+inline void rpc_Get(rpcMessage &msg, bool &x)     { x = msg.Get_BOOL(); }
+inline void rpc_Get(rpcMessage &msg, int8_t &x)   { x = msg.Get_INT8(); }
+inline void rpc_Get(rpcMessage &msg, uint8_t &x)  { x = msg.Get_UINT8(); }
+inline void rpc_Get(rpcMessage &msg, int16_t &x)  { x = msg.Get_INT16(); }
+inline void rpc_Get(rpcMessage &msg, uint16_t &x) { x = msg.Get_UINT16(); }
+inline void rpc_Get(rpcMessage &msg, int32_t &x)  { x = msg.Get_INT32(); }
+inline void rpc_Get(rpcMessage &msg, uint32_t &x) { x = msg.Get_UINT32(); }
+
+
+// return value
+template <class T>
+class CRpcDeferredValue : public CRpcDeferredCall
+{
+public:
+	T value;
+	CRpcDeferredValue(uint16_t callId, unsigned int cmdIndex)
+		: CRpcDeferredCall(callId, cmdIndex), value(0) {}
+	void Receive(CRpcIo &rpc_io)
+	{
+		rpcMessage msg;
+		msg.Receive(rpc_io);
+		msg.Check(cmd, sizeof(T));
+		rpc_Get(msg, value);
+	}
+};
+
+
+// return value followed by a data message (vectorR parameter)
+template <class T, class D>
+class CRpcDeferredData : public CRpcDeferredValue<T>
+{
+public:
+	vector<D> data;
+	CRpcDeferredData(uint16_t callId, unsigned int cmdIndex)
+		: CRpcDeferredValue<T>(callId, cmdIndex) {}
+	void Receive(CRpcIo &rpc_io)
+	{
+		CRpcDeferredValue<T>::Receive(rpc_io);
+		rpc_Receive(rpc_io, data);
+	}
+};
+
+
+// queues a deferred call (after its request is sent)
+template <class C>
+inline std::shared_ptr<C> rpc_Defer(CRpcIo &rpc_io, C *call)
+{
+	std::shared_ptr<C> p(call);
+	rpc_io.deferred.push_back(p);
+	return p;
+}
+
+
+template <class T>
+class CRpcFuture
+{
+protected:
+	CRpcIo *rpc_io;
+	std::shared_ptr< CRpcDeferredValue<T> > call;
+	void Resolve()
+	{
+		if (!call) throw CRpcError(CRpcError::UNDEF);
+		rpc_Sync(*rpc_io, call.get());
+		if (call->error.error != CRpcError::OK) throw call->error;
+	}
+public:
+	CRpcFuture() : rpc_io(0) {}
+	CRpcFuture(CRpcIo &io, const std::shared_ptr< CRpcDeferredValue<T> > &c)
+		: rpc_io(&io), call(c) {}
+	bool IsValid() const { return bool(call); }
+	bool IsReady() const { if (!call) return false; RPC_IO_LOCK(*rpc_io) return call->ready; }
+	T Get() { Resolve(); return call->value; }
+};
+
+
+template <class T, class D>
+class CRpcDataFuture : public CRpcFuture<T>
+{
+public:
+	CRpcDataFuture() {}
+	CRpcDataFuture(CRpcIo &io, const std::shared_ptr< CRpcDeferredData<T, D> > &c)
+		: CRpcFuture<T>(io, c) {}
+	vector<D>& GetData()
+	{
+		this->Resolve();
+		return static_cast<CRpcDeferredData<T, D>&>(*this->call).data;
+	}
+};
+
+
 // === tools ================================================================
 
 void rpc_TranslateCallName(const string &in, string &out);
@@ -0,0 +1,388 @@
+// rpc_capture.cpp
+
+#include <string.h>
+#include "profiler.h"
+#include "rpc_capture.h"
+
+
+static const char captureMagic[8] = { 'P','S','I','R','P','C','0','1' };
+
+
+void CRpcCaptureTiming::Print(FILE *f) const
+{
+	fprintf(f, "%llu records, %llu bytes sent, %llu bytes received\n",
+		(unsigned long long)records, (unsigned long long)bytesSent,
+		(unsigned long long)bytesReceived);
+	fprintf(f, "host %0.3f s, io %0.3f s\n", hostTime*1e-6, ioTime*1e-6);
+}
+
+
+// === CRpcCapture ==========================================================
+
+void CRpcCapture::Put(const void *data, unsigned int size)
+{
+	const uint8_t *p = (const uint8_t*)data;
+	buffer.insert(buffer.end(), p, p + size);
+	if (buffer.size() >= RPCCAPTURE_BUFFER_SIZE) FlushBuffer();
+}
+
+
+void CRpcCapture::PutVarint(uint64_t x)
+{
+	uint8_t b[10];
+	unsigned int n = 0;
+	while (x >= 0x80) { b[n++] = uint8_t(x) | 0x80; x >>= 7; }
+	b[n++] = uint8_t(x);
+	Put(b, n);
+}
+
+
+void CRpcCapture::PutString(const std::string &s)
+{
+	PutVarint(s.size());
+	Put(s.data(), s.size());
+}
+
+
+void CRpcCapture::FlushBuffer()
+{
+	if (f && buffer.size())
+		if (fwrite(buffer.data(), 1, buffer.size(), f) != buffer.size()) error = true;
+	buffer.clear();
+}
+
+
+bool CRpcCapture::Start(const char *filename, CRpcIo &dtb, const char *rpcTimestamp,
+		const std::vector<CRpcCallIdEntry> &callIds)
+{
+	Stop();
+	f = fopen(filename, "wb");
+	if (!f) return false;
+
+	io = &dtb;
+	error = false;
+	timing = CRpcCaptureTiming();
+	buffer.reserve(RPCCAPTURE_BUFFER_SIZE + 65536);
+
+	uint32_t header[2] = { RPCCAPTURE_VERSION, 0 };
+	Put(captureMagic, sizeof(captureMagic));
+	Put(header, sizeof(header));
+	PutString(rpcTimestamp);
+	PutVarint(callIds.size());
+	for (unsigned int i = 0; i < callIds.size(); i++)
+	{
+		PutVarint(callIds[i].id);
+		PutString(callIds[i].name);
+	}
+
+	recType = 0;
+	tEnd = clock::now();
+	return true;
+}
+
+
+bool CRpcCapture::Stop()
+{
+	if (!f) return true;
+	EndRecord();
+	FlushBuffer();
+	if (fclose(f) != 0) error = true;
+	f = 0;
+	return !error;
+}
+
+
+void CRpcCapture::StartRecord(char type, clock::time_point t0)
+{
+	if (recType == type) return;
+	EndRecord();
+	recType = type;
+	recHost = Us(tEnd, t0);
+	recIo = 0;
+}
+
+
+void CRpcCapture::PutRecord(char type, uint64_t host, uint64_t ioTime)
+{
+	Put(&type, 1);
+	PutVarint(host);
+	PutVarint(ioTime);
+	timing.hostTime += host;
+	timing.ioTime += ioTime;
+	timing.records++;
+}
+
+
+void CRpcCapture::EndRecord()
+{
+	if (!recType) return;
+	PutRecord(recType, recHost, recIo);
+	PutVarint(recData.size());
+	Put(recData.data(), recData.size());
+	if (recType == 'W') timing.bytesSent += recData.size();
+	else timing.bytesReceived += recData.size();
+	recData.clear();
+	recType = 0;
+}
+
+
+void CRpcCapture::Write(const void *buffer, unsigned int size)
+{ PROFILING
+	if (!f) { io->Write(buffer, size); return; }
+
+	clock::time_point t0 = clock::now();
+	StartRecord('W', t0);
+	io->Write(buffer, size);
+	tEnd = clock::now();
+	recIo += Us(t0, tEnd);
+	const uint8_t *p = (const uint8_t*)buffer;
+	recData.insert(recData.end(), p, p + size);
+}
+
+
+void CRpcCapture::Flush()
+{ PROFILING
+	if (!f) { io->Flush(); return; }
+
+	clock::time_point t0 = clock::now();
+	EndRecord();
+	io->Flush();
+	clock::time_point t1 = clock::now();
+	PutRecord('F', Us(tEnd, t0), Us(t0, t1));
+	tEnd = t1;
+}
+
+
+void CRpcCapture::WaitBegin()
+{
+	if (!f) return;
+	tWait = clock::now();
+	EndRecord();
+}
+
+
+void CRpcCapture::WaitEnd()
+{
+	if (!f) return;
+	clock::time_point t1 = clock::now();
+	PutRecord('S', Us(tEnd, tWait), Us(tWait, t1));
+	tEnd = t1;
+}
+
+
+void CRpcCapture::Clear()
+{
+	io->Clear();
+}
+
+
+void CRpcCapture::Read(void *buffer, unsigned int size)
+{ PROFILING
+	if (!f) { io->Read(buffer, size); return; }
+
+	clock::time_point t0 = clock::now();
+	StartRecord('R', t0);
+	try
+	{
+		io->Read(buffer, size);
+	}
+	catch (CRpcError &e)
+	{
+		// the failed call gets a record of its own
+		clock::time_point t1 = clock::now();
+		uint64_t host = recHost;
+		if (recData.size()) { EndRecord(); host = 0; }
+		recType = 0;
+		PutRecord('E', host, Us(t0, t1));
+		PutVarint(e.error);
+		tEnd = t1;
+		throw;
+	}
+	tEnd = clock::now();
+	recIo += Us(t0, tEnd);
+	const uint8_t *p = (const uint8_t*)buffer;
+	recData.insert(recData.end(), p, p + size);
+}
+
+
+// === CRpcReplay ===========================================================
+
+class CCaptureReader
+{
+	const std::vector<uint8_t> &f;
+	size_t pos;
+public:
+	CCaptureReader(const std::vector<uint8_t> &file, size_t start)
+		: f(file), pos(start) {}
+	bool End() { return pos >= f.size(); }
+	uint8_t Byte() { if (End()) throw int(1); return f[pos++]; }
+	uint64_t Varint()
+	{
+		uint64_t x = 0;
+		for (unsigned int shift = 0; shift < 64; shift += 7)
+		{
+			uint8_t b = Byte();
+			x |= uint64_t(b & 0x7f) << shift;
+			if (!(b & 0x80)) return x;
+		}
+		throw int(2);
+	}
+	size_t Skip(uint64_t n)
+	{
+		if (n > f.size() - pos) throw int(1);
+		size_t p = pos; pos += n; return p;
+	}
+	std::string String()
+	{
+		uint64_t n = Varint();
+		size_t p = Skip(n);
+		return std::string((const char*)&f[p], n);
+	}
+};
+
+
+bool CRpcReplay::Load(const char *filename)
+{
+	timestamp.clear();
+	callIds.clear();
+	sent.clear();
+	data.clear();
+	reads.clear();
+	captured = CRpcCaptureTiming();
+
+	// --- read the file
+	FILE *file = fopen(filename, "rb");
+	if (!file) return false;
+	std::vector<uint8_t> content;
+	uint8_t block[65536];
+	size_t n, p;
+	while ((n = fread(block, 1, sizeof(block), file)) > 0)
+		content.insert(content.end(), block, block + n);
+	fclose(file);
+
+	const unsigned int headerSize = sizeof(captureMagic) + 8;
+	if (content.size() < headerSize
+		|| memcmp(content.data(), captureMagic, sizeof(captureMagic)) != 0) return false;
+	uint32_t version;
+	memcpy(&version, &content[sizeof(captureMagic)], 4);
+	if (version != RPCCAPTURE_VERSION) return false;
+
+	// --- decode
+	try
+	{
+		CCaptureReader r(content, headerSize);
+		timestamp = r.String();
+		uint64_t count = r.Varint();
+		callIds.resize(count);
+		for (uint64_t i = 0; i < count; i++)
+		{
+			callIds[i].id = int(r.Varint());
+			callIds[i].name = r.String();
+		}
+
+		while (!r.End())
+		{
+			char type = r.Byte();
+			captured.hostTime += r.Varint();
+			captured.ioTime += r.Varint();
+			captured.records++;
+			CReadBlock b;
+			switch (type)
+			{
+			case 'W':
+				n = r.Varint();
+				p = r.Skip(n);
+				sent.insert(sent.end(), content.begin() + p, content.begin() + p + n);
+				captured.bytesSent += n;
+				break;
+			case 'R':
+				n = r.Varint();
+				b.error = false;
+				b.errorId = 0;
+				b.pos = data.size();
+				b.size = n;
+				p = r.Skip(n);
+				data.insert(data.end(), content.begin() + p, content.begin() + p + n);
+				reads.push_back(b);
+				captured.bytesReceived += n;
+				break;
+			case 'E':
+				b.error = true;
+				b.errorId = uint32_t(r.Varint());
+				b.pos = data.size();
+				b.size = 0;
+				reads.push_back(b);
+				break;
+			case 'F':
+			case 'S':
+				break;
+			default: throw int(3);
+			}
+		}
+	}
+	catch (int) { return false; }
+
+	return true;
+}
+
+
+void CRpcReplay::Open()
+{
+	sentPos = 0;
+	readBlock = 0;
+	readPos = 0;
+	mismatch = false;
+	running = true;
+	tStart = std::chrono::steady_clock::now();
+}
+
+
+void CRpcReplay::Close()
+{
+	if (!running) return;
+	tStop = std::chrono::steady_clock::now();
+	running = false;
+}
+
+
+double CRpcReplay::ReplayTime()
+{
+	std::chrono::steady_clock::time_point t = running ? std::chrono::steady_clock::now() : tStop;
+	return std::chrono::duration<double>(t - tStart).count();
+}
+
+
+void CRpcReplay::Write(const void *buffer, unsigned int size)
+{ PROFILING
+	if (mismatch || size > sent.size() - sentPos
+		|| memcmp(&sent[sentPos], buffer, size) != 0)
+	{
+		mismatch = true;
+		throw CRpcError(CRpcError::WRITE_ERROR);
+	}
+	sentPos += size;
+}
+
+
+void CRpcReplay::Read(void *buffer, unsigned int size)
+{ PROFILING
+	uint8_t *p = (uint8_t*)buffer;
+	while (size)
+	{
+		if (readBlock >= reads.size()) throw CRpcError(CRpcError::READ_TIMEOUT);
+		CReadBlock &b = reads[readBlock];
+		if (b.error)
+		{
+			readBlock++;
+			readPos = 0;
+			throw CRpcError(CRpcError::errorId(b.errorId));
+		}
+		uint64_t n = b.size - readPos;
+		if (n > size) n = size;
+		memcpy(p, &data[b.pos + readPos], n);
+		p += n;
+		size -= n;
+		readPos += n;
+		if (readPos >= b.size) { readBlock++; readPos = 0; }
+	}
+}
@@ -0,0 +1,171 @@
+// rpc_capture.h
+//
+// Capture of the RPC traffic between host and DTB and its replay.
+// CRpcCapture is put between CTestboard and the USB connection and
+// writes all bytes sent and received with their timing to a file.
+// CRpcReplay serves the received bytes of a capture back to the same
+// call sequence without DTB, e.g. to profile the host side of a chip
+// test (decoding, logging, bookkeeping) separately from the USB time.
+//
+// File format (little endian):
+//
+//   file header:  "PSIRPC01", uint32 version, uint32 reserved
+//                 rpc timestamp of the host (string)
+//                 call ids known at capture start:
+//                 count, { call id, call name (string) }
+//   records until end of file:
+//     'W' host time, io time, size, bytes     sent (Write)
+//     'R' host time, io time, size, bytes     received (Read)
+//     'F' host time, io time                  Flush
+//     'E' host time, io time, error id        Read failed (CRpcError)
+//     'S' host time, wait time                mDelay of the host
+//
+//   All numbers are unsigned LEB128 varints, a string is its length
+//   followed by the characters. Host time is the time in us from the end
+//   of the previous record to the start of this one, io time the time
+//   in us spent in the connection calls of the record. Consecutive Write
+//   or Read calls are merged into one record.
+//
+// The replay compares the bytes sent with the capture: the first
+// difference stops the replay with a WRITE_ERROR. Reads beyond the
+// capture end with a READ_TIMEOUT.
+
+#pragma once
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <chrono>
+#include "rpc_io.h"
+
+
+#define RPCCAPTURE_VERSION     1
+#define RPCCAPTURE_BUFFER_SIZE (1 << 20)
+
+
+struct CRpcCallIdEntry
+{
+	int id;
+	std::string name;
+};
+
+
+struct CRpcCaptureTiming
+{
+	uint64_t hostTime;   // us between the io calls
+	uint64_t ioTime;     // us in the io calls
+	uint64_t bytesSent;
+	uint64_t bytesReceived;
+	uint64_t records;
+	CRpcCaptureTiming() : hostTime(0), ioTime(0), bytesSent(0), bytesReceived(0), records(0) {}
+	void Print(FILE *f) const;
+};
+
+
+// === CRpcCapture ==========================================================
+
+class CRpcCapture : public CRpcIo
+{
+	typedef std::chrono::steady_clock clock;
+
+	CRpcIo *io;
+	FILE *f;
+	std::vector<uint8_t> buffer;
+	bool error;
+
+	// open record
+	char recType;        // 0: none
+	uint64_t recHost, recIo;
+	std::vector<uint8_t> recData;
+	clock::time_point tEnd; // end of the last io call
+	clock::time_point tWait;
+
+	CRpcCaptureTiming timing;
+
+	void Put(const void *data, unsigned int size);
+	void PutVarint(uint64_t x);
+	void PutString(const std::string &s);
+	void FlushBuffer();
+	void StartRecord(char type, clock::time_point t0);
+	void EndRecord();
+	void PutRecord(char type, uint64_t host, uint64_t ioTime);
+	static uint64_t Us(clock::time_point t0, clock::time_point t1)
+	{ return std::chrono::duration_cast<std::chrono::microseconds>(t1 - t0).count(); }
+public:
+	CRpcCapture() : io(0), f(0), error(false), recType(0), recHost(0), recIo(0) {}
+	~CRpcCapture() { Stop(); }
+
+	// Starts the capture of the traffic to connection dtb.
+	bool Start(const char *filename, CRpcIo &dtb, const char *rpcTimestamp,
+		const std::vector<CRpcCallIdEntry> &callIds);
+	// Ends the capture and closes the file (the connection stays open).
+	// Returns false on a file write error.
+	bool Stop();
+	bool IsRunning() { return f != 0; }
+	CRpcIo* GetConnection() { return io; }
+	const CRpcCaptureTiming& GetTiming() { return timing; }
+
+	// brackets a wait of the host (CTestboard::mDelay)
+	void WaitBegin();
+	void WaitEnd();
+
+	// --- CRpcIo
+	void Write(const void *buffer, unsigned int size);
+	void Flush();
+	void Clear();
+	void Read(void *buffer, unsigned int size);
+	void Close() { Stop(); }
+};
+
+
+// === CRpcReplay ===========================================================
+
+class CRpcReplay : public CRpcIo
+{
+	struct CReadBlock
+	{
+		bool error;
+		uint32_t errorId;
+		uint64_t pos, size;    // in data
+	};
+
+	std::string timestamp;
+	std::vector<CRpcCallIdEntry> callIds;
+	std::vector<uint8_t> sent;      // bytes sent by the host
+	std::vector<uint8_t> data;      // bytes received by the host
+	std::vector<CReadBlock> reads;
+	CRpcCaptureTiming captured;
+
+	uint64_t sentPos;
+	unsigned int readBlock;
+	uint64_t readPos;
+	bool mismatch;
+	bool running;
+	std::chrono::steady_clock::time_point tStart, tStop;
+public:
+	CRpcReplay() : sentPos(0), readBlock(0), readPos(0), mismatch(false), running(false) {}
+
+	// Loads the whole capture into memory, so the file access does not
+	// contribute to the replay time. Returns false if the file is not a
+	// capture or truncated.
+	bool Load(const char *filename);
+
+	// Restarts the replay from the beginning.
+	void Open();
+
+	const std::string& GetRpcTimestamp() { return timestamp; }
+	const std::vector<CRpcCallIdEntry>& GetCallIds() { return callIds; }
+	const CRpcCaptureTiming& GetCapturedTiming() { return captured; }
+	bool Mismatch() { return mismatch; }
+	bool Complete() { return sentPos == sent.size() && readBlock == reads.size(); }
+	uint64_t BytesSent() { return sentPos; }
+	double ReplayTime(); // s from Open to Close (or now)
+
+	// --- CRpcIo
+	void Write(const void *buffer, unsigned int size);
+	void Flush() {}
+	void Clear() {}
+	void Read(void *buffer, unsigned int size);
+	void Close();
+};
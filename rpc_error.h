@@ -30,7 +30,7 @@ public:
 	} error;
 	int functionId;
 	CRpcError() : error(CRpcError::OK), functionId(-1) {}
-	CRpcError(errorId e) : error(e) {}
+	CRpcError(errorId e) : error(e), functionId(-1) {}
 	void SetFunction(unsigned int cmdId) { functionId = cmdId; }
 	const char *GetMsg();
 	void What();
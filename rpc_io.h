@@ -2,14 +2,37 @@
 
 #pragma once
 
+#include <deque>
+#include <memory>
+#include "config.h"
 #include "rpc_error.h"
 
+#ifdef ENABLE_MULTITHREADING
+#include <mutex>
+// held for a whole RPC call including its deferred replies (recursive:
+// a call may resolve its call id by a nested GetRpcCallId call)
+#define RPC_IO_LOCK(io) std::lock_guard<std::recursive_mutex> lock((io).sync);
+#else
+#define RPC_IO_LOCK(io)
+#endif
+
+
+class CRpcDeferredCall;
+
 
 class CRpcIo
 {
 protected:
 	void Dump(const char *msg, const void *buffer, unsigned int size);
 public:
+	// deferred calls waiting for their reply in call order (see rpc.h)
+	std::deque< std::shared_ptr<CRpcDeferredCall> > deferred;
+	bool deferredSync; // replies of deferred calls are being read
+#ifdef ENABLE_MULTITHREADING
+	std::recursive_mutex sync; // see RPC_IO_LOCK
+#endif
+
+	CRpcIo() : deferredSync(false) {}
 	virtual ~CRpcIo() {}
 	virtual void Write(const void *buffer, unsigned int size) = 0;
 	virtual void Flush() = 0;
@@ -0,0 +1,197 @@
+// rpc_iothread.cpp
+
+#include "profiler.h"
+#include "rpc_iothread.h"
+#include "rpc_stat.h"
+
+
+void CRpcIoThread::Start(CRpcIo &dtb)
+{
+	Stop();
+	io = &dtb;
+	jobsQueued = jobsDone = 0;
+	writeFailed = readFailed = false;
+	pending.clear();
+	worker = std::thread(&CRpcIoThread::Run, this);
+}
+
+
+void CRpcIoThread::Stop()
+{
+	if (!worker.joinable()) return;
+	SubmitPending(true);
+	CJob job;
+	job.type = CJob::STOP;
+	Submit(job);
+	worker.join();
+}
+
+
+// A call reads its reply in several pieces, each a job of the I/O thread.
+// Both sides poll for IOTHREAD_SPIN_US before they sleep, so a reply
+// does not cost a thread wakeup per piece.
+template <class Pred>
+void CRpcIoThread::Spin(std::unique_lock<std::mutex> &lock, Pred done)
+{
+	std::chrono::steady_clock::time_point end =
+		std::chrono::steady_clock::now() + std::chrono::microseconds(IOTHREAD_SPIN_US);
+	while (!done() && std::chrono::steady_clock::now() < end)
+	{
+		lock.unlock();
+		std::this_thread::yield();
+		lock.lock();
+	}
+}
+
+
+// === I/O thread ===========================================================
+
+void CRpcIoThread::Run()
+{
+	std::unique_lock<std::mutex> lock(queueLock);
+	while (true)
+	{
+		if (queue.empty()) Spin(lock, [this] { return !queue.empty(); });
+		queued.wait(lock, [this] { return !queue.empty(); });
+		CJob job(std::move(queue.front()));
+		queue.pop_front();
+		if (job.type == CJob::STOP) break;
+		lock.unlock();
+		RpcStat.SetCurrentCall(job.call);
+
+		bool failed = false;
+		CRpcError error;
+		try
+		{
+			switch (job.type)
+			{
+			case CJob::WRITE:
+				if (job.data.size()) io->Write(job.data.data(), job.data.size());
+				if (job.flush) io->Flush();
+				break;
+			case CJob::READ:
+				io->Read(job.buffer, job.size);
+				break;
+			case CJob::CLEAR:
+				io->Clear();
+				break;
+			default: break;
+			}
+		}
+		catch (CRpcError &e) { failed = true; error = e; }
+
+		lock.lock();
+		if (failed && job.type == CJob::READ) { readFailed = true; readError = error; }
+		else if (failed && !writeFailed) { writeFailed = true; writeError = error; }
+		if (job.type == CJob::WRITE)
+		{
+			job.data.clear();
+			spare.push_back(std::move(job.data));
+		}
+		jobsDone++;
+		finished.notify_all();
+	}
+}
+
+
+// === caller side ==========================================================
+
+void CRpcIoThread::Submit(CJob &job)
+{
+	job.call = RpcStat.GetCurrentCall();
+	std::lock_guard<std::mutex> lock(queueLock);
+	queue.push_back(std::move(job));
+	jobsQueued++;
+	queued.notify_one();
+}
+
+
+void CRpcIoThread::SubmitPending(bool flush)
+{
+	if (pending.empty() && !flush) return;
+	CJob job;
+	job.type = CJob::WRITE;
+	job.flush = flush;
+	job.data.swap(pending);
+	{
+		std::lock_guard<std::mutex> lock(queueLock);
+		if (!spare.empty())
+		{
+			pending.swap(spare.back());
+			spare.pop_back();
+		}
+	}
+	Submit(job);
+}
+
+
+void CRpcIoThread::Wait(uint64_t job)
+{
+	std::unique_lock<std::mutex> lock(queueLock);
+	Spin(lock, [this, job] { return jobsDone >= job; });
+	finished.wait(lock, [this, job] { return jobsDone >= job; });
+}
+
+
+void CRpcIoThread::CheckWriteError()
+{
+	std::lock_guard<std::mutex> lock(queueLock);
+	if (!writeFailed) return;
+	writeFailed = false;
+	throw writeError;
+}
+
+
+void CRpcIoThread::CheckReadError()
+{
+	std::lock_guard<std::mutex> lock(queueLock);
+	if (!readFailed) return;
+	readFailed = false;
+	throw readError;
+}
+
+
+void CRpcIoThread::Write(const void *buffer, unsigned int size)
+{ PROFILING
+	if (!worker.joinable()) throw CRpcError(CRpcError::WRITE_ERROR);
+	CheckWriteError();
+	const uint8_t *p = (const uint8_t*)buffer;
+	pending.insert(pending.end(), p, p + size);
+}
+
+
+void CRpcIoThread::Flush()
+{ PROFILING
+	if (!worker.joinable()) return;
+	CheckWriteError();
+	SubmitPending(true);
+}
+
+
+void CRpcIoThread::Read(void *buffer, unsigned int size)
+{ PROFILING
+	if (!worker.joinable()) throw CRpcError(CRpcError::READ_ERROR);
+	SubmitPending(false);
+	CJob job;
+	job.type = CJob::READ;
+	job.buffer = buffer;
+	job.size = size;
+	Submit(job);
+	Wait(jobsQueued);
+	CheckWriteError();
+	CheckReadError();
+}
+
+
+void CRpcIoThread::Clear()
+{
+	if (!worker.joinable()) return;
+	pending.clear();
+	CJob job;
+	job.type = CJob::CLEAR;
+	Submit(job);
+	Wait(jobsQueued);
+
+	std::lock_guard<std::mutex> lock(queueLock);
+	writeFailed = readFailed = false;
+}
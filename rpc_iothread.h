@@ -0,0 +1,92 @@
+// rpc_iothread.h
+//
+// CRpcIoThread is put between CTestboard and the connection (CUSB or the
+// emulator). A dedicated I/O thread owns the connection: only it writes,
+// flushes, reads and clears. The threads calling CTestboard submit jobs
+// to its queue:
+//
+//   Write   collects the bytes of the calling thread
+//   Flush   queues them and returns without waiting for the transfer
+//   Read    queues the bytes collected so far and a read job with the
+//           buffer of the caller, waits until the read job is done
+//   Clear   queues a clear job and waits until it is done
+//
+// The calls of different threads are serialized by the connection lock
+// (RPC_THREAD_LOCK, see rpc_io.h), so the requests of one call are queued
+// in one piece and the replies are read by the thread that waits for
+// them. An error of a queued write is thrown by the next call, an error
+// of a read by the Read that queued it.
+
+#pragma once
+
+#include <stdint.h>
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include "rpc_io.h"
+
+#define IOTHREAD_SPIN_US 50 // polling before a thread sleeps (see Spin)
+
+
+class CRpcIoThread : public CRpcIo
+{
+	struct CJob
+	{
+		enum { WRITE, READ, CLEAR, STOP } type;
+		bool flush;                 // WRITE: flush after the write
+		unsigned int call;          // RpcStat call id of the submitting thread
+		std::vector<uint8_t> data;  // WRITE
+		void *buffer;               // READ: buffer of the waiting caller
+		unsigned int size;          // READ
+	};
+
+	CRpcIo *io;
+	std::thread worker;
+
+	// --- shared with the I/O thread (queueLock)
+	std::mutex queueLock;
+	std::condition_variable queued;
+	std::condition_variable finished;
+	std::deque<CJob> queue;
+	uint64_t jobsDone;
+	std::vector< std::vector<uint8_t> > spare; // buffers of done writes
+	bool writeFailed;
+	CRpcError writeError;
+	bool readFailed;
+	CRpcError readError;
+
+	// --- caller side (connection lock)
+	uint64_t jobsQueued;
+	std::vector<uint8_t> pending;
+
+	void Run();
+	void Submit(CJob &job);
+	void SubmitPending(bool flush);
+	void Wait(uint64_t job);
+	template <class Pred> void Spin(std::unique_lock<std::mutex> &lock, Pred done);
+	void CheckWriteError();
+	void CheckReadError();
+public:
+	CRpcIoThread() : io(0), jobsDone(0), writeFailed(false), readFailed(false), jobsQueued(0) {}
+	~CRpcIoThread() { Stop(); }
+
+	// starts the I/O thread as owner of connection dtb
+	void Start(CRpcIo &dtb);
+	// waits for the queued requests and ends the I/O thread
+	void Stop();
+	bool IsRunning() { return worker.joinable(); }
+	CRpcIo* GetConnection() { return io; }
+	// waits until the queued jobs are done (the I/O thread is idle until
+	// the caller, holding the connection lock, queues the next one)
+	void WaitIdle() { Wait(jobsQueued); }
+
+	// --- CRpcIo
+	void Write(const void *buffer, unsigned int size);
+	void Flush();
+	void Clear();
+	void Read(void *buffer, unsigned int size);
+	void Close() { Stop(); }
+};
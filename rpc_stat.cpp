@@ -0,0 +1,101 @@
+// rpc_stat.cpp
+
+#include <algorithm>
+#include "rpc_stat.h"
+
+
+CRpcStatistics RpcStat;
+thread_local CRpcCallState CRpcStatistics::call;
+
+
+void CRpcCallStat::AddRoundTrip(double t)
+{
+	if (roundTrips == 0 || t < tMin) tMin = t;
+	if (t > tMax) tMax = t;
+	roundTrips++;
+	tSum += t;
+
+	unsigned int bin = 0;
+	for (double limit = 32e-6; bin < RPC_LATENCY_BINS-1 && t >= limit; limit *= 2) bin++;
+	latency[bin]++;
+}
+
+
+struct CRpcStatEntry
+{
+	unsigned int id;
+	const CRpcCallStat *s;
+	bool operator<(const CRpcStatEntry &e) const
+	{
+		if (s->tSum != e.s->tSum) return s->tSum > e.s->tSum;
+		return s->calls > e.s->calls;
+	}
+};
+
+
+void CRpcStatistics::Print(FILE *f, const std::vector<std::string> &names)
+{
+	std::lock_guard<std::mutex> lock(sync);
+	std::vector<CRpcStatEntry> entry;
+	CRpcCallStat total;
+	unsigned int i, k;
+	for (i = 0; i < stat.size(); i++)
+	{
+		const CRpcCallStat &s = stat[i];
+		if (s.calls == 0 && s.bytesReceived == 0 && s.flushes == 0) continue;
+		CRpcStatEntry e = { i, &s };
+		entry.push_back(e);
+		total.calls         += s.calls;
+		total.roundTrips    += s.roundTrips;
+		total.bytesSent     += s.bytesSent;
+		total.bytesReceived += s.bytesReceived;
+		total.flushes       += s.flushes;
+		total.tSum          += s.tSum;
+	}
+	std::sort(entry.begin(), entry.end());
+
+	fprintf(f, "--- RPC statistics --------------------------------------\n");
+	fprintf(f, "calls: %llu, round trips: %llu, flushes: %llu, sent: %llu bytes, received: %llu bytes, "
+		"round trip time: %.3f s\n",
+		(unsigned long long)total.calls, (unsigned long long)total.roundTrips,
+		(unsigned long long)total.flushes, (unsigned long long)total.bytesSent,
+		(unsigned long long)total.bytesReceived, total.tSum);
+	fprintf(f, " id %-28s %9s %9s %7s %11s %11s %9s %9s %9s %9s\n", "call",
+		"calls", "rtrips", "flushes", "sent", "received", "sum [s]", "min [us]", "avg [us]", "max [us]");
+	for (i = 0; i < entry.size(); i++)
+	{
+		const CRpcCallStat &s = *entry[i].s;
+		std::string name = entry[i].id < names.size() ? names[entry[i].id] : "?";
+		size_t pos = name.find('$');
+		if (pos != std::string::npos) name.erase(pos);
+		double avg = s.roundTrips ? s.tSum/s.roundTrips : 0.0;
+		fprintf(f, "%3u %-28s %9llu %9llu %7llu %11llu %11llu %9.3f %9.1f %9.1f %9.1f\n",
+			entry[i].id, name.c_str(),
+			(unsigned long long)s.calls, (unsigned long long)s.roundTrips,
+			(unsigned long long)s.flushes, (unsigned long long)s.bytesSent,
+			(unsigned long long)s.bytesReceived, s.tSum, s.tMin*1e6, avg*1e6, s.tMax*1e6);
+		if (s.roundTrips == 0) continue;
+		fprintf(f, "    latency [us]:");
+		for (k = 0; k < RPC_LATENCY_BINS; k++)
+		{
+			if (s.latency[k] == 0) continue;
+			if (k == 0) fprintf(f, " <32:%u", s.latency[k]);
+			else fprintf(f, " %u:%u", 16u << k, s.latency[k]);
+		}
+		fprintf(f, "\n");
+	}
+}
+
+
+bool CRpcStatistics::Write(const char *filename, const std::vector<std::string> &names)
+{
+	{
+		std::lock_guard<std::mutex> lock(sync);
+		if (stat.empty()) return true;
+	}
+	FILE *f = fopen(filename, "wt");
+	if (!f) return false;
+	Print(f, names);
+	fclose(f);
+	return true;
+}
@@ -0,0 +1,127 @@
+// rpc_stat.h
+//
+// Statistics of the RPC calls per DTB call id: number of calls, bytes
+// sent and received, USB transfers (flushes) and round trip latency.
+// A call starts with rpcMessage::Send. Data messages and flushes until
+// the next call are accounted to it. The round trip time is measured
+// from Send to the reply (rpcMessage::Receive), i.e. only for calls
+// with a return value or a flush. Of deferred calls only the last one
+// sent before the replies are read gets a round trip time. The current
+// call is tracked per thread, the collection is locked, as several
+// threads may do calls (multitest, I/O thread).
+
+#pragma once
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <chrono>
+#include <mutex>
+#include <atomic>
+
+
+// latency bins: [0] < 32 us, [k] 2^(k+4) .. 2^(k+5) us, [15] >= 0.5 s
+#define RPC_LATENCY_BINS 16
+
+
+struct CRpcCallStat
+{
+	uint64_t calls;
+	uint64_t roundTrips;
+	uint64_t bytesSent;
+	uint64_t bytesReceived;
+	uint64_t flushes;
+	double tSum, tMin, tMax; // round trip time (s)
+	unsigned int latency[RPC_LATENCY_BINS];
+	CRpcCallStat() : calls(0), roundTrips(0), bytesSent(0), bytesReceived(0),
+		flushes(0), tSum(0.0), tMin(0.0), tMax(0.0)
+	{ for (unsigned int i = 0; i < RPC_LATENCY_BINS; i++) latency[i] = 0; }
+	void AddRoundTrip(double t);
+};
+
+
+// tracking of the current call, kept per thread (a board thread of
+// multitest or the I/O thread sending for another thread)
+struct CRpcCallState
+{
+	unsigned int current; // call id of the last call
+	bool inCall;          // waiting for the reply of the current call
+	std::chrono::steady_clock::time_point tSend;
+	CRpcCallState() : current(0), inCall(false) {}
+};
+
+
+class CRpcStatistics
+{
+	std::atomic<bool> enabled;
+	std::mutex sync; // stat
+	std::vector<CRpcCallStat> stat;
+	static thread_local CRpcCallState call;
+
+	CRpcCallStat& Stat(unsigned int id)
+	{
+		if (id >= stat.size()) stat.resize(id + 1);
+		return stat[id];
+	}
+public:
+	CRpcStatistics() : enabled(true) {}
+	void Enable(bool on) { enabled = on; call.inCall = false; }
+	bool IsEnabled() { return enabled; }
+	void Clear() { std::lock_guard<std::mutex> lock(sync); stat.clear(); call.inCall = false; }
+
+	// call id the data and flushes of this thread are accounted to
+	unsigned int GetCurrentCall() { return call.current; }
+	void SetCurrentCall(unsigned int id) { call.current = id; }
+
+	// --- collection (rpc.cpp, usb.cpp)
+	void CallStart(uint16_t cmd, unsigned int bytes)
+	{
+		if (!enabled) return;
+		call.current = cmd;
+		call.inCall = true;
+		{
+			std::lock_guard<std::mutex> lock(sync);
+			CRpcCallStat &s = Stat(cmd);
+			s.calls++;
+			s.bytesSent += bytes;
+		}
+		call.tSend = std::chrono::steady_clock::now();
+	}
+	void DataSent(unsigned int bytes)
+	{
+		if (!enabled) return;
+		std::lock_guard<std::mutex> lock(sync);
+		Stat(call.current).bytesSent += bytes;
+	}
+	void DataReceived(unsigned int bytes)
+	{
+		if (!enabled) return;
+		std::lock_guard<std::mutex> lock(sync);
+		Stat(call.current).bytesReceived += bytes;
+	}
+	void CallDone(uint16_t cmd, unsigned int bytes)
+	{
+		if (!enabled) return;
+		bool roundTrip = call.inCall && cmd == call.current;
+		if (roundTrip) call.inCall = false;
+		double t = std::chrono::duration<double>(std::chrono::steady_clock::now() - call.tSend).count();
+		std::lock_guard<std::mutex> lock(sync);
+		CRpcCallStat &s = Stat(cmd);
+		s.bytesReceived += bytes;
+		if (roundTrip) s.AddRoundTrip(t);
+	}
+	void Flush()
+	{
+		if (!enabled) return;
+		std::lock_guard<std::mutex> lock(sync);
+		Stat(call.current).flushes++;
+	}
+
+	// --- report (names[call id] = call name)
+	void Print(FILE *f, const std::vector<std::string> &names);
+	bool Write(const char *filename, const std::vector<std::string> &names);
+};
+
+
+extern CRpcStatistics RpcStat;
@@ -13,6 +13,7 @@ CSettings::CSettings()
 
 	rocType = 1;
 	sensor = false;
+	pixelAliveParallel = false;
 
 	// cable length:
 	deser160_clkDelay = 4;
@@ -139,6 +140,7 @@ bool CSettings::Read(const char filename[])
 			else if (s == "PROBER_PORT")        proberPort = ReadInt(-1, 99);
 			else if (s == "ROC_TYPE")           rocType = ReadInt(0, 1);
 			else if (s == "SENSOR")             sensor = ReadBool();
+			else if (s == "PIXEL_ALIVE_PARALLEL") pixelAliveParallel = ReadBool();
 			else if (s == "TESTREP")            errorRep = ReadInt(0, 10);
 			else if (s == "CABLE_LENGTH")       cableLength = ReadInt(0, 10000);
 			else if (s == "DESER160_CLK_DELAY") deser160_clkDelay = ReadInt(0, 63);
@@ -146,12 +148,54 @@ bool CSettings::Read(const char filename[])
 			else if (s == "ADC_TIN_DELAY")      adc_tinDelay  = ReadInt(0, 63);
 			else if (s == "ADC_TOUT_DELAY")     adc_toutDelay = ReadInt(0, 63);
 			else if (s == "ADC_CLK_DELAY")      adc_clkDelay = ReadInt(0, 320);
+			else if (s == "USB_TUNING")
+			{
+				int id = ReadInt(0, 65535);
+				CUsbTuning &t = usbTuning[id];
+				t.transferSize   = ReadInt(0, 65536);
+				t.latencyTimer   = ReadInt(0, 255);
+				t.readBufferSize = ReadInt(64, 65536);
+				t.queueStatus    = ReadInt(0, 1) != 0;
+			}
 		}
 	}
 	catch (int e)
 	{
 		if (e != ERROR_FILE_END_OF_FILE) ok = false;
 	}
+	f.Close(); // CSettings is copied by multitest
 
 	return ok;
 }
+
+
+bool CSettings::WriteUsbTuning(const char filename[], int boardId, const CUsbTuning &tuning)
+{
+	// keep all lines except the old entry of this board
+	std::string text;
+	FILE *f = fopen(filename, "rt");
+	if (f)
+	{
+		char line[512];
+		while (fgets(line, sizeof(line), f))
+		{
+			int id;
+			if (sscanf(line, " [USB_TUNING] %i", &id) == 1 && id == boardId) continue;
+			text += line;
+		}
+		fclose(f);
+		if (text.size() && text[text.size()-1] != '\n') text += '\n';
+	}
+
+	char entry[128];
+	sprintf(entry, "[USB_TUNING] %i %u %u %u %i\n", boardId, tuning.transferSize,
+		tuning.latencyTimer, tuning.readBufferSize, tuning.queueStatus ? 1 : 0);
+	text += entry;
+
+	f = fopen(filename, "wt");
+	if (!f) return false;
+	bool ok = fwrite(text.data(), 1, text.size(), f) == text.size();
+	if (fclose(f) != 0) ok = false;
+	if (ok) usbTuning[boardId] = tuning;
+	return ok;
+}
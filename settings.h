@@ -5,8 +5,10 @@
 
 #include <stdio.h>
 #include <string>
+#include <map>
 #include "config.h"
 #include "file.h"
+#include "usbtuning.h"
 
 
 #define NUMSETTING 3
@@ -30,6 +32,9 @@ public:
 	CSettings();
 	bool Read(const char filename[]);
 
+	// replaces the [USB_TUNING] entry of board id in the settings file
+	bool WriteUsbTuning(const char filename[], int boardId, const CUsbTuning &tuning);
+
 // --- data --------------------------------------------------------------
 	int  dtbId;             // force to open special board (-1 = any connected board)
 	std::string scriptPath; // script path
@@ -38,6 +43,7 @@ public:
 
 	int rocType;            // 0 = analog ROC, 1 = digital ROC
 	bool sensor; 		    // sensor mounted
+	bool pixelAliveParallel; // pixel alive test: one pixel per double column per trigger
 
 	// cable length:           5   48  prober 450 cm  bump bonder
 	int deser160_clkDelay;  //  4    0    19    5       16
@@ -49,6 +55,8 @@ public:
 	int cableLength;        // adapter cable length in mm
 
 	int  errorRep;          // # test rep if defect chip
+
+	std::map<int, CUsbTuning> usbTuning; // USB transport tuning per board id
 };
 
 
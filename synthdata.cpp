@@ -0,0 +1,145 @@
+// synthdata.cpp
+
+#include "synthdata.h"
+
+
+uint32_t EncodeRawPixel(unsigned int x, unsigned int y, unsigned int ph)
+{
+	unsigned int c = x/2;
+	unsigned int r = 2*(80 - y) + (x & 1);
+	uint32_t raw = (c/6) << 21 | (c%6) << 18 | (r/36) << 15 | ((r/6)%6) << 12 | (r%6) << 9;
+	return raw | ((ph & 0xf0) << 1) | (ph & 0x0f);
+}
+
+
+const char* CSyntheticData::TypeName(SynthDataType type)
+{
+	switch (type)
+	{
+	case SYNTH_ROCDIG: return "ROC dig";
+	case SYNTH_ROCANA: return "ROC ana";
+	case SYNTH_MODD:   return "MODD";
+	}
+	return "?";
+}
+
+
+unsigned int CSyntheticData::HitCount()
+{
+	// integer part + Bernoulli for the fraction, +/- 1 spread
+	unsigned int n = (unsigned int)cfg.hits;
+	if (rnd() < (cfg.hits - n)*4294967296.0) n++;
+	switch (Random(4))
+	{
+	case 0: if (n) n--; break;
+	case 1: n++; break;
+	}
+	return n;
+}
+
+
+uint32_t CSyntheticData::RandomPixel()
+{
+	unsigned int x = Random(52), y = Random(80), ph = Random(256);
+	return EncodeRawPixel(x, y, ph);
+}
+
+
+void CSyntheticData::RocDigEvent()
+{
+	ev.push_back(0x7f8 | Random(4)); // ROC header
+	unsigned int n = HitCount();
+	for (unsigned int i = 0; i < n; i++)
+	{
+		uint32_t raw = RandomPixel();
+		ev.push_back((raw >> 12) & 0x0fff);
+		ev.push_back(raw & 0x0fff);
+	}
+	ev.front() |= 0x8000;
+	ev.back()  |= 0x4000;
+}
+
+
+void CSyntheticData::RocAnaEvent()
+{
+	ev.push_back(cfg.ubLevel & 0x0fff);
+	ev.push_back(cfg.bLevel & 0x0fff);
+	ev.push_back(AnalogLevel(Random(6)) & 0x0fff); // last DAC
+	unsigned int n = HitCount();
+	for (unsigned int i = 0; i < n; i++)
+	{
+		unsigned int c = Random(26), r = 2 + Random(160);
+		ev.push_back(AnalogLevel(c/6) & 0x0fff);
+		ev.push_back(AnalogLevel(c%6) & 0x0fff);
+		ev.push_back(AnalogLevel(r/36) & 0x0fff);
+		ev.push_back(AnalogLevel((r/6)%6) & 0x0fff);
+		ev.push_back(AnalogLevel(r%6) & 0x0fff);
+		ev.push_back((cfg.bLevel + int(Random(200))) & 0x0fff);
+	}
+	ev.front() |= 0x8000;
+	ev.back()  |= 0x4000;
+}
+
+
+void CSyntheticData::ModDigEvent()
+{
+	unsigned int header = (eventNr & 0xff) << 8;
+	ev.push_back(0x080 | ((header >> 12) & 15));
+	ev.push_back(0x090 | ((header >>  8) & 15));
+	ev.push_back(0x0a0 | ((header >>  4) & 15));
+	ev.push_back(0x0b0 | ( header        & 15));
+	for (unsigned int r = 0; r < cfg.rocs; r++)
+	{
+		ev.push_back(0x070 | Random(4)); // ROC header
+		unsigned int n = HitCount();
+		for (unsigned int i = 0; i < n; i++)
+		{
+			uint32_t raw = RandomPixel();
+			for (int k = 5; k >= 0; k--)
+				ev.push_back(((6 - k) << 4) | ((raw >> (4*k)) & 15));
+		}
+	}
+	ev.push_back(0x0c0);
+	ev.push_back(0x0d0);
+	ev.push_back(0x0e0);
+	ev.push_back(0x0f0);
+}
+
+
+void CSyntheticData::InjectError(unsigned int first, unsigned int last)
+{
+	if (last <= first + 1) return;
+	if (Random(2))
+	{ // corrupt a data word (keep the record markers)
+		unsigned int pos = first + 1 + Random(last - first - 1);
+		uint16_t flags = ev[pos] & 0xc000;
+		ev[pos] = flags | (rnd() & 0x0fff);
+	}
+	else
+	{ // record without end
+		ev.resize(last - 1);
+	}
+}
+
+
+void CSyntheticData::AddEvent(std::vector<uint16_t> &data)
+{
+	ev.clear();
+	switch (cfg.type)
+	{
+	case SYNTH_ROCDIG: RocDigEvent(); break;
+	case SYNTH_ROCANA: RocAnaEvent(); break;
+	case SYNTH_MODD:   ModDigEvent(); break;
+	}
+	if (cfg.errorRate > 0.0 && rnd() < cfg.errorRate*4294967296.0)
+		InjectError(0, ev.size());
+	eventNr++;
+	data.insert(data.end(), ev.begin(), ev.end());
+}
+
+
+void CSyntheticData::Generate(std::vector<uint16_t> &data)
+{
+	data.reserve(data.size() + cfg.events*(cfg.type == SYNTH_MODD ? 9 + cfg.rocs*(1 + 6*cfg.hits) : 3 + 6*cfg.hits));
+	for (unsigned int i = 0; i < cfg.events; i++) AddEvent(data);
+}
@@ -0,0 +1,68 @@
+// synthdata.h
+//
+// Generator of synthetic DTB data streams for benchmarks and offline
+// tests without hardware:
+//
+//   ROC dig (Deser160): record = ROC header, 2 x 12 bit per pixel,
+//                       first word flag 0x8000, last word flag 0x4000
+//   ROC ana (ADC):      record = UB, B, last DAC, 6 levels per pixel
+//   MODD (Deser400):    record = TBM header (4), per ROC: ROC header
+//                       and 6 nibbles per pixel, TBM trailer (4)
+//
+// The hits are placed randomly on valid addresses. With error injection
+// a fraction of the events gets a corrupted word or loses its end.
+// The generator is deterministic for a given seed.
+
+#pragma once
+
+#include <stdint.h>
+#include <vector>
+#include <random>
+
+
+enum SynthDataType { SYNTH_ROCDIG, SYNTH_ROCANA, SYNTH_MODD };
+
+struct CSynthConfig
+{
+	SynthDataType type;
+	unsigned int events;
+	unsigned int rocs;     // ROCs per module event (MODD)
+	double hits;           // mean number of hits per ROC and event
+	double errorRate;      // fraction of events with an injected error
+	int ubLevel, bLevel;   // analog levels (ROC ana)
+	unsigned int seed;
+	CSynthConfig() : type(SYNTH_ROCDIG), events(100000), rocs(8), hits(2.0),
+		errorRate(0.0), ubLevel(-400), bLevel(0), seed(1) {}
+};
+
+
+class CSyntheticData
+{
+	CSynthConfig cfg;
+	std::mt19937 rnd;
+	std::vector<uint16_t> ev;
+	unsigned int eventNr;
+
+	unsigned int Random(unsigned int n) { return rnd() % n; }
+	unsigned int HitCount();
+	uint32_t RandomPixel();
+	int AnalogLevel(unsigned int digit) { return cfg.bLevel + (int(digit) - 1)*((cfg.bLevel - cfg.ubLevel)/4); }
+	void RocDigEvent();
+	void RocAnaEvent();
+	void ModDigEvent();
+	void InjectError(unsigned int first, unsigned int last);
+public:
+	CSyntheticData(const CSynthConfig &config) : cfg(config), rnd(config.seed), eventNr(0) {}
+
+	// appends the next event to data
+	void AddEvent(std::vector<uint16_t> &data);
+
+	// appends all cfg.events events to data
+	void Generate(std::vector<uint16_t> &data);
+
+	static const char* TypeName(SynthDataType type);
+};
+
+
+// raw 24 bit pixel word of the digital ROC
+uint32_t EncodeRawPixel(unsigned int x, unsigned int y, unsigned int ph);
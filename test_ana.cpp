@@ -8,6 +8,7 @@
 #include <iomanip>
 #include <sstream>
 #include "datastream.h"
+#include "pixelalive.h"
 
 
 
@@ -36,7 +37,7 @@ namespace TestRocAna
 //  initialization
 // =======================================================================
 
-int tct_wbc = 0;
+thread_local int tct_wbc = 0;
 
 void WriteSettings()
 {
@@ -392,10 +393,8 @@ void test_current()
 // calibrate analog decoding
 // =======================================================================
 
-int ub_level;
-int b_level;
-
-void test_calibrate_decoding()
+// black levels of the ROC header (ub: ultra black, b: black)
+void test_calibrate_decoding(int &ub_level, int &b_level)
 { PROFILING
 	// load settings
 	Log.section("CALREADOUT", false);
@@ -466,7 +465,7 @@ void test_calibrate_decoding()
 // =======================================================================
 
 
-void test_pixel()
+void test_pixel(int ub_level, int b_level)
 { PROFILING
 	// load settings
 	InitDAC();
@@ -495,54 +494,13 @@ void test_pixel()
 	src.Enable();
 
 	// --- scan all pixel ------------------------------------------------------
-	unsigned char col, row;
-	for (col=0; col<ROC_NUMCOLS; col++)
-	{
-		tb.roc_Col_Enable(col, true);
-		tb.uDelay(10);
-		for (row=0; row<ROC_NUMROWS; row++)
-		{
-			tb.roc_Pix_Cal (col, row, false);
-			tb.uDelay(20);
-			tb.Pg_Single();
-			tb.uDelay(10);
-			tb.roc_Pix_Trim(col, row, 15);
-			tb.uDelay(5);
-			tb.Pg_Single();
-			tb.uDelay(10);
-
-			tb.roc_Pix_Mask(col, row);
-			tb.roc_ClrCal();
-		}
-		tb.roc_Col_Enable(col, false);
-		tb.uDelay(10);
-	}
+	PixelAlive::Scan(settings.pixelAliveParallel);
 	src.Disable();
 
 	// --- analyze data --------------------------------------------------------
-	// for each col, for each row, (masked pixel, unmasked pixel)
 	try
 	{
-		for (col=0; col<ROC_NUMCOLS; col++)
-		{
-			for (row=0; row<ROC_NUMROWS; row++)
-			{
-				// must be empty readout
-
-				CEvent *ev = data.Get();
-				g_chipdata.pixmap.SetMaskedCount(col, row, ev->roc[0].pixel.size());
-
-				// must be single pixel hit
-				ev = data.Get();
-				g_chipdata.pixmap.SetUnmaskedCount(col, row, ev->roc[0].pixel.size());
-				if (ev->roc[0].pixel.size() > 0)
-				{
-					g_chipdata.pixmap.SetDefectColCode(col, row, ev->roc[0].pixel[0].x != col);
-					g_chipdata.pixmap.SetDefectRowCode(col, row, ev->roc[0].pixel[0].y != row);
-					g_chipdata.pixmap.SetPulseHeight(col, row, ev->roc[0].pixel[0].ph);
-				}
-			}
-		}
+		PixelAlive::Analyze(data, g_chipdata.pixmap, settings.pixelAliveParallel);
 	} catch (DataPipeException e) { printf("\nERROR TestPixel: %s\n", e.what()); }
 
 //	hist.Report(Log);
@@ -717,7 +675,7 @@ bool GetPixel(CDtbSource &src, CSink<CEvent*> &data, unsigned int x)
 
 unsigned char FindLevel(CDtbSource &src, CSink<CEvent*> &data)
 { PROFILING
-	static unsigned char x = 20;  // first estimation
+	static thread_local unsigned char x = 20;  // first estimation
 	if (x>80) x = 80; else if (x<1) x=1;
 
 	try
@@ -871,7 +829,7 @@ int GetPixelC(unsigned int x)
 
 int FindLevelC()
 { PROFILING
-	static unsigned char x = 9;  // first estimation
+	static thread_local unsigned char x = 9;  // first estimation
 	if (x>253) x = 200; else if (x<1) x=1;
 
 	int res = GetPixelC(x);
@@ -930,16 +888,25 @@ bool testColPixelC(uint8_t col, uint8_t trimbit, vectorR<uint8_t> &res)
 
 bool testAllPixelC(int vtrim, unsigned int trimbit=4 /* reference */ )
 { PROFILING
-	vector<uint8_t> res;
 	tb.roc_SetDAC(Vtrim, vtrim);
 	tb.uDelay(100);
 
 	unsigned int trimvalue = (trimbit<4) ? (~(0x01<<trimbit)&15) : 15;
 
+	// all columns in flight, replies are read in column order
+	CRpcDataFuture<bool, uint8_t> test[ROC_NUMCOLS];
 	int col, row;
+	for (col=0; col<ROC_NUMCOLS; col++)
+		test[col] = tb.TestColPixelDeferred(col, trimvalue, false);
+
 	for (col=0; col<ROC_NUMCOLS; col++)
 	{
-		if (!tb.TestColPixel(col,trimvalue,false,res)) return false;
+		if (!test[col].Get())
+		{
+			tb.Sync(); // read the replies of the remaining columns
+			return false;
+		}
+		vector<uint8_t> &res = test[col].GetData();
 
 		for(row=0; row<ROC_NUMROWS; row++)
 		{
@@ -1050,8 +1017,9 @@ int test_roc(bool &repeat)
 
 	test_current();
 
-	test_calibrate_decoding();
-	test_pixel();
+	int ub_level, b_level;
+	test_calibrate_decoding(ub_level, b_level);
+	test_pixel(ub_level, b_level);
 	unsigned int pixcnt = g_chipdata.pixmap.DefectPixelCount();
 
 /*	if (pixcnt<=400)
@@ -1196,8 +1164,9 @@ int test_roc_bumpbonder()
 
 	test_current();
 
-	test_calibrate_decoding();
-	test_pixel();
+	int ub_level, b_level;
+	test_calibrate_decoding(ub_level, b_level);
+	test_pixel(ub_level, b_level);
 	unsigned int pixcnt = g_chipdata.pixmap.DefectPixelCount();
 
 	Log.section("PIXMAP");
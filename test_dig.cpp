@@ -8,6 +8,7 @@
 #include <iomanip>
 #include <sstream>
 #include "datastream.h"
+#include "pixelalive.h"
 
 
 
@@ -28,7 +29,7 @@
 //  global variables for test results
 // =======================================================================
 
-CChip g_chipdata;
+thread_local CChip g_chipdata;
 
 
 namespace TestRocDig
@@ -38,7 +39,7 @@ namespace TestRocDig
 //  initialization
 // =======================================================================
 
-int tct_wbc = 0;
+thread_local int tct_wbc = 0;
 
 void WriteSettings()
 {
@@ -451,9 +452,12 @@ void test_readback()
 
 	Log.section("READBACK");
 
-	double vd = tb.GetVD();
-	double va = tb.GetVA();
-	double ia = tb.GetIA()*1000.0;
+	CRpcFuture<uint16_t> vd_raw = tb._GetVDDeferred();
+	CRpcFuture<uint16_t> va_raw = tb._GetVADeferred();
+	CRpcFuture<uint16_t> ia_raw = tb._GetIADeferred();
+	double vd = tb.VoltageFromRaw(vd_raw.Get());
+	double va = tb.VoltageFromRaw(va_raw.Get());
+	double ia = tb.CurrentFromRaw(ia_raw.Get())*1000.0;
 
 	if(vdig_u == 0) return;
 	double cal = vd/vdig_u;
@@ -572,55 +576,14 @@ void test_pixel()
 	src.Enable();
 
 	// --- scan all pixel ------------------------------------------------------
-	unsigned char col, row;
-	for (col=0; col<ROC_NUMCOLS; col++)
-	{
-		tb.roc_Col_Enable(col, true);
-		tb.uDelay(10);
-		for (row=0; row<ROC_NUMROWS; row++)
-		{
-			tb.roc_Pix_Cal (col, row, false);
-			tb.uDelay(20);
-			tb.Pg_Single();
-			tb.uDelay(10);
-			tb.roc_Pix_Trim(col, row, 15);
-			tb.uDelay(5);
-			tb.Pg_Single();
-			tb.uDelay(10);
-
-			tb.roc_Pix_Mask(col, row);
-			tb.roc_ClrCal();
-		}
-		tb.roc_Col_Enable(col, false);
-		tb.uDelay(10);
-	}
+	PixelAlive::Scan(settings.pixelAliveParallel);
 	src.Disable();
 
 
 	// --- analyze data --------------------------------------------------------
-	// for each col, for each row, (masked pixel, unmasked pixel)
 	try
 	{
-		for (col=0; col<ROC_NUMCOLS; col++)
-		{
-			for (row=0; row<ROC_NUMROWS; row++)
-			{
-				// must be empty readout
-
-				CEvent *ev = data.Get();
-				g_chipdata.pixmap.SetMaskedCount(col, row, ev->roc[0].pixel.size());
-
-				// must be single pixel hit
-				ev = data.Get();
-				g_chipdata.pixmap.SetUnmaskedCount(col, row, ev->roc[0].pixel.size());
-				if (ev->roc[0].pixel.size() > 0)
-				{
-					g_chipdata.pixmap.SetDefectColCode(col, row, ev->roc[0].pixel[0].x != col);
-					g_chipdata.pixmap.SetDefectRowCode(col, row, ev->roc[0].pixel[0].y != row);
-					g_chipdata.pixmap.SetPulseHeight(col, row, ev->roc[0].pixel[0].ph);
-				}
-			}
-		}
+		PixelAlive::Analyze(data, g_chipdata.pixmap, settings.pixelAliveParallel);
 	} catch (DataPipeException e) { printf("\nERROR TestPixel: %s\n", e.what()); }
 
 	src.Close();
@@ -877,7 +840,7 @@ bool GetPixel(CDtbSource &src, CSink<CEvent*> &data, unsigned int x)
 
 unsigned char FindLevel(CDtbSource &src, CSink<CEvent*> &data)
 { PROFILING
-	static unsigned char x = 20;  // first estimation
+	static thread_local unsigned char x = 20;  // first estimation
 	if (x>80) x = 80; else if (x<1) x=1;
 
 	try
@@ -1031,7 +994,7 @@ int GetPixelC(unsigned int x)
 
 int FindLevelC()
 { PROFILING
-	static unsigned char x = 9;  // first estimation
+	static thread_local unsigned char x = 9;  // first estimation
 	if (x>253) x = 200; else if (x<1) x=1;
 
 	int res = GetPixelC(x);
@@ -1090,16 +1053,25 @@ bool testColPixelC(uint8_t col, uint8_t trimbit, vectorR<uint8_t> &res)
 
 bool testAllPixelC(int vtrim, unsigned int trimbit=4 /* reference */ )
 { PROFILING
-	vector<uint8_t> res;
 	tb.roc_SetDAC(Vtrim, vtrim);
 	tb.uDelay(100);
 
 	unsigned int trimvalue = (trimbit<4) ? (~(0x01<<trimbit)&15) : 15;
 
+	// all columns in flight, replies are read in column order
+	CRpcDataFuture<bool, uint8_t> test[ROC_NUMCOLS];
 	int col, row;
+	for (col=0; col<ROC_NUMCOLS; col++)
+		test[col] = tb.TestColPixelDeferred(col, trimvalue, false);
+
 	for (col=0; col<ROC_NUMCOLS; col++)
 	{
-		if (!tb.TestColPixel(col,trimvalue, false, res)) return false;
+		if (!test[col].Get())
+		{
+			tb.Sync(); // read the replies of the remaining columns
+			return false;
+		}
+		vector<uint8_t> &res = test[col].GetData();
 
 		for(row=0; row<ROC_NUMROWS; row++)
 		{
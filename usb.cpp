@@ -2,11 +2,12 @@
 
 #ifndef _WIN32
 #include <libusb-1.0/libusb.h>
-#include <cstring>
 #endif
+#include <cstring>
 
 #include "profiler.h"
 #include "rpc_error.h"
+#include "rpc_stat.h"
 #include "usb.h"
 
 
@@ -167,12 +168,38 @@ bool CUSB::Open(char serialNumber[])
 	ftStatus = FT_SetBitMode(ftHandle, 0xFF, 0x40);
 	if (ftStatus != FT_OK) return false;
 
-//	FT_SetUSBParameters(ftHandle, 8192, 8192);
 //	FT_SetBaudRate(ftHandle, 9600);
 	
 	FT_SetTimeouts(ftHandle,4000,1000);
 	isUSB_open = true;
-	return true;
+	return ApplyTuning();
+}
+
+
+bool CUSB::ApplyTuning()
+{
+	// always set, so a previous tuning is undone by the defaults
+	unsigned int transferSize = m_tuning.transferSize ?
+		m_tuning.transferSize : USBTUNING_DEFAULT_TRANSFER_SIZE;
+	unsigned int latencyTimer = m_tuning.latencyTimer ?
+		m_tuning.latencyTimer : USBTUNING_DEFAULT_LATENCY_TIMER;
+
+	ftStatus = FT_SetUSBParameters(ftHandle, transferSize, transferSize);
+	if (ftStatus != FT_OK) return false;
+	ftStatus = FT_SetLatencyTimer(ftHandle, UCHAR(latencyTimer));
+	return ftStatus == FT_OK;
+}
+
+
+bool CUSB::SetTuning(const CUsbTuning &tuning)
+{
+	m_tuning = tuning;
+	if (m_tuning.readBufferSize < 64) m_tuning.readBufferSize = 64;
+	if (m_tuning.readBufferSize > USBREADBUFFERMAX) m_tuning.readBufferSize = USBREADBUFFERMAX;
+	if (!isUSB_open) return true;
+
+	Flush();
+	return ApplyTuning();
 }
 
 
@@ -188,11 +215,29 @@ void CUSB::Write(const void *buffer, unsigned int bytesToWrite)
 { PROFILING
 	if (!isUSB_open) throw CRpcError(CRpcError::WRITE_ERROR);
 
-	DWORD k=0;
-	for (k=0; k < bytesToWrite; k++)
+	const unsigned char *p = (const unsigned char*)buffer;
+
+	// large blocks are written directly (after the pending data)
+	if (bytesToWrite >= USBWRITEBUFFERSIZE)
+	{
+		Flush();
+		DWORD bytesWritten;
+		RpcStat.Flush();
+		ftStatus = FT_Write(ftHandle, (LPVOID)p, bytesToWrite, &bytesWritten);
+		if (ftStatus != FT_OK) throw CRpcError(CRpcError::WRITE_ERROR);
+		if (bytesWritten != bytesToWrite) { ftStatus = FT_IO_ERROR; throw CRpcError(CRpcError::WRITE_ERROR); }
+		return;
+	}
+
+	while (bytesToWrite)
 	{
 		if (m_posW >= USBWRITEBUFFERSIZE) Flush();
-		m_bufferW[m_posW++] = ((unsigned char*)buffer)[k];
+		DWORD n = USBWRITEBUFFERSIZE - m_posW;
+		if (n > bytesToWrite) n = bytesToWrite;
+		memcpy(m_bufferW + m_posW, p, n);
+		m_posW += n;
+		p += n;
+		bytesToWrite -= n;
 	}
 }
 
@@ -207,6 +252,7 @@ void CUSB::Flush()
 
 	if (!bytesToWrite) return;
 
+	RpcStat.Flush();
 	ftStatus = FT_Write(ftHandle, m_bufferW, bytesToWrite, &bytesWritten);
 
 	if (ftStatus != FT_OK) throw CRpcError(CRpcError::WRITE_ERROR);
@@ -218,15 +264,18 @@ bool CUSB::FillBuffer(DWORD minBytesToRead)
 { PROFILING
 	if (!isUSB_open) return false;
 
-	DWORD bytesAvailable, bytesToRead;
+	DWORD bytesAvailable = 0, bytesToRead;
 
-	ftStatus = FT_GetQueueStatus(ftHandle, &bytesAvailable);
-	if (ftStatus != FT_OK) return false;
+	if (m_tuning.queueStatus)
+	{
+		ftStatus = FT_GetQueueStatus(ftHandle, &bytesAvailable);
+		if (ftStatus != FT_OK) return false;
+	}
 
 	if (m_posR<m_sizeR) return false;
 
 	bytesToRead = (bytesAvailable>minBytesToRead)? bytesAvailable : minBytesToRead;
-	if (bytesToRead>USBREADBUFFERSIZE) bytesToRead = USBREADBUFFERSIZE;
+	if (bytesToRead>m_tuning.readBufferSize) bytesToRead = m_tuning.readBufferSize;
 
 	ftStatus = FT_Read(ftHandle, m_bufferR, bytesToRead, &m_sizeR);
 	m_posR = 0;
@@ -243,27 +292,31 @@ void CUSB::Read(void *buffer,  unsigned int bytesToRead)
 { PROFILING
 	if (!isUSB_open) throw CRpcError(CRpcError::READ_ERROR);
 
-	DWORD i;
+	unsigned char *p = (unsigned char*)buffer;
 
-	for (i=0; i<bytesToRead; i++)
+	while (bytesToRead)
 	{
 		if (m_posR<m_sizeR)
-			((unsigned char*)buffer)[i] = m_bufferR[m_posR++];
-
+		{
+			DWORD n = m_sizeR - m_posR;
+			if (n > bytesToRead) n = bytesToRead;
+			memcpy(p, m_bufferR + m_posR, n);
+			m_posR += n;
+			p += n;
+			bytesToRead -= n;
+		}
+		else if (bytesToRead >= m_tuning.readBufferSize)
+		{   // large payload (e.g. Daq_Read): read directly into the destination
+			DWORD bytesRead;
+			ftStatus = FT_Read(ftHandle, p, bytesToRead, &bytesRead);
+			if (ftStatus != FT_OK) throw CRpcError(CRpcError::READ_ERROR);
+			if (bytesRead < bytesToRead) throw CRpcError(CRpcError::READ_TIMEOUT);
+			return;
+		}
 		else
 		{
-			DWORD n = bytesToRead-i;
-			if (n>USBREADBUFFERSIZE) n = USBREADBUFFERSIZE;
-
-			if (!FillBuffer(n)) throw CRpcError(CRpcError::READ_ERROR);
-			if (m_sizeR < n) throw CRpcError(CRpcError::READ_ERROR);
-
-			if (m_posR<m_sizeR)
-				((unsigned char*)buffer)[i] = m_bufferR[m_posR++];
-			else
-			{   // timeout (bytesRead < bytesToRead)
-				throw CRpcError(CRpcError::READ_TIMEOUT);
-			}
+			if (!FillBuffer(bytesToRead)) throw CRpcError(CRpcError::READ_ERROR);
+			if (m_sizeR < bytesToRead) throw CRpcError(CRpcError::READ_ERROR);
 		}
 	}
 }
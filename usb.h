@@ -17,9 +17,11 @@
 #endif
 
 #include "rpc_io.h"
+#include "usbtuning.h"
 
 #define USBWRITEBUFFERSIZE  1024
-#define USBREADBUFFERSIZE   4096
+#define USBREADBUFFERSIZE   4096   // default read buffer size
+#define USBREADBUFFERMAX   65536   // max. tuned read buffer size
 
 /*
 class CUsbLog
@@ -47,9 +49,12 @@ class CUSB : public CRpcIo
 	unsigned char m_bufferW[USBWRITEBUFFERSIZE];
 
 	DWORD m_posR, m_sizeR;
-	unsigned char m_bufferR[USBREADBUFFERSIZE];
+	unsigned char m_bufferR[USBREADBUFFERMAX];
+
+	CUsbTuning m_tuning;
 
 	bool FillBuffer(DWORD minBytesToRead);
+	bool ApplyTuning();
 
 public:
 	CUSB()
@@ -69,6 +74,10 @@ public:
 	void Close();
 	bool Connected() { return isUSB_open; };
 
+	// transport parameters (applied immediately if open)
+	bool SetTuning(const CUsbTuning &tuning);
+	const CUsbTuning& GetTuning() { return m_tuning; }
+
 
 	void Write(const void *buffer, unsigned int size);
 	void Flush();
@@ -0,0 +1,199 @@
+// usbtuning.cpp
+
+#include <chrono>
+#include "psi46test.h"
+#include "usbtuning.h"
+
+
+#define USBTUNE_CALLS       100     // GetBoardId calls (latency)
+#define USBTUNE_VECTORS      10     // VectorTest calls
+#define USBTUNE_VECTOR_SIZE 16384   // words per VectorTest call
+#define USBTUNE_DAQ_WORDS   1000000 // words read by Daq_Read
+#define USBTUNE_DAQ_BLOCK   1000000
+#define USBTUNE_PG_BLOCK    100     // data generator block length
+#define USBTUNE_PG_PERIOD   520
+
+
+CUsbTuning::CUsbTuning()
+{
+	transferSize = 0;
+	latencyTimer = 0;
+	readBufferSize = USBREADBUFFERSIZE;
+	queueStatus = true;
+}
+
+
+void CUsbTuning::Print(FILE *f) const
+{
+	if (transferSize) fprintf(f, "transfer size %u", transferSize);
+	else fprintf(f, "transfer size default");
+	if (latencyTimer) fprintf(f, ", latency timer %u ms", latencyTimer);
+	else fprintf(f, ", latency timer default");
+	fprintf(f, ", read buffer %u, queue status %s\n",
+		readBufferSize, queueStatus ? "on" : "off");
+}
+
+
+void ApplyUsbTuning(CTestboard &tb, bool verbose)
+{
+	int id = tb.GetBoardId();
+	std::map<int, CUsbTuning>::iterator t = settings.usbTuning.find(id);
+	if (t == settings.usbTuning.end())
+	{
+		tb.SetUsbTuning(CUsbTuning());
+		return;
+	}
+
+	if (!tb.SetUsbTuning(t->second))
+	{
+		printf("USB tuning error: %s\n", tb.ConnectionError());
+		return;
+	}
+	if (verbose)
+	{
+		printf("USB tuning of board %i: ", id);
+		t->second.Print(stdout);
+	}
+}
+
+
+// === benchmark ============================================================
+
+struct CUsbBenchResult
+{
+	double tCall;   // s per call
+	double tVector; // s for all VectorTest calls
+	double tDaq;    // s for USBTUNE_DAQ_WORDS words
+	double Total() const { return USBTUNE_CALLS*tCall + tVector + tDaq; }
+};
+
+
+static double Seconds(std::chrono::steady_clock::time_point t0)
+{
+	return std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+}
+
+
+static double BenchCalls(CTestboard &tb)
+{
+	std::chrono::steady_clock::time_point t0 = std::chrono::steady_clock::now();
+	for (int i = 0; i < USBTUNE_CALLS; i++) tb.GetBoardId();
+	return Seconds(t0)/USBTUNE_CALLS;
+}
+
+
+static double BenchVector(CTestboard &tb, vector<uint16_t> &in)
+{
+	vector<uint16_t> out;
+	std::chrono::steady_clock::time_point t0 = std::chrono::steady_clock::now();
+	for (int i = 0; i < USBTUNE_VECTORS; i++) tb.VectorTest(in, out);
+	return Seconds(t0);
+}
+
+
+static double BenchDaq(CTestboard &tb)
+{
+	// fill the DAQ buffer with the data generator, then read it
+	tb.Daq_Start(0);
+	tb.Pg_Loop(USBTUNE_PG_PERIOD);
+	for (int i = 0; i < 500 && tb.Daq_GetSize(0) < USBTUNE_DAQ_WORDS; i++) tb.mDelay(10);
+	tb.Pg_Stop();
+	tb.Daq_Stop(0);
+
+	vector<uint16_t> data;
+	uint32_t n, count = 0;
+	std::chrono::steady_clock::time_point t0 = std::chrono::steady_clock::now();
+	do
+	{
+		tb.Daq_Read(data, USBTUNE_DAQ_BLOCK, n, 0);
+		count += data.size();
+	} while (n != 0 && data.size() != 0);
+	double t = Seconds(t0);
+
+	if (count == 0) throw int(1);
+	return t*USBTUNE_DAQ_WORDS/count;
+}
+
+
+static bool Bench(CTestboard &tb, const CUsbTuning &t, vector<uint16_t> &in, CUsbBenchResult &r)
+{
+	printf(" %6u %5u %6u  %-5s ", t.transferSize, t.latencyTimer,
+		t.readBufferSize, t.queueStatus ? "on" : "off");
+	fflush(stdout);
+	try
+	{
+		if (!tb.SetUsbTuning(t)) throw int(2);
+		r.tCall   = BenchCalls(tb);
+		r.tVector = BenchVector(tb, in);
+		r.tDaq    = BenchDaq(tb);
+	}
+	catch (CRpcError &e)
+	{
+		printf(" %s\n", e.GetMsg());
+		tb.Clear();
+		return false;
+	}
+	catch (int)
+	{
+		printf(" failed\n");
+		return false;
+	}
+
+	const double MB = 2e-6*USBTUNE_VECTORS*USBTUNE_VECTOR_SIZE;
+	printf("%8.1f %8.2f %8.2f %8.3f\n", 1e6*r.tCall,
+		2*MB/r.tVector, 2e-6*USBTUNE_DAQ_WORDS/r.tDaq, r.Total());
+	return true;
+}
+
+
+bool UsbTune(CTestboard &tb, CUsbTuning &best)
+{
+	static const unsigned int transferSize[] = { USBTUNING_DEFAULT_TRANSFER_SIZE, 16384, 65536 };
+	static const unsigned int latencyTimer[] = { 1, 2, USBTUNING_DEFAULT_LATENCY_TIMER };
+	static const unsigned int readBuffer[]   = { 4096, 16384, 65536 };
+
+	CUsbTuning start = tb.GetUsbTuning();
+
+	vector<uint16_t> in(USBTUNE_VECTOR_SIZE);
+	for (unsigned int i = 0; i < in.size(); i++) in[i] = i;
+
+	// data generator sequence (0, 1, 2, ... 99)
+	tb.Pg_SetCmd(0, PG_SYNC + PG_RESR + 1);
+	for (int k = 1; k < USBTUNE_PG_BLOCK; k++) tb.Pg_SetCmd(k, PG_TOK + 1);
+	tb.Pg_SetCmd(USBTUNE_PG_BLOCK, PG_TOK);
+	tb.Daq_Open(2*USBTUNE_DAQ_WORDS, 0);
+	tb.Daq_Select_Datagenerator(0);
+
+	printf(" %6s %5s %6s  %-5s %8s %8s %8s %8s\n", "xfer", "lat", "rdbuf", "queue",
+		"call[us]", "vec MB/s", "daq MB/s", "score[s]");
+
+	bool found = false;
+	double bestTime = 0.0;
+	CUsbBenchResult r;
+	CUsbTuning t;
+	for (unsigned int i = 0; i < sizeof(transferSize)/sizeof(unsigned int); i++)
+	for (unsigned int k = 0; k < sizeof(latencyTimer)/sizeof(unsigned int); k++)
+	for (unsigned int m = 0; m < sizeof(readBuffer)/sizeof(unsigned int); m++)
+	{
+		t.transferSize = transferSize[i];
+		t.latencyTimer = latencyTimer[k];
+		t.readBufferSize = readBuffer[m];
+		t.queueStatus = true;
+		if (!Bench(tb, t, in, r)) continue;
+		if (!found || r.Total() < bestTime) { best = t; bestTime = r.Total(); found = true; }
+	}
+
+	// refill without queue status query for the best combination
+	if (found)
+	{
+		t = best;
+		t.queueStatus = false;
+		if (Bench(tb, t, in, r) && r.Total() < bestTime) { best = t; bestTime = r.Total(); }
+	}
+
+	tb.Daq_Close(0);
+	tb.Daq_DeselectAll();
+	tb.SetUsbTuning(found ? best : start);
+	tb.Flush();
+	return found;
+}
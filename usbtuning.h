@@ -0,0 +1,50 @@
+// usbtuning.h
+//
+// USB transport parameters of the DTB connection and their calibration.
+// UsbTune measures the RPC round trip (small calls and VectorTest) and
+// the Daq_Read throughput for a set of transfer sizes, latency timer
+// values and read buffer sizes and selects the fastest combination.
+// The result is stored per DTB board id in psi46test.ini:
+//
+//   [USB_TUNING] <board id> <transfer size> <latency timer> <read buffer> <queue status>
+//
+// A transfer size or latency timer of 0 sets the FTDI driver default.
+
+#pragma once
+
+#include <stdio.h>
+
+
+#define USBTUNING_FILE "psi46test.ini"
+
+// FTDI driver defaults (sent for 0)
+#define USBTUNING_DEFAULT_TRANSFER_SIZE 4096 // bytes
+#define USBTUNING_DEFAULT_LATENCY_TIMER   16 // ms
+
+
+struct CUsbTuning
+{
+	unsigned int transferSize;   // FT_SetUSBParameters (bytes, 0 = driver default)
+	unsigned int latencyTimer;   // FT_SetLatencyTimer (ms, 0 = driver default)
+	unsigned int readBufferSize; // CUSB read buffer (bytes)
+	bool queueStatus;            // query FT_GetQueueStatus on each buffer refill
+
+	CUsbTuning();
+	bool operator==(const CUsbTuning &t) const
+	{
+		return transferSize == t.transferSize && latencyTimer == t.latencyTimer
+			&& readBufferSize == t.readBufferSize && queueStatus == t.queueStatus;
+	}
+	void Print(FILE *f) const;
+};
+
+
+class CTestboard;
+
+// Applies the tuning stored for the connected board (or the default one).
+void ApplyUsbTuning(CTestboard &tb, bool verbose = true);
+
+// Benchmarks the candidate parameters on the connected board.
+// Overwrites the pattern generator program and DAQ channel 0.
+// Returns false if the board does not answer.
+bool UsbTune(CTestboard &tb, CUsbTuning &best);